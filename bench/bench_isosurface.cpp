@@ -0,0 +1,189 @@
+//----------------------------------------------------------------------------
+// Isosurface Evaluation Benchmarks
+//----------------------------------------------------------------------------
+
+#include "benchmark.h"
+#include "scenes.h"
+#include <threed/boundingbox.h>
+#include <threed/transform.h>
+#include <vector>
+
+using namespace ThreeD;
+using namespace Bench;
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+enum {
+    GRID_SIZE = 64,                     // grid points along x and y
+    NUM_RANDOM_POINTS = 1 << 14         // points cycled through by batches
+};
+
+/** Random points within the bounding box of @p iso, in the
+ *  coordinates of the mesher
+ */
+void randomPoints(const Isosurface *iso, std::vector<Vector> *points)
+{
+    const BoundingBox &bbox = iso->globalBoundingBox();
+    Random rnd(42);
+    points->resize(NUM_RANDOM_POINTS);
+    for (int i = 0; i < NUM_RANDOM_POINTS; ++i)
+        (*points)[i] = Vector(
+            rnd.uniform(bbox.vmin().x(), bbox.vmax().x()),
+            rnd.uniform(bbox.vmin().y(), bbox.vmax().y()),
+            rnd.uniform(bbox.vmin().z(), bbox.vmax().z()));
+}
+
+std::vector<long> sceneArgs()
+{
+    std::vector<long> args;
+    for (int i = 0; i < numScenes(); ++i)
+        args.push_back(i);
+    return args;
+}
+
+std::vector<long> batchArgs()
+{
+    std::vector<long> args;
+    args.push_back(1);
+    args.push_back(8);
+    args.push_back(64);
+    args.push_back(256);
+    args.push_back(1024);
+    return args;
+}
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------
+
+/** Runs of range(1) grid points along z, through fDensity(), over a
+ *  grid that spans the bounding box of scene range(0)
+ */
+static void BM_GridRun(State &state)
+{
+    std::string label;
+    const Isosurface *iso = getScene(state.range(0), &label);
+    int runLength = state.range(1);
+    state.setLabel(label);
+
+    const BoundingBox &bbox = iso->globalBoundingBox();
+    Vector step = (bbox.vmax() - bbox.vmin()) / (float)GRID_SIZE;
+    float dz = (bbox.vmax().z() - bbox.vmin().z()) / (float)runLength;
+    std::vector<float> densities(runLength);
+
+    int cell = 0;
+    while (state.keepRunning()) {
+        float x = bbox.vmin().x() + (cell % GRID_SIZE) * step.x();
+        float y = bbox.vmin().y() + (cell / GRID_SIZE) * step.y();
+        iso->fDensity(x, y, bbox.vmin().z(), dz, runLength, &densities[0]);
+        doNotOptimize(&densities[0]);
+        cell = (cell + 1) % (GRID_SIZE * GRID_SIZE);
+    }
+
+    state.setItemsProcessed((double)state.iterations() * runLength);
+}
+
+BENCHMARK(BM_GridRun)->argsProduct(sceneArgs(), batchArgs());
+
+//----------------------------------------------------------------------------
+
+/** Batches of range(1) points scattered over the bounding box of scene
+ *  range(0), through fDensityPoints()
+ */
+static void BM_PointBatch(State &state)
+{
+    std::string label;
+    const Isosurface *iso = getScene(state.range(0), &label);
+    int batch = state.range(1);
+    state.setLabel(label);
+
+    std::vector<Vector> points;
+    randomPoints(iso, &points);
+    std::vector<float> xs(NUM_RANDOM_POINTS);
+    std::vector<float> ys(NUM_RANDOM_POINTS);
+    std::vector<float> zs(NUM_RANDOM_POINTS);
+    for (int i = 0; i < NUM_RANDOM_POINTS; ++i) {
+        xs[i] = points[i].x();
+        ys[i] = points[i].y();
+        zs[i] = points[i].z();
+    }
+    std::vector<float> densities(batch);
+
+    int first = 0;
+    while (state.keepRunning()) {
+        iso->fDensityPoints(&xs[first], &ys[first], &zs[first], batch,
+                            &densities[0]);
+        doNotOptimize(&densities[0]);
+        first += batch;
+        if (first + batch > NUM_RANDOM_POINTS)
+            first = 0;
+    }
+
+    state.setItemsProcessed((double)state.iterations() * batch);
+}
+
+BENCHMARK(BM_PointBatch)->argsProduct(sceneArgs(), batchArgs());
+
+//----------------------------------------------------------------------------
+
+/** Batches of range(1) scattered points, through fLeaves(), which
+ *  also finds the winning leaf of each point
+ */
+static void BM_LeafBatch(State &state)
+{
+    std::string label;
+    const Isosurface *iso = getScene(state.range(0), &label);
+    int batch = state.range(1);
+    state.setLabel(label);
+
+    std::vector<Vector> points;
+    randomPoints(iso, &points);
+    std::vector<float> densities(batch);
+    std::vector<const Isosurface *> leaves(batch);
+
+    int first = 0;
+    while (state.keepRunning()) {
+        iso->fLeaves(&points[first], batch, &densities[0], &leaves[0]);
+        doNotOptimize(&leaves[0]);
+        first += batch;
+        if (first + batch > NUM_RANDOM_POINTS)
+            first = 0;
+    }
+
+    state.setItemsProcessed((double)state.iterations() * batch);
+}
+
+BENCHMARK(BM_LeafBatch)->argsProduct(sceneArgs(), batchArgs());
+
+//----------------------------------------------------------------------------
+
+/** Gradients (normals) at scattered points of scene range(0),
+ *  range(1) points per iteration, through fNormal()
+ */
+static void BM_Gradient(State &state)
+{
+    std::string label;
+    const Isosurface *iso = getScene(state.range(0), &label);
+    int batch = state.range(1);
+    state.setLabel(label);
+
+    std::vector<Vector> points;
+    randomPoints(iso, &points);
+    Vector normal;
+
+    int first = 0;
+    while (state.keepRunning()) {
+        for (int i = 0; i < batch; ++i)
+            iso->fNormal(&points[first + i], &normal);
+        doNotOptimize(&normal);
+        first += batch;
+        if (first + batch > NUM_RANDOM_POINTS)
+            first = 0;
+    }
+
+    state.setItemsProcessed((double)state.iterations() * batch);
+}
+
+BENCHMARK(BM_Gradient)->argsProduct(sceneArgs(), std::vector<long>(1, 64));
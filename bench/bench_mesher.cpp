@@ -0,0 +1,162 @@
+//----------------------------------------------------------------------------
+// Mesher Benchmarks
+//----------------------------------------------------------------------------
+
+#include "benchmark.h"
+#include "scenes.h"
+#include <threed/sdfisosurface.h>
+#include <threed/csgisosurface.h>
+#include <threed/isomesher_mc.h>
+#include <threed/isomesher_dc.h>
+#include <threed/threadpool.h>
+#include <stdio.h>
+
+using namespace ThreeD;
+using namespace Bench;
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+enum {
+    WIDE_GRID = 4096,                   // grid points across a wide slice
+    PIPELINE_SCENE = 3,                 // union-256, costly to evaluate
+    PIPELINE_GRID = 96                  // grid points across its box
+};
+
+const float VOXEL_SIZE = 0.25f;
+
+/** Four small spheres at the corners of a square, whose grid has
+ *  slices WIDE_GRID points across, of mostly empty voxels, and few
+ *  rows, so that meshing time goes to the sweep more than to the
+ *  faces
+ */
+Isosurface *wideScene()
+{
+    static Isosurface *scene = 0;
+    if (! scene) {
+        CsgIsosurface *csg = new CsgIsosurface();
+        float corner = (WIDE_GRID - 16) * VOXEL_SIZE * 0.5f;
+        for (int i = 0; i < 4; ++i) {
+            Isosurface *sphere = new SdfSphere(0.5f);
+            Transform t;
+            t.translate(Vector((i & 1) ? corner : -corner, 0.0f,
+                               (i & 2) ? corner : -corner));
+            sphere->setTransform(t);
+            csg->addChild(sphere);
+        }
+        csg->getBoundingBox(Transform());
+        scene = csg;
+    }
+    return scene;
+}
+
+std::vector<long> mesherArgs()
+{
+    std::vector<long> args;
+    args.push_back(0);
+    args.push_back(1);
+    return args;
+}
+
+std::vector<long> tileArgs()
+{
+    std::vector<long> args;
+    args.push_back(0);
+    args.push_back(32);
+    args.push_back(64);
+    args.push_back(128);
+    return args;
+}
+
+std::vector<long> threadArgs()
+{
+    std::vector<long> args;
+    args.push_back(1);
+    args.push_back(2);
+    args.push_back(4);
+    return args;
+}
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------
+
+/** Mesh the wide scene, with MC if range(0) is 0 and DC if it is 1,
+ *  in tiles of range(1) by 512 voxels, or in whole slices if 0
+ */
+static void BM_MeshWideSlice(State &state)
+{
+    Isosurface *iso = wideScene();
+    bool dc = (state.range(0) != 0);
+    int tileSize = state.range(1);
+    float voxel = VOXEL_SIZE;
+
+    char label[64];
+    sprintf(label, "%s %dx%d", (dc ? "dc" : "mc"), WIDE_GRID, WIDE_GRID);
+    state.setLabel(label);
+
+    const BoundingBox &bbox = iso->globalBoundingBox();
+    Vector size = bbox.vmax() - bbox.vmin();
+    double points = (double)(size.x() / voxel) * (size.y() / voxel)
+                  * (size.z() / voxel);
+
+    while (state.keepRunning()) {
+        IsoMesher *mesher;
+        if (dc)
+            mesher = new IsoMesher_DC(iso);
+        else
+            mesher = new IsoMesher_MC(iso);
+        mesher->setVoxelSize(voxel, voxel, voxel);
+        mesher->setTileSize(tileSize, (tileSize != 0 ? 512 : 0));
+        Mesh *mesh = mesher->createMesh();
+        doNotOptimize(mesh);
+        delete mesh;
+        delete mesher;
+    }
+
+    state.setItemsProcessed(state.iterations() * points);
+}
+
+BENCHMARK(BM_MeshWideSlice)->argsProduct(mesherArgs(), tileArgs())
+    ->minTime(10.0)->repetitions(3);
+
+//----------------------------------------------------------------------------
+
+/** Mesh scene range(0) with MC, with the sweep pipelined over a pool
+ *  of range(1) threads, or not pipelined if 1
+ */
+static void BM_MeshPipelined(State &state)
+{
+    std::string label;
+    Isosurface *iso = getScene(state.range(0), &label);
+    int numThreads = state.range(1);
+    state.setLabel(label);
+
+    const BoundingBox &bbox = iso->globalBoundingBox();
+    Vector size = bbox.vmax() - bbox.vmin();
+    float extent = size.x();
+    if (size.y() > extent)
+        extent = size.y();
+    if (size.z() > extent)
+        extent = size.z();
+    float voxel = extent / PIPELINE_GRID;
+
+    ThreadPool pool(numThreads);
+
+    while (state.keepRunning()) {
+        IsoMesher_MC mesher(iso);
+        mesher.setVoxelSize(voxel, voxel, voxel);
+        if (numThreads > 1)
+            mesher.setThreadPool(&pool);
+        Mesh *mesh = mesher.createMesh();
+        doNotOptimize(mesh);
+        delete mesh;
+    }
+
+    state.setItemsProcessed((double)state.iterations() *
+                            PIPELINE_GRID * PIPELINE_GRID * PIPELINE_GRID);
+}
+
+BENCHMARK(BM_MeshPipelined)->argsProduct(
+    std::vector<long>(1, PIPELINE_SCENE), threadArgs());
@@ -0,0 +1,270 @@
+//----------------------------------------------------------------------------
+// Benchmark Harness
+//----------------------------------------------------------------------------
+
+#include "benchmark.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+using namespace Bench;
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+const void *volatile sink;
+
+std::vector<Benchmark *> &registry()
+{
+    static std::vector<Benchmark *> benchmarks;
+    return benchmarks;
+}
+
+std::string formatRate(double rate)
+{
+    static const char *units[] = { "", "k", "M", "G", "T" };
+    int u = 0;
+    while (rate >= 1000.0 && u < 4) {
+        rate /= 1000.0;
+        ++u;
+    }
+    char buf[32];
+    sprintf(buf, "%.3g%s/s", rate, units[u]);
+    return buf;
+}
+
+// one timed run of a benchmark
+
+struct Result {
+    long iterations;
+    double seconds;
+    double items;
+    std::string label;
+};
+
+// grow the iterations until a run takes long enough, aiming a little
+// past the minimum time
+
+Result timeRun(Function func, const std::vector<long> &args, double minTime)
+{
+    long iterations = 1;
+    while (1) {
+        State state(args, iterations);
+        func(state);
+
+        double seconds = state.seconds();
+        if (seconds >= minTime || iterations >= 1000000000L) {
+            Result result;
+            result.iterations = iterations;
+            result.seconds = seconds;
+            result.items = state.items();
+            result.label = state.label();
+            return result;
+        }
+
+        double grow = (seconds > 0.0 ? minTime * 1.4 / seconds : 10.0);
+        if (grow > 10.0)
+            grow = 10.0;
+        if (grow < 2.0)
+            grow = 2.0;
+        iterations = (long)(iterations * grow);
+    }
+}
+
+void printResult(const std::string &name, long iterations, double ns,
+                 double itemsPerSecond, const std::string &label)
+{
+    std::string items = "";
+    if (itemsPerSecond > 0.0)
+        items = formatRate(itemsPerSecond);
+    printf("%-36s %12ld %14.0f %14s  %s\n",
+           name.c_str(), iterations, ns, items.c_str(), label.c_str());
+    fflush(stdout);
+}
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------
+
+double Bench::now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+//----------------------------------------------------------------------------
+
+void Bench::doNotOptimize(const void *p)
+{
+    sink = p;
+}
+
+//----------------------------------------------------------------------------
+
+State::State(const std::vector<long> &args, long iterations)
+    : _args(args), _iterations(iterations)
+{
+    _count = 0;
+    _start = 0.0;
+    _seconds = 0.0;
+    _items = 0.0;
+}
+
+//----------------------------------------------------------------------------
+
+bool State::keepRunning()
+{
+    if (_count == 0)
+        _start = now();
+    if (_count < _iterations) {
+        ++_count;
+        return true;
+    }
+    _seconds += now() - _start;
+    return false;
+}
+
+//----------------------------------------------------------------------------
+
+void State::pauseTiming()
+{
+    _seconds += now() - _start;
+}
+
+//----------------------------------------------------------------------------
+
+void State::resumeTiming()
+{
+    _start = now();
+}
+
+//----------------------------------------------------------------------------
+
+Benchmark::Benchmark(const char *name, Function func)
+    : _name(name), _func(func)
+{
+    _minTime = 0.0;
+    _repetitions = 1;
+}
+
+//----------------------------------------------------------------------------
+
+Benchmark *Benchmark::arg(long a)
+{
+    _argSets.push_back(std::vector<long>(1, a));
+    return this;
+}
+
+//----------------------------------------------------------------------------
+
+Benchmark *Benchmark::args(long a, long b)
+{
+    std::vector<long> set;
+    set.push_back(a);
+    set.push_back(b);
+    _argSets.push_back(set);
+    return this;
+}
+
+//----------------------------------------------------------------------------
+
+Benchmark *Benchmark::argsProduct(const std::vector<long> &as,
+                                  const std::vector<long> &bs)
+{
+    for (unsigned int i = 0; i < as.size(); ++i)
+        for (unsigned int j = 0; j < bs.size(); ++j)
+            args(as[i], bs[j]);
+    return this;
+}
+
+//----------------------------------------------------------------------------
+
+Benchmark *Benchmark::minTime(double seconds)
+{
+    _minTime = seconds;
+    return this;
+}
+
+//----------------------------------------------------------------------------
+
+Benchmark *Benchmark::repetitions(int count)
+{
+    _repetitions = (count >= 1 ? count : 1);
+    return this;
+}
+
+//----------------------------------------------------------------------------
+
+int Benchmark::runAll(const char *filter, double minTime)
+{
+    int runs = 0;
+
+    printf("%-36s %12s %14s %14s  %s\n",
+           "benchmark", "iterations", "ns/iteration", "items", "label");
+
+    std::vector<Benchmark *> &benchmarks = registry();
+    for (unsigned int b = 0; b < benchmarks.size(); ++b) {
+        const Benchmark *bench = benchmarks[b];
+
+        std::vector<std::vector<long> > argSets = bench->_argSets;
+        if (argSets.empty())
+            argSets.push_back(std::vector<long>());
+
+        for (unsigned int a = 0; a < argSets.size(); ++a) {
+            const std::vector<long> &args = argSets[a];
+
+            std::string name = bench->_name;
+            for (unsigned int i = 0; i < args.size(); ++i) {
+                char buf[32];
+                sprintf(buf, "/%ld", args[i]);
+                name += buf;
+            }
+            if (filter && ! strstr(name.c_str(), filter))
+                continue;
+
+            double time = (bench->_minTime > minTime ?
+                           bench->_minTime : minTime);
+            int count = bench->_repetitions;
+            double sumNs = 0.0, sumNs2 = 0.0, sumRate = 0.0;
+            long sumIterations = 0;
+            std::string label;
+            for (int r = 0; r < count; ++r) {
+                Result result = timeRun(bench->_func, args, time);
+                double ns = result.seconds * 1e9 / result.iterations;
+                double rate = (result.seconds > 0.0 ?
+                               result.items / result.seconds : 0.0);
+                printResult(name, result.iterations, ns, rate, result.label);
+                sumNs += ns;
+                sumNs2 += ns * ns;
+                sumRate += rate;
+                sumIterations += result.iterations;
+                label = result.label;
+            }
+
+            if (count > 1) {
+                double mean = sumNs / count;
+                double variance = (sumNs2 - sumNs * mean) / (count - 1);
+                printResult(name + "_mean", sumIterations, mean,
+                            sumRate / count, label);
+                printResult(name + "_stddev", sumIterations,
+                            (variance > 0.0 ? sqrt(variance) : 0.0),
+                            0.0, label);
+            }
+            ++runs;
+        }
+    }
+
+    return runs;
+}
+
+//----------------------------------------------------------------------------
+
+Benchmark *Bench::registerBenchmark(const char *name, Function func)
+{
+    Benchmark *bench = new Benchmark(name, func);
+    registry().push_back(bench);
+    return bench;
+}
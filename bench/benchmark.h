@@ -0,0 +1,150 @@
+//----------------------------------------------------------------------------
+// Benchmark Harness
+//----------------------------------------------------------------------------
+
+#ifndef _BENCH_BENCHMARK_H
+#define _BENCH_BENCHMARK_H
+
+#include <string>
+#include <vector>
+
+namespace Bench {
+
+
+/**
+ * State, handed to a benchmark function on each run
+ *
+ * The function sets up its workload, then times the work in a loop:
+ *
+ *     while (state.keepRunning())
+ *         iso->fDensity(...);
+ *     state.setItemsProcessed(state.iterations() * numPoints);
+ *
+ * The runner calls the function with more and more iterations, until
+ * the loop takes at least the minimum time.
+ */
+class State
+{
+public:
+    State(const std::vector<long> &args, long iterations);
+
+    /** @return true while there are iterations left to time
+     */
+    bool keepRunning();
+
+    /** @return the @p n'th argument of the benchmark */
+    long range(int n) const { return _args[n]; }
+
+    /** @return the number of iterations of this run */
+    long iterations() const { return _iterations; }
+
+    /** Set the number of items (samples) that the run processed,
+     *  for the items per second column
+     */
+    void setItemsProcessed(double items) { _items = items; }
+
+    /** Set a label to print with the results */
+    void setLabel(const std::string &label) { _label = label; }
+
+    /** Stop the timer, eg. around setup inside the loop */
+    void pauseTiming();
+
+    /** Restart the timer */
+    void resumeTiming();
+
+    /** @return the seconds timed */
+    double seconds() const { return _seconds; }
+
+    /** @return the items set by setItemsProcessed() */
+    double items() const { return _items; }
+
+    /** @return the label set by setLabel() */
+    const std::string &label() const { return _label; }
+
+private:
+    std::vector<long> _args;
+    long _iterations;
+    long _count;
+    double _start;
+    double _seconds;
+    double _items;
+    std::string _label;
+};
+
+
+typedef void (*Function)(State &state);
+
+
+/**
+ * Benchmark, a function and the sets of arguments to run it with
+ */
+class Benchmark
+{
+public:
+    Benchmark(const char *name, Function func);
+
+    /** Run with one argument */
+    Benchmark *arg(long a);
+
+    /** Run with two arguments */
+    Benchmark *args(long a, long b);
+
+    /** Run with every pair of @p as and @p bs */
+    Benchmark *argsProduct(const std::vector<long> &as,
+                           const std::vector<long> &bs);
+
+    /** Time each run for at least @p seconds, over the minimum time
+     *  given to runAll()
+     */
+    Benchmark *minTime(double seconds);
+
+    /** Repeat each run @p count times, and print the mean and the
+     *  standard deviation of the repeats after them
+     */
+    Benchmark *repetitions(int count);
+
+    /** Run every set of arguments whose name contains @p filter, each
+     *  for at least @p minTime seconds, and print the results
+     *
+     *  @return the number of runs
+     */
+    static int runAll(const char *filter, double minTime);
+
+private:
+    std::string _name;
+    Function _func;
+    std::vector<std::vector<long> > _argSets;
+    double _minTime;
+    int _repetitions;
+};
+
+
+/** Register a benchmark; see BENCHMARK()
+ */
+Benchmark *registerBenchmark(const char *name, Function func);
+
+/** @return the current time in seconds
+ */
+double now();
+
+/** Keep the compiler from optimizing away a computed value
+ */
+void doNotOptimize(const void *p);
+
+
+} // namespace Bench
+
+
+#define BENCH_CONCAT2(a, b) a##b
+#define BENCH_CONCAT(a, b) BENCH_CONCAT2(a, b)
+
+/** Register function @p func as a benchmark, eg.
+ *
+ *      BENCHMARK(BM_GridRun)->args(0, 64)->args(0, 256);
+ *      BENCHMARK(BM_MeshWideSlice)->arg(0)->repetitions(5);
+ */
+#define BENCHMARK(func)                                             \
+    static Bench::Benchmark *BENCH_CONCAT(_bench_, __LINE__) =      \
+        Bench::registerBenchmark(#func, func)
+
+#endif // _BENCH_BENCHMARK_H
@@ -0,0 +1,44 @@
+//----------------------------------------------------------------------------
+// Benchmark Runner
+//----------------------------------------------------------------------------
+
+#include "benchmark.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//----------------------------------------------------------------------------
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--min_time=SECONDS] [FILTER]\n"
+            "  runs the benchmarks whose name contains FILTER, eg.\n"
+            "  BM_GridRun/4/ for every run length over scene 4\n",
+            argv0);
+}
+
+//----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    double minTime = 0.2;
+    const char *filter = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--min_time=", 11) == 0)
+            minTime = atof(argv[i] + 11);
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else
+            filter = argv[i];
+    }
+
+    int runs = Bench::Benchmark::runAll(filter, minTime);
+    if (runs == 0) {
+        fprintf(stderr, "no benchmark matches %s\n", filter);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+//----------------------------------------------------------------------------
+// Benchmark Scenes
+//----------------------------------------------------------------------------
+
+#include "scenes.h"
+#include <threed/csgisosurface.h>
+#include <threed/transform.h>
+#include <stdio.h>
+#include <math.h>
+#include "sphere.h"
+#include "box.h"
+
+using namespace ThreeD;
+using namespace Bench;
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+struct SceneSpec {
+    SceneKind kind;
+    int size;
+    const char *name;
+};
+
+const SceneSpec sceneSpecs[] = {
+    { SCENE_SPHERE,          1,      "sphere" },
+    { SCENE_BOX,             1,      "box" },
+    { SCENE_UNION,           16,     "union-16" },
+    { SCENE_UNION,           256,    "union-256" },
+    { SCENE_UNION,           10000,  "union-10000" },
+    { SCENE_SMOOTH_UNION,    16,     "smooth-union-16" },
+    { SCENE_DIFFERENCE_CHAIN, 4,     "difference-chain-4" },
+    { SCENE_DIFFERENCE_CHAIN, 16,    "difference-chain-16" },
+    { SCENE_DIFFERENCE_CHAIN, 64,    "difference-chain-64" },
+    { SCENE_TREE,            3,      "tree-depth-3" },
+    { SCENE_TREE,            6,      "tree-depth-6" },
+    { SCENE_TREE,            9,      "tree-depth-9" }
+};
+
+const int NUM_SCENES = sizeof(sceneSpecs) / sizeof(sceneSpecs[0]);
+
+//----------------------------------------------------------------------------
+
+/** A sphere or a box, about @p scale across, rotated at random and
+ *  placed within @p extent of the origin
+ */
+Isosurface *makePrimitive(Random *rnd, float scale, float extent)
+{
+    Isosurface *iso;
+    if (rnd->uniform() < 0.5f)
+        iso = new SphereIsosurface(scale * rnd->uniform(0.3f, 0.5f));
+    else
+        iso = new BoxIsosurface(Vector(scale * rnd->uniform(0.4f, 1.0f),
+                                       scale * rnd->uniform(0.4f, 1.0f),
+                                       scale * rnd->uniform(0.4f, 1.0f)));
+
+    Transform t;
+    t.translate(Vector(rnd->uniform(-extent, extent),
+                       rnd->uniform(-extent, extent),
+                       rnd->uniform(-extent, extent)));
+    t.rotate(Vector(rnd->uniform(0.0f, 360.0f),
+                    rnd->uniform(0.0f, 360.0f),
+                    rnd->uniform(0.0f, 360.0f)));
+    iso->setTransform(t);
+    return iso;
+}
+
+//----------------------------------------------------------------------------
+
+/** A csg of @p size primitives, combined in @p mode
+ */
+Isosurface *makeFlat(Random *rnd, CsgIsosurface::CSG_Mode mode, int size)
+{
+    // keep the density of primitives about the same at every size
+    float extent = 2.0f * (float)pow((double)size, 1.0 / 3.0);
+
+    CsgIsosurface *csg = new CsgIsosurface();
+    csg->setCsgMode(mode);
+    if (mode == CsgIsosurface::CSG_SMOOTH_UNION)
+        csg->setSmoothRadius(0.2f);
+    for (int i = 0; i < size; ++i)
+        csg->addChild(makePrimitive(rnd, 1.5f, extent));
+    return csg;
+}
+
+//----------------------------------------------------------------------------
+
+/** A box with @p depth primitives cut out of it, one at each level
+ *  of a chain of differences
+ */
+Isosurface *makeChain(Random *rnd, int depth)
+{
+    Isosurface *iso = new BoxIsosurface(Vector(4.0f, 4.0f, 4.0f));
+    for (int i = 0; i < depth; ++i) {
+        CsgIsosurface *csg = new CsgIsosurface();
+        csg->setCsgMode(CsgIsosurface::CSG_DIFFERENCE);
+        csg->addChild(iso);
+        csg->addChild(makePrimitive(rnd, 1.0f, 2.0f));
+        iso = csg;
+    }
+    return iso;
+}
+
+//----------------------------------------------------------------------------
+
+/** A balanced binary tree @p depth levels deep, with primitives at
+ *  the leaves and a random operation at every node
+ */
+Isosurface *makeTree(Random *rnd, int depth, float extent)
+{
+    if (depth == 0)
+        return makePrimitive(rnd, 1.5f, extent);
+
+    static const CsgIsosurface::CSG_Mode modes[] = {
+        CsgIsosurface::CSG_UNION,
+        CsgIsosurface::CSG_UNION,
+        CsgIsosurface::CSG_INTERSECTION,
+        CsgIsosurface::CSG_DIFFERENCE
+    };
+
+    CsgIsosurface *csg = new CsgIsosurface();
+    csg->setCsgMode(modes[(int)(rnd->uniform() * 4.0f)]);
+    csg->addChild(makeTree(rnd, depth - 1, extent));
+    csg->addChild(makeTree(rnd, depth - 1, extent));
+    return csg;
+}
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------
+
+Isosurface *Bench::makeScene(SceneKind kind, int size, unsigned long seed)
+{
+    Random rnd(seed);
+
+    switch (kind) {
+        case SCENE_SPHERE:
+            return new SphereIsosurface(2.0f);
+        case SCENE_BOX:
+            return new BoxIsosurface(Vector(3.0f, 4.0f, 2.0f));
+        case SCENE_UNION:
+            return makeFlat(&rnd, CsgIsosurface::CSG_UNION, size);
+        case SCENE_SMOOTH_UNION:
+            return makeFlat(&rnd, CsgIsosurface::CSG_SMOOTH_UNION, size);
+        case SCENE_DIFFERENCE_CHAIN:
+            return makeChain(&rnd, size);
+        case SCENE_TREE:
+            return makeTree(&rnd, size,
+                            2.0f * (float)pow(2.0, size / 3.0));
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+
+int Bench::numScenes()
+{
+    return NUM_SCENES;
+}
+
+//----------------------------------------------------------------------------
+
+Isosurface *Bench::getScene(int index, std::string *label)
+{
+    static Isosurface *scenes[NUM_SCENES];
+
+    const SceneSpec &spec = sceneSpecs[index];
+    if (! scenes[index]) {
+        scenes[index] = makeScene(spec.kind, spec.size, 1234567ul + index);
+        scenes[index]->getBoundingBox(Transform());
+    }
+    if (label)
+        *label = spec.name;
+    return scenes[index];
+}
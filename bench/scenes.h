@@ -0,0 +1,64 @@
+//----------------------------------------------------------------------------
+// Benchmark Scenes
+//----------------------------------------------------------------------------
+
+#ifndef _BENCH_SCENES_H
+#define _BENCH_SCENES_H
+
+#include <threed/isosurface.h>
+#include <string>
+
+namespace Bench {
+
+
+/**
+ * Random, a small generator that gives the same numbers on every
+ * platform, so scenes are the same wherever they are built
+ */
+class Random
+{
+public:
+    Random(unsigned long seed) : _state(seed) {}
+
+    /** @return a number in [0,1) */
+    float uniform()
+    {
+        _state = (_state * 1103515245ul + 12345ul) & 0x7FFFFFFFul;
+        return (float)(_state >> 7) / (float)(1ul << 24);
+    }
+
+    /** @return a number in [lo,hi) */
+    float uniform(float lo, float hi) { return lo + (hi - lo) * uniform(); }
+
+private:
+    unsigned long _state;
+};
+
+
+enum SceneKind {
+    SCENE_SPHERE,                       // one primitive
+    SCENE_BOX,
+    SCENE_UNION,                        // @p size primitives in a union
+    SCENE_SMOOTH_UNION,
+    SCENE_DIFFERENCE_CHAIN,             // @p size differences, nested
+    SCENE_TREE                          // balanced, @p size levels deep
+};
+
+/** Build a scene of sphere and box primitives, at random positions,
+ *  sizes and rotations drawn from @p seed.  The primitives are spread
+ *  so that a grid over the bounding box crosses about as much surface
+ *  whatever the size.
+ */
+ThreeD::Isosurface *makeScene(SceneKind kind, int size, unsigned long seed);
+
+/** @return the number of scenes that benchmarks sweep over */
+int numScenes();
+
+/** @return scene number @p index, built and prepared on first use
+ *  and kept for later benchmarks.  @p label receives its name.
+ */
+ThreeD::Isosurface *getScene(int index, std::string *label);
+
+
+} // namespace Bench
+#endif // _BENCH_SCENES_H
@@ -0,0 +1,167 @@
+//----------------------------------------------------------------------------
+// Concurrent Mesher Stress Test
+//----------------------------------------------------------------------------
+
+/*
+ * Runs the MC, DC and brick meshers at once, each on a thread of its
+ * own, over one CSG scene that was prepared beforehand, and checks
+ * that each run makes as many faces and points as the same mesher run
+ * alone.  Meant to be built, with the library, for ThreadSanitizer:
+ *
+ *     make -C ../threed clean all CXXFLAGS=-fsanitize=thread
+ *     make clean stress CXXFLAGS=-fsanitize=thread
+ *     ./stress
+ */
+
+#include "scenes.h"
+#include <threed/isomesher_mc.h>
+#include <threed/isomesher_dc.h>
+#include <threed/isomesher_brick.h>
+#include <threed/mesh_opt.h>
+#include <threed/threadpool.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ThreeD;
+using namespace Bench;
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+enum {
+    MESHER_MC,
+    MESHER_DC,
+    MESHER_BRICK,
+    NUM_MESHERS
+};
+
+const char *mesherNames[NUM_MESHERS] = { "mc", "dc", "brick" };
+
+const int GRID_POINTS = 32;             // grid points across the scene
+
+/**
+ * Run, one mesher over the scene, and the size of the mesh it made
+ */
+struct Run {
+    Isosurface *iso;
+    int mesher;
+    float voxel;
+    int numThreads;                     // of a pool of its own, or 1
+    int faces;
+    int points;
+};
+
+void meshOnce(Run *run)
+{
+    IsoMesher *mesher;
+    if (run->mesher == MESHER_MC)
+        mesher = new IsoMesher_MC(run->iso);
+    else if (run->mesher == MESHER_DC)
+        mesher = new IsoMesher_DC(run->iso);
+    else
+        mesher = new IsoMesher_Brick(run->iso);
+    mesher->setVoxelSize(run->voxel, run->voxel, run->voxel);
+
+    ThreadPool *pool = 0;
+    if (run->numThreads > 1) {
+        pool = new ThreadPool(run->numThreads);
+        mesher->setThreadPool(pool);
+    }
+
+    Mesh *mesh = mesher->createMesh();
+    IndexedMesh imesh;
+    Mesh_Opt::getIndexedMesh(mesh, &imesh);
+    run->faces = imesh.numFaces();
+    run->points = (int)imesh.points.size();
+
+    delete mesher;
+    delete mesh;
+    delete pool;
+}
+
+void *runThread(void *arg)
+{
+    meshOnce((Run *)arg);
+    return 0;
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--rounds=N] [--threads=N]\n"
+            "  meshes with MC, DC and bricks at once N rounds (default\n"
+            "  10), each mesher with a pool of --threads threads, or none\n",
+            argv0);
+}
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    int rounds = 10;
+    int numThreads = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--rounds=", 9) == 0)
+            rounds = atoi(argv[i] + 9);
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+            numThreads = atoi(argv[i] + 10);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // prepare the scene once, before any mesher starts:  createMesh()
+    // prepares it again, which writes nothing only if it was prepared
+
+    Isosurface *iso = makeScene(SCENE_DIFFERENCE_CHAIN, 4, 1234567ul);
+    BoundingBox bbox = iso->getBoundingBox(Transform());
+    Vector size = bbox.vmax() - bbox.vmin();
+    float extent = size.x();
+    if (size.y() > extent)
+        extent = size.y();
+    if (size.z() > extent)
+        extent = size.z();
+
+    Run expected[NUM_MESHERS];
+    int m;
+    for (m = 0; m < NUM_MESHERS; ++m) {
+        Run &run = expected[m];
+        run.iso = iso;
+        run.mesher = m;
+        run.voxel = extent / GRID_POINTS;
+        run.numThreads = numThreads;
+        meshOnce(&run);
+        printf("%-6s %d faces, %d points\n",
+               mesherNames[m], run.faces, run.points);
+    }
+
+    int failures = 0;
+    for (int round = 0; round < rounds; ++round) {
+        Run runs[NUM_MESHERS];
+        pthread_t threads[NUM_MESHERS];
+        for (m = 0; m < NUM_MESHERS; ++m) {
+            runs[m] = expected[m];
+            pthread_create(&threads[m], 0, runThread, &runs[m]);
+        }
+        for (m = 0; m < NUM_MESHERS; ++m) {
+            pthread_join(threads[m], 0);
+            if (runs[m].faces != expected[m].faces ||
+                    runs[m].points != expected[m].points) {
+                printf("round %d: %s made %d faces, %d points\n",
+                       round, mesherNames[m], runs[m].faces, runs[m].points);
+                ++failures;
+            }
+        }
+    }
+
+    printf("%d rounds, %d failures\n", rounds, failures);
+    delete iso;
+    return (failures == 0 ? 0 : 1);
+}
@@ -27,7 +27,7 @@ BoxIsosurface::BoxIsosurface(const ThreeD::Vector &size)
 
 //----------------------------------------------------------------------------
 
-double BoxIsosurface::calcDensity(float xt, float yt, float zt)
+double BoxIsosurface::calcDensity(float xt, float yt, float zt) const
 {
     xt -= _center.x();
     yt -= _center.y();
@@ -43,24 +43,18 @@ double BoxIsosurface::calcDensity(float xt, float yt, float zt)
 
 //----------------------------------------------------------------------------
 
-void BoxIsosurface::fDensity(
-    float x0, float y0, float z0,
-    float dz, int num_points, float *densities)
+void BoxIsosurface::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
 {
-    for (int i = 0; i < num_points; ++i) {
-        float xt, yt, zt;
-        _globalTransInv.transform(x0, y0, z0, &xt, &yt, &zt);
-
-        densities[i] = calcDensity(xt, yt, zt);
-
-        z0 += dz;
-    }
+    for (int i = 0; i < num_points; ++i)
+        densities[i] = calcDensity(xs[i], ys[i], zs[i]);
 }
 
 //----------------------------------------------------------------------------
 
 void BoxIsosurface::fNormal(
-    const ThreeD::Vector *point, ThreeD::Vector *normal)
+    const ThreeD::Vector *point, ThreeD::Vector *normal) const
 {
     float xt, yt, zt;
     _globalTransInv.transform(
@@ -79,7 +73,7 @@ void BoxIsosurface::fNormal(
 //----------------------------------------------------------------------------
 
 const ThreeD::Isosurface::Material &BoxIsosurface::fMaterial(
-    const ThreeD::Vector *point, float density)
+    const ThreeD::Vector *point, float density) const
 {
     return _mat;
 }
@@ -3,17 +3,17 @@ class BoxIsosurface : public ThreeD::Isosurface {
 public:
     BoxIsosurface(const ThreeD::Vector &size);
 
-    inline double calcDensity(float xt, float yt, float zt);
+    inline double calcDensity(float xt, float yt, float zt) const;
 
-    virtual void fDensity(
-        float x0, float y0, float z0,
-        float dz, int num_points, float *densities);
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
 
     virtual void fNormal(
-        const ThreeD::Vector *point, ThreeD::Vector *normal);
+        const ThreeD::Vector *point, ThreeD::Vector *normal) const;
 
     virtual const Material &fMaterial(
-        const ThreeD::Vector *point, float density);
+        const ThreeD::Vector *point, float density) const;
 
     /*
      * data
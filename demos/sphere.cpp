@@ -24,7 +24,7 @@ SphereIsosurface::SphereIsosurface(float rad)
 
 //----------------------------------------------------------------------------
 
-double SphereIsosurface::calcDensity(float xt, float yt, float zt)
+double SphereIsosurface::calcDensity(float xt, float yt, float zt) const
 {
     xt -= _center.x();
     yt -= _center.y();
@@ -39,24 +39,18 @@ double SphereIsosurface::calcDensity(float xt, float yt, float zt)
 
 //----------------------------------------------------------------------------
 
-void SphereIsosurface::fDensity(
-    float x0, float y0, float z0,
-    float dz, int num_points, float *densities)
+void SphereIsosurface::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
 {
-    for (int i = 0; i < num_points; ++i) {
-        float xt, yt, zt;
-        _globalTransInv.transform(x0, y0, z0, &xt, &yt, &zt);
-
-        densities[i] = calcDensity(xt, yt, zt);
-
-        z0 += dz;
-    }
+    for (int i = 0; i < num_points; ++i)
+        densities[i] = calcDensity(xs[i], ys[i], zs[i]);
 }
 
 //----------------------------------------------------------------------------
 
 void SphereIsosurface::fNormal(
-    const ThreeD::Vector *point, ThreeD::Vector *normal)
+    const ThreeD::Vector *point, ThreeD::Vector *normal) const
 {
     float xt, yt, zt;
     _globalTransInv.transform(
@@ -75,7 +69,7 @@ void SphereIsosurface::fNormal(
 //----------------------------------------------------------------------------
 
 const ThreeD::Isosurface::Material &SphereIsosurface::fMaterial(
-    const ThreeD::Vector *point, float density)
+    const ThreeD::Vector *point, float density) const
 {
     return _mat;
 }
@@ -3,6 +3,7 @@
 //----------------------------------------------------------------------------
 
 #include <threed/csgisosurface.h>
+#include <threed/misc.h>
 #include <stdlib.h>
 
 using namespace ThreeD;
@@ -11,7 +12,9 @@ using namespace ThreeD;
 
 CsgIsosurface::CsgIsosurface()
 {
-    _maxPoints = 0;
+    _csg_mode = CSG_UNION;
+    _smoothFunc = SMOOTH_POLYNOMIAL;
+    _smoothRadius = 1.0f;
 }
 
 //----------------------------------------------------------------------------
@@ -24,11 +27,6 @@ CsgIsosurface::~CsgIsosurface()
         it = _children.erase(it);
         delete child;
     }
-
-    if (_maxPoints) {
-        free(_densities);
-        _maxPoints = 0;
-    }
 }
 
 //----------------------------------------------------------------------------
@@ -40,104 +38,364 @@ void CsgIsosurface::setCsgMode(CSG_Mode csg_mode)
 
 //----------------------------------------------------------------------------
 
+void CsgIsosurface::setSmoothRadius(float radius)
+{
+    _smoothRadius = radius;
+}
+
+//----------------------------------------------------------------------------
+
+void CsgIsosurface::setSmoothFunc(Smooth_Func func)
+{
+    _smoothFunc = func;
+}
+
+//----------------------------------------------------------------------------
+
 void CsgIsosurface::addChild(Isosurface *child)
 {
     _children.push_back(child);
+
+    ChildTrans childTrans;
+    childTrans.trans = child->transform();
+    childTrans.inv = childTrans.trans;
+    childTrans.inv.invert();
+    childTrans.identity = childTrans.trans.isIdentity();
+    _childTrans.push_back(childTrans);
 }
 
 //----------------------------------------------------------------------------
 
-BoundingBox CsgIsosurface::getBoundingBox(
-    const Transform &combinedTrans)
+void CsgIsosurface::prepare(const Transform &combinedTrans)
 {
-    Transform t(_localTrans);
-    t *= combinedTrans;
+    Transform globalTrans(_localTrans);
+    globalTrans *= combinedTrans;
+    setGlobalTrans(globalTrans);
+
+    // the children are always visited, as their transforms may have
+    // changed even if that of the csg did not, but like the children,
+    // nothing is written unless it changed
 
     BoundingBox bbox;
+    int c = 0;
     std::list<Isosurface *>::iterator it = _children.begin();
     while (it != _children.end()) {
         Isosurface *child = (*it);
         ++it;
-        const BoundingBox &child_bbox = child->getBoundingBox(t);
-        bbox.merge(child_bbox);
+        child->prepare(_globalTrans);
+        bbox.merge(child->globalBoundingBox());
+
+        ChildTrans &childTrans = _childTrans[c++];
+        if (! (childTrans.trans == child->transform())) {
+            childTrans.trans = child->transform();
+            childTrans.inv = childTrans.trans;
+            childTrans.inv.invert();
+            childTrans.identity = childTrans.trans.isIdentity();
+        }
+    }
+
+    // bounds added to the csg itself, eg. to make room for a blend
+
+    if (_bbox != BoundingBox()) {
+        BoundingBox own_bbox = _bbox;
+        own_bbox.transform(_globalTrans);
+        bbox.merge(own_bbox);
     }
 
-    return bbox;
+    if (bbox != _globalBBox)
+        _globalBBox = bbox;
 }
 
 //----------------------------------------------------------------------------
 
 void CsgIsosurface::fDensity_n(
     float x0, float y0, float z0,
-    float dz, int num_points, float *densities)
+    float dz, int first, int num_points, float *densities,
+    const Isosurface **leaves) const
 {
     // the case where there are no actual children in the csg
     if (_children.empty()) {
-        for (int i = 0; i < num_points; ++i)
+        for (int i = 0; i < num_points; ++i) {
             densities[i] = 1.0f;
+            if (leaves)
+                leaves[i] = this;
+        }
         return;
     }
 
-    // do the first child isosurface
-    std::list<Isosurface *>::const_iterator it = _children.begin();
-    Isosurface *child = (*it);
-    ++it;
-    child->fDensity(x0, y0, z0, dz, num_points, densities);
+    float xs[RUN_CHUNK], ys[RUN_CHUNK], zs[RUN_CHUNK];
+    float densities2[RUN_CHUNK];
+
+    // chunk c of the run starts at z0 + c * RUN_CHUNK * dz, and is
+    // evaluated from there, skipping the points before @p first
+
+    int end = first + num_points;
+    int i = first;
+    while (i < end) {
+        int start = i - i % RUN_CHUNK;
+        int skip = i - start;
+        int n = THREED_MIN(end, start + RUN_CHUNK) - i;
+        float z = z0 + start * dz;
+        int at = i - first;
+        float *dens = &densities[at];
+        bool haveLocal = false;
+        i += n;
+
+        // the leaves are followed down the children in csg coordinates
+
+        if (leaves) {
+            _globalTransInv.transformRun(
+                x0, y0, z, dz, skip, n, xs, ys, zs);
+            fLeavesPoints(xs, ys, zs, n, dens, &leaves[at]);
+            continue;
+        }
 
-    // allocate temporary storage for CSG operation
-    if (num_points > _maxPoints) {
-        if (_maxPoints)
-            free(_densities);
-        _maxPoints = num_points;
-        _densities = (float *)malloc(sizeof(float) * _maxPoints);
+        int c = 0;
+        std::list<Isosurface *>::const_iterator it = _children.begin();
+        while (it != _children.end()) {
+            const Isosurface *child = (*it);
+            ++it;
+            float *out = (c == 0 ? dens : densities2);
+
+            // a child that is not transformed relative to the csg
+            // shares the run transformed into csg coordinates, while
+            // any other child transforms the run with its own global
+            // transform, composed once by getBoundingBox().  Part of a
+            // chunk, or a single point, goes through fDensityRun(), as
+            // fDensity() of a csg child takes one point by another path
+
+            if (_childTrans[c++].identity) {
+                if (! haveLocal) {
+                    _globalTransInv.transformRun(
+                        x0, y0, z, dz, skip, n, xs, ys, zs);
+                    haveLocal = true;
+                }
+                child->fDensityPoints(xs, ys, zs, n, out);
+            } else if (skip == 0 && n > 1)
+                child->fDensity(x0, y0, z, dz, n, out);
+            else
+                child->fDensityRun(x0, y0, z, dz, skip, n, out);
+
+            if (out == densities2)
+                combineDensities(dens, densities2, n);
+        }
     }
+}
 
-    // union
+//----------------------------------------------------------------------------
 
-    if (_csg_mode == CSG_UNION) {
+void CsgIsosurface::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    // the case where there are no actual children in the csg
+    if (_children.empty()) {
+        for (int i = 0; i < num_points; ++i)
+            densities[i] = 1.0f;
+        return;
+    }
+
+    float cxs[RUN_CHUNK], cys[RUN_CHUNK], czs[RUN_CHUNK];
+    float densities2[RUN_CHUNK];
+
+    for (int i = 0; i < num_points; i += RUN_CHUNK) {
+        int n = THREED_MIN(num_points - i, RUN_CHUNK);
+
+        int c = 0;
+        std::list<Isosurface *>::const_iterator it = _children.begin();
         while (it != _children.end()) {
-            Isosurface *child = (*it);
+            const Isosurface *child = (*it);
             ++it;
-            child->fDensity(x0, y0, z0, dz, num_points, _densities);
-            for (int i = 0; i < num_points; ++i)
-                if (_densities[i] < densities[i])
-                    densities[i] = _densities[i];
+            float *out = (c == 0 ? &densities[i] : densities2);
+
+            const ChildTrans &childTrans = _childTrans[c++];
+            if (childTrans.identity)
+                child->fDensityPoints(&xs[i], &ys[i], &zs[i], n, out);
+            else {
+                childTrans.inv.transformPoints(
+                    &xs[i], &ys[i], &zs[i], n, cxs, cys, czs);
+                child->fDensityPoints(cxs, cys, czs, n, out);
+            }
+
+            if (out == densities2)
+                combineDensities(&densities[i], densities2, n);
         }
+    }
+}
 
-    // intersection
+//----------------------------------------------------------------------------
 
-    } else if (_csg_mode == CSG_INTERSECTION) {
+void CsgIsosurface::fLeavesPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities, const Isosurface **leaves) const
+{
+    // the case where there are no actual children in the csg
+    if (_children.empty()) {
+        Isosurface::fLeavesPoints(xs, ys, zs, num_points, densities, leaves);
+        return;
+    }
+
+    float cxs[RUN_CHUNK], cys[RUN_CHUNK], czs[RUN_CHUNK];
+    float densities2[RUN_CHUNK];
+    const Isosurface *leaves2[RUN_CHUNK];
+
+    for (int i = 0; i < num_points; i += RUN_CHUNK) {
+        int n = THREED_MIN(num_points - i, RUN_CHUNK);
+
+        int c = 0;
+        std::list<Isosurface *>::const_iterator it = _children.begin();
         while (it != _children.end()) {
-            Isosurface *child = (*it);
+            const Isosurface *child = (*it);
             ++it;
-            child->fDensity(x0, y0, z0, dz, num_points, _densities);
-            for (int i = 0; i < num_points; ++i)
-                if (_densities[i] > densities[i])
-                    densities[i] = _densities[i];
+            bool first = (c == 0);
+            float *out = (first ? &densities[i] : densities2);
+            const Isosurface **outLeaves = (first ? &leaves[i] : leaves2);
+
+            const ChildTrans &childTrans = _childTrans[c++];
+            if (childTrans.identity)
+                child->fLeavesPoints(
+                    &xs[i], &ys[i], &zs[i], n, out, outLeaves);
+            else {
+                childTrans.inv.transformPoints(
+                    &xs[i], &ys[i], &zs[i], n, cxs, cys, czs);
+                child->fLeavesPoints(cxs, cys, czs, n, out, outLeaves);
+            }
+
+            if (! first)
+                combineLeaves(&densities[i], &leaves[i],
+                              densities2, leaves2, n);
         }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void CsgIsosurface::combineLeaves(
+    float *densities, const Isosurface **leaves,
+    const float *densities2, const Isosurface *const *leaves2,
+    int num_points) const
+{
+    for (int i = 0; i < num_points; ++i) {
+        float weight;
+        densities[i] = combine(densities[i], densities2[i], &weight);
+        leaves[i] = combineLeaf(leaves[i], leaves2[i], weight);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void CsgIsosurface::combineDensities(
+    float *densities, const float *densities2, int num_points) const
+{
+    int i;
+
+    // union
+
+    if (_csg_mode == CSG_UNION) {
+        for (i = 0; i < num_points; ++i)
+            if (densities2[i] < densities[i])
+                densities[i] = densities2[i];
+
+    // intersection
+
+    } else if (_csg_mode == CSG_INTERSECTION) {
+        for (i = 0; i < num_points; ++i)
+            if (densities2[i] > densities[i])
+                densities[i] = densities2[i];
 
     // difference
 
     } else if (_csg_mode == CSG_DIFFERENCE) {
-        while (it != _children.end()) {
-            Isosurface *child = (*it);
-            ++it;
-            child->fDensity(x0, y0, z0, dz, num_points, _densities);
-            for (int i = 0; i < num_points; ++i)
-                if (-_densities[i] > densities[i])
-                    densities[i] = -_densities[i];
+        for (i = 0; i < num_points; ++i)
+            if (-densities2[i] > densities[i])
+                densities[i] = -densities2[i];
+
+    // smooth modes
+
+    } else {
+        float weight;
+        for (i = 0; i < num_points; ++i)
+            densities[i] = combine(densities[i], densities2[i], &weight);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+float CsgIsosurface::combine(
+    float density, float density2, float *weight) const
+{
+    float a = density;
+    float b = density2;
+
+    switch (_csg_mode) {
+
+        case CSG_UNION:
+            *weight = (b < a ? 0.0f : 1.0f);
+            return (b < a ? b : a);
+
+        case CSG_DIFFERENCE:
+            b = -b;
+            // fall through
+        case CSG_INTERSECTION:
+            *weight = (b > a ? 0.0f : 1.0f);
+            return (b > a ? b : a);
+
+        // smooth intersection is -smin(-a, -b), and smooth difference
+        // is the smooth intersection with -b
+
+        case CSG_SMOOTH_INTERSECTION:
+            b = -b;
+            // fall through
+        case CSG_SMOOTH_DIFFERENCE:
+            a = -a;
+            // fall through
+        default:
+            break;
+    }
+
+    float k = _smoothRadius;
+    float d;
+
+    if (k <= 0.0f) {
+        *weight = (b < a ? 0.0f : 1.0f);
+        d = (b < a ? b : a);
+
+    } else if (_smoothFunc == SMOOTH_EXPONENTIAL) {
+        // -k * log(exp(-a/k) + exp(-b/k)), shifted by the minimum
+        float m = THREED_MIN(a, b);
+        float ea = (float)exp((m - a) / k);
+        float eb = (float)exp((m - b) / k);
+        *weight = ea / (ea + eb);
+        d = m - k * (float)log(ea + eb);
+
+    } else {
+        // polynomial smooth minimum, whose derivative by a is h
+        float h = 0.5f + 0.5f * (b - a) / k;
+        if (h <= 0.0f) {
+            *weight = 0.0f;
+            d = b;
+        } else if (h >= 1.0f) {
+            *weight = 1.0f;
+            d = a;
+        } else {
+            *weight = h;
+            d = b + h * (a - b) - k * h * (1.0f - h);
         }
     }
+
+    if (_csg_mode == CSG_SMOOTH_UNION)
+        return d;
+    return -d;
 }
 
 //----------------------------------------------------------------------------
 
 void CsgIsosurface::fDensity(
     float x0, float y0, float z0,
-    float dz, int num_points, float *densities)
+    float dz, int num_points, float *densities) const
 {
     if (num_points != 1) {
-        fDensity_n(x0, y0, z0, dz, num_points, densities);
+        fDensity_n(x0, y0, z0, dz, 0, num_points, densities);
         return;
     }
 
@@ -157,11 +415,8 @@ void CsgIsosurface::fDensity(
     while (it != _children.end()) {
         (*it)->fDensity(x0, y0, z0, 0, 1, &density2);
         ++it;
-        if (_csg_mode == CSG_DIFFERENCE)
-            density2 = -density2;
-        if ((_csg_mode == CSG_UNION && density2 < density) ||
-            (_csg_mode != CSG_UNION && density2 > density))
-            density = density2;
+        float weight;
+        density = combine(density, density2, &weight);
     }
 
     *densities = density;
@@ -169,28 +424,63 @@ void CsgIsosurface::fDensity(
 
 //----------------------------------------------------------------------------
 
-Isosurface *CsgIsosurface::findIsosurface(
-    float x, float y, float z)
+void CsgIsosurface::fDensityRun(
+    float x0, float y0, float z0, float dz,
+    int first, int num_points, float *densities) const
+{
+    fDensity_n(x0, y0, z0, dz, first, num_points, densities);
+}
+
+//----------------------------------------------------------------------------
+
+const Isosurface *CsgIsosurface::fDensityLeaf(
+    float x, float y, float z, float *density) const
+{
+    // the case where there are no actual children in the csg
+    if (_children.empty()) {
+        *density = 1.0f;
+        return this;
+    }
+
+    float density2;
+
+    // as fDensity(), following the winner along
+    std::list<Isosurface *>::const_iterator it = _children.begin();
+    const Isosurface *leaf = (*it)->fDensityLeaf(x, y, z, density);
+    ++it;
+
+    while (it != _children.end()) {
+        const Isosurface *leaf2 = (*it)->fDensityLeaf(x, y, z, &density2);
+        ++it;
+        float weight;
+        *density = combine(*density, density2, &weight);
+        leaf = combineLeaf(leaf, leaf2, weight);
+    }
+
+    return leaf;
+}
+
+//----------------------------------------------------------------------------
+
+const Isosurface *CsgIsosurface::findIsosurface(
+    float x, float y, float z) const
 {
     float density, density2;
 
     // try the first child isosurface
     std::list<Isosurface *>::const_iterator it = _children.begin();
-    Isosurface *iso = (*it);
+    const Isosurface *iso = (*it);
     ++it;
     iso->fDensity(x, y, z, 0, 1, &density);
 
     while (it != _children.end()) {
-        Isosurface *iso2 = (*it);
+        const Isosurface *iso2 = (*it);
         ++it;
         iso2->fDensity(x, y, z, 0, 1, &density2);
-        if (_csg_mode == CSG_DIFFERENCE)
-            density2 = -density2;
-        if ((_csg_mode == CSG_UNION && density2 < density) ||
-            (_csg_mode != CSG_UNION && density2 > density)) {
-            density = density2;
+        float weight;
+        density = combine(density, density2, &weight);
+        if (weight < 0.5f)
             iso = iso2;
-        }
     }
 
     return iso;
@@ -198,19 +488,74 @@ Isosurface *CsgIsosurface::findIsosurface(
 
 //----------------------------------------------------------------------------
 
-void CsgIsosurface::fNormal(const Vector *point, Vector *normal)
+void CsgIsosurface::fNormal(const Vector *point, Vector *normal) const
 {
-    Isosurface *iso =
-        findIsosurface(point->x(), point->y(), point->z());
-    iso->fNormal(point, normal);
+    if (_csg_mode < CSG_SMOOTH_UNION) {
+        const Isosurface *iso =
+            findIsosurface(point->x(), point->y(), point->z());
+        iso->fNormal(point, normal);
+        return;
+    }
+
+    // blend the gradients of the children by the derivatives of the
+    // smooth minimum, following the order in which fDensity()
+    // combines the children.  the length of each gradient is found
+    // by stepping along the normal of the child
+
+    float x = point->x();
+    float y = point->y();
+    float z = point->z();
+    float density, density2;
+    Vector gradient, gradient2;
+
+    std::list<Isosurface *>::const_iterator it = _children.begin();
+    const Isosurface *iso = (*it);
+    ++it;
+    iso->fDensity(x, y, z, 0, 1, &density);
+    childGradient(iso, point, density, &gradient);
+
+    while (it != _children.end()) {
+        const Isosurface *iso2 = (*it);
+        ++it;
+        iso2->fDensity(x, y, z, 0, 1, &density2);
+        float weight;
+        density = combine(density, density2, &weight);
+        if (weight >= 1.0f)
+            continue;
+
+        childGradient(iso2, point, density2, &gradient2);
+        if (_csg_mode == CSG_SMOOTH_DIFFERENCE)
+            gradient2 = -gradient2;
+        gradient = gradient * weight + gradient2 * (1.0f - weight);
+    }
+
+    *normal = gradient.normalized();
+}
+
+//----------------------------------------------------------------------------
+
+void CsgIsosurface::childGradient(
+    const Isosurface *child, const Vector *point, float density,
+    Vector *gradient) const
+{
+    const float step = 0.001f;
+
+    Vector normal;
+    child->fNormal(point, &normal);
+
+    Vector p = *point + normal * step;
+    float density2;
+    child->fDensity(p.x(), p.y(), p.z(), 0, 1, &density2);
+
+    *gradient = normal * ((density2 - density) / step);
 }
 
 //----------------------------------------------------------------------------
 
 const CsgIsosurface::Material &CsgIsosurface::fMaterial(
-    const Vector *point, float density)
+    const Vector *point, float density) const
 {
-    Isosurface *iso =
+    const Isosurface *iso =
         findIsosurface(point->x(), point->y(), point->z());
     return iso->fMaterial(point, density);
 }
@@ -6,6 +6,7 @@
 #define _THREED_CSGISOSURFACE_H
 
 #include <threed/isosurface.h>
+#include <vector>
 
 namespace ThreeD {
 
@@ -19,7 +20,15 @@ public:
     enum CSG_Mode {
         CSG_UNION,
         CSG_INTERSECTION,
-        CSG_DIFFERENCE
+        CSG_DIFFERENCE,
+        CSG_SMOOTH_UNION,
+        CSG_SMOOTH_INTERSECTION,
+        CSG_SMOOTH_DIFFERENCE
+    };
+
+    enum Smooth_Func {
+        SMOOTH_POLYNOMIAL,              // blends within the radius only
+        SMOOTH_EXPONENTIAL              // blends everywhere
     };
 
     /**
@@ -36,6 +45,19 @@ public:
      */
     void setCsgMode(CSG_Mode csg_mode);
 
+    /** Set the radius of the blend in the smooth modes.  The radius
+     *  is in units of density, not of distance, so for fields that
+     *  are not distances its extent in space depends on the gradient
+     *  of the children.  A smooth union may reach out of the bounding
+     *  boxes of its children, which can be enlarged with
+     *  addBoundingBox() on the csg itself.
+     */
+    void setSmoothRadius(float radius);
+
+    /** Set the smooth minimum function of the smooth modes
+     */
+    void setSmoothFunc(Smooth_Func func);
+
     /**
      *  This isosurface takes ownership of the child.
      */
@@ -44,52 +66,132 @@ public:
     /**
      *
      */
-    virtual BoundingBox getBoundingBox(
-        const Transform &combinedTrans);
+    virtual void prepare(const Transform &combinedTrans);
 
-    /**
-     *
+    /** Compute the densities of points @p first to
+     *  first + num_points - 1 of a run of points, and if @p leaves
+     *  is not null, the winning leaf of each point (see fLeaves())
      */
     void fDensity_n(
         float x0, float y0, float z0,
-        float dz, int num_points, float *densities);
+        float dz, int first, int num_points, float *densities,
+        const Isosurface **leaves = 0) const;
 
     /**
      *
      */
     virtual void fDensity(
         float x0, float y0, float z0,
-        float dz, int num_points, float *densities);
+        float dz, int num_points, float *densities) const;
+
+    /** Compute the densities of part of a run, as fDensity_n() does
+     */
+    virtual void fDensityRun(
+        float x0, float y0, float z0, float dz,
+        int first, int num_points, float *densities) const;
+
+    /**
+     *
+     */
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+    /** Compute the density at one point, and the winning leaf:  the
+     *  leaf of the child that wins, or the csg itself where a smooth
+     *  mode blends the children
+     */
+    virtual const Isosurface *fDensityLeaf(
+        float x, float y, float z, float *density) const;
+
+    /** Compute densities and winning leaves, combining the children
+     *  as fDensityPoints() does
+     */
+    virtual void fLeavesPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities, const Isosurface **leaves) const;
 
     /**
      *
      */
 
     virtual void fNormal(
-        const Vector *point, Vector *normal);
+        const Vector *point, Vector *normal) const;
 
     /**
      *
      */
     virtual const Material &fMaterial(
-        const Vector *point, float density);
+        const Vector *point, float density) const;
 
 protected:
     /*
      *
      */
-    inline Isosurface *findIsosurface(float x0, float y0, float z0);
+    inline const Isosurface *findIsosurface(
+        float x0, float y0, float z0) const;
+
+    /*
+     * Combine the density of another child into @p density.
+     * @p weight receives the derivative of the result by @p density,
+     * while the derivative by @p density2 is 1 - weight (or its
+     * negative for a difference).
+     */
+    inline float combine(float density, float density2, float *weight) const;
+
+    /*
+     * @return the leaf after combining a child, given the leaf before,
+     * the leaf of the child and the weight returned by combine()
+     */
+    const Isosurface *combineLeaf(const Isosurface *leaf,
+                                  const Isosurface *leaf2,
+                                  float weight) const
+    {
+        if (weight <= 0.0f)
+            return leaf2;
+        if (weight < 1.0f)
+            return this;
+        return leaf;
+    }
+
+    /*
+     * Estimate the gradient of a child, given its density at @p point
+     */
+    void childGradient(const Isosurface *child, const Vector *point,
+                       float density, Vector *gradient) const;
+
+    /*
+     * Combine the densities of another child into @p densities
+     */
+    void combineDensities(
+        float *densities, const float *densities2, int num_points) const;
+
+    /*
+     * Combine the densities of another child into @p densities, and
+     * where the child wins, its leaves into @p leaves.  Where the
+     * two are blended, the csg is the leaf.
+     */
+    void combineLeaves(
+        float *densities, const Isosurface **leaves,
+        const float *densities2, const Isosurface *const *leaves2,
+        int num_points) const;
 
     /*
      * data
      */
 
+    struct ChildTrans {
+        Transform trans;                // child coordinates to csg's
+        Transform inv;                  // csg coordinates to child's
+        bool identity;
+    };
+
     CSG_Mode _csg_mode;
+    Smooth_Func _smoothFunc;
+    float _smoothRadius;
 
     std::list<Isosurface *> _children;
-
-    float *_densities;
-    int _maxPoints;
+    std::vector<ChildTrans> _childTrans;    // same order as _children
 };
 
 
@@ -0,0 +1,293 @@
+//----------------------------------------------------------------------------
+// ThreeD Density Cache
+//----------------------------------------------------------------------------
+
+#include <threed/densitycache.h>
+#include <threed/misc.h>
+#include <string.h>
+
+using namespace ThreeD;
+
+//----------------------------------------------------------------------------
+
+DensityCache::DensityCache(const Isosurface *iso, unsigned long maxBytes)
+{
+    _iso = iso;
+    _lastBrick = 0;
+    _maxBytes = maxBytes;
+    _peakBytes = 0;
+    _hits = 0;
+    _misses = 0;
+}
+
+//----------------------------------------------------------------------------
+
+DensityCache::~DensityCache()
+{
+    clear();
+}
+
+//----------------------------------------------------------------------------
+
+void DensityCache::setGrid(const Vector &origin, const Vector &voxelSize)
+{
+    if (voxelSize == _voxelSize) {
+        // keep the cache if the new origin is a point of the grid
+        Vector steps = (origin - _origin) / voxelSize;
+        Vector offset = steps - Vector(floor(steps.x() + 0.5f),
+                                       floor(steps.y() + 0.5f),
+                                       floor(steps.z() + 0.5f));
+        if (fabs(offset.x()) < 1e-3 &&
+            fabs(offset.y()) < 1e-3 &&
+            fabs(offset.z()) < 1e-3)
+            return;
+    }
+
+    clear();
+    _origin = origin;
+    _voxelSize = voxelSize;
+}
+
+//----------------------------------------------------------------------------
+
+void DensityCache::setMemoryLimit(unsigned long maxBytes)
+{
+    _maxBytes = maxBytes;
+    while (! _lru.empty() && memoryUsed() > _maxBytes)
+        dropBrick(_lru.back());
+}
+
+//----------------------------------------------------------------------------
+
+void DensityCache::clear()
+{
+    BricksMap::iterator it = _bricks.begin();
+    while (it != _bricks.end()) {
+        delete (*it).second;
+        ++it;
+    }
+    _bricks.clear();
+    _lru.clear();
+    _lastBrick = 0;
+}
+
+//----------------------------------------------------------------------------
+
+void DensityCache::invalidate(const BoundingBox &bbox)
+{
+    if (_bricks.empty())
+        return;
+
+    // brick range covered by the box, with one grid point of margin
+
+    const Vector &vmin = bbox.vmin();
+    const Vector &vmax = bbox.vmax();
+
+    int bx0 = ((int)floor((vmin.x() - _origin.x()) / _voxelSize.x()) - 1) >> BRICK_SHIFT;
+    int by0 = ((int)floor((vmin.y() - _origin.y()) / _voxelSize.y()) - 1) >> BRICK_SHIFT;
+    int bz0 = ((int)floor((vmin.z() - _origin.z()) / _voxelSize.z()) - 1) >> BRICK_SHIFT;
+    int bx1 = ((int)ceil((vmax.x() - _origin.x()) / _voxelSize.x()) + 1) >> BRICK_SHIFT;
+    int by1 = ((int)ceil((vmax.y() - _origin.y()) / _voxelSize.y()) + 1) >> BRICK_SHIFT;
+    int bz1 = ((int)ceil((vmax.z() - _origin.z()) / _voxelSize.z()) + 1) >> BRICK_SHIFT;
+
+    BricksMap::iterator it = _bricks.begin();
+    while (it != _bricks.end()) {
+        Brick *brick = (*it).second;
+        ++it;
+        const BrickKey &key = brick->key;
+        if (key.x >= bx0 && key.x <= bx1 &&
+            key.y >= by0 && key.y <= by1 &&
+            key.z >= bz0 && key.z <= bz1)
+            dropBrick(brick);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void DensityCache::fDensity(
+    float x0, float y0, float z0, int num_points, float *densities)
+{
+    int gx = (int)floor((x0 - _origin.x()) / _voxelSize.x() + 0.5f);
+    int gy = (int)floor((y0 - _origin.y()) / _voxelSize.y() + 0.5f);
+    int gz = (int)floor((z0 - _origin.z()) / _voxelSize.z() + 0.5f);
+
+    while (num_points > 0) {
+        int k = gz & BRICK_MASK;
+        int count = THREED_MIN(BRICK_SIZE - k, num_points);
+        const float *line = getLine(gx, gy, gz, count);
+        memcpy(densities, &line[k], sizeof(float) * count);
+
+        densities += count;
+        gz += count;
+        num_points -= count;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+float DensityCache::density(const Vector &point)
+{
+    float fx = (point.x() - _origin.x()) / _voxelSize.x();
+    float fy = (point.y() - _origin.y()) / _voxelSize.y();
+    float fz = (point.z() - _origin.z()) / _voxelSize.z();
+    int ix = (int)floor(fx);
+    int iy = (int)floor(fy);
+    int iz = (int)floor(fz);
+    float tx = fx - ix;
+    float ty = fy - iy;
+    float tz = fz - iz;
+
+    float d = 0.0f;
+    for (int a = 0; a < 2; ++a) {
+        float wx = (a ? tx : 1.0f - tx);
+        for (int b = 0; b < 2; ++b) {
+            float wy = (b ? ty : 1.0f - ty);
+            for (int c = 0; c < 2; ++c) {
+                float wz = (c ? tz : 1.0f - tz);
+                d += wx * wy * wz * sample(ix + a, iy + b, iz + c);
+            }
+        }
+    }
+    return d;
+}
+
+//----------------------------------------------------------------------------
+
+void DensityCache::fNormal(const Vector *point, Vector *normal)
+{
+    float fx = (point->x() - _origin.x()) / _voxelSize.x();
+    float fy = (point->y() - _origin.y()) / _voxelSize.y();
+    float fz = (point->z() - _origin.z()) / _voxelSize.z();
+    int ix = (int)floor(fx);
+    int iy = (int)floor(fy);
+    int iz = (int)floor(fz);
+    float tx = fx - ix;
+    float ty = fy - iy;
+    float tz = fz - iz;
+
+    // densities of the 4 x 4 x 4 grid points around the voxel,
+    // which the central differences at its eight corners need
+
+    float d[4][4][4];
+    int a, b, c;
+    for (a = 0; a < 4; ++a)
+        for (b = 0; b < 4; ++b)
+            for (c = 0; c < 4; ++c)
+                d[a][b][c] = sample(ix - 1 + a, iy - 1 + b, iz - 1 + c);
+
+    float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+    for (a = 1; a < 3; ++a) {
+        float wx = (a == 2 ? tx : 1.0f - tx);
+        for (b = 1; b < 3; ++b) {
+            float wy = (b == 2 ? ty : 1.0f - ty);
+            for (c = 1; c < 3; ++c) {
+                float w = wx * wy * (c == 2 ? tz : 1.0f - tz);
+                nx += w * (d[a + 1][b][c] - d[a - 1][b][c]);
+                ny += w * (d[a][b + 1][c] - d[a][b - 1][c]);
+                nz += w * (d[a][b][c + 1] - d[a][b][c - 1]);
+            }
+        }
+    }
+
+    *normal = Vector(nx / _voxelSize.x(),
+                     ny / _voxelSize.y(),
+                     nz / _voxelSize.z()).normalized();
+}
+
+//----------------------------------------------------------------------------
+
+float DensityCache::hitRate() const
+{
+    unsigned long total = _hits + _misses;
+    if (total == 0)
+        return 0.0f;
+    return (float)_hits / (float)total;
+}
+
+//----------------------------------------------------------------------------
+
+void DensityCache::resetStats()
+{
+    _hits = 0;
+    _misses = 0;
+    _peakBytes = memoryUsed();
+}
+
+//----------------------------------------------------------------------------
+
+unsigned long DensityCache::memoryUsed() const
+{
+    return _bricks.size() * sizeof(Brick);
+}
+
+//----------------------------------------------------------------------------
+
+const float *DensityCache::getLine(int gx, int gy, int gz, int count)
+{
+    // arithmetic shifts, so negative grid points round down
+
+    BrickKey key;
+    key.x = gx >> BRICK_SHIFT;
+    key.y = gy >> BRICK_SHIFT;
+    key.z = gz >> BRICK_SHIFT;
+
+    Brick *brick = _lastBrick;
+    if (! brick || brick->key.x != key.x ||
+                   brick->key.y != key.y ||
+                   brick->key.z != key.z) {
+
+        BricksMap::iterator it = _bricks.find(key);
+        if (it != _bricks.end()) {
+            brick = (*it).second;
+            _lru.splice(_lru.begin(), _lru, brick->lru);
+        } else {
+            evict();
+            brick = new Brick;
+            brick->key = key;
+            memset(brick->valid, 0, sizeof(brick->valid));
+            _lru.push_front(brick);
+            brick->lru = _lru.begin();
+            _bricks[key] = brick;
+            if (memoryUsed() > _peakBytes)
+                _peakBytes = memoryUsed();
+        }
+        _lastBrick = brick;
+    }
+
+    int line = ((gx & BRICK_MASK) << BRICK_SHIFT) | (gy & BRICK_MASK);
+    float *densities = &brick->densities[line << BRICK_SHIFT];
+    unsigned int bit = (1u << (line & 31));
+
+    if (brick->valid[line >> 5] & bit)
+        _hits += count;
+    else {
+        float dz = _voxelSize.z();
+        _iso->fDensity(_origin.x() + gx * _voxelSize.x(),
+                       _origin.y() + gy * _voxelSize.y(),
+                       _origin.z() + (key.z << BRICK_SHIFT) * dz,
+                       dz, BRICK_SIZE, densities);
+        brick->valid[line >> 5] |= bit;
+        _misses += count;
+    }
+
+    return densities;
+}
+
+//----------------------------------------------------------------------------
+
+void DensityCache::evict()
+{
+    while (! _lru.empty() && memoryUsed() + sizeof(Brick) > _maxBytes)
+        dropBrick(_lru.back());
+}
+
+//----------------------------------------------------------------------------
+
+void DensityCache::dropBrick(Brick *brick)
+{
+    if (_lastBrick == brick)
+        _lastBrick = 0;
+    _lru.erase(brick->lru);
+    _bricks.erase(brick->key);
+    delete brick;
+}
@@ -0,0 +1,183 @@
+//----------------------------------------------------------------------------
+// ThreeD Density Cache
+//----------------------------------------------------------------------------
+
+#ifndef _THREED_DENSITYCACHE_H
+#define _THREED_DENSITYCACHE_H
+
+#include <threed/isosurface.h>
+#include <map>
+#include <list>
+
+namespace ThreeD {
+
+
+/**
+ * DensityCache, a sparse cache of the densities of an isosurface
+ *
+ * Densities are cached at the points of a regular grid, in bricks of
+ * 8 x 8 x 8 grid points.  A brick is allocated when one of its points
+ * is first requested, and its points are evaluated one z-line (eight
+ * points) at a time, through Isosurface::fDensity().  When the memory
+ * held by the bricks goes over the limit, the least recently used
+ * bricks are dropped.
+ *
+ * A cache can be shared by several meshers, and kept across calls to
+ * createMesh() at the same voxel size, but not by meshers running at
+ * the same time.  The isosurface must be prepared (see
+ * Isosurface::prepare()), and the cache must be invalidated where the
+ * isosurface is edited.
+ */
+class DensityCache
+{
+public:
+    /** Construct a cache for @p iso, holding at most @p maxBytes
+     *  of densities
+     */
+    DensityCache(const Isosurface *iso, unsigned long maxBytes = 64ul << 20);
+
+    /** destructor
+     */
+    ~DensityCache();
+
+    /** Set the grid of the cache.  If the voxel size differs from
+     *  the current one, or @p origin is not a point of the current
+     *  grid, the cache is cleared and the grid anchored at @p origin.
+     */
+    void setGrid(const Vector &origin, const Vector &voxelSize);
+
+    /** Set the memory limit, dropping bricks if necessary
+     */
+    void setMemoryLimit(unsigned long maxBytes);
+
+    /** Drop all bricks
+     */
+    void clear();
+
+    /** Drop the bricks that hold densities within @p bbox
+     */
+    void invalidate(const BoundingBox &bbox);
+
+    /** Get the densities of a run of grid points along the z axis.
+     *  (x0,y0,z0) is rounded to the nearest grid point, and the
+     *  points are one voxel apart.
+     */
+    void fDensity(
+        float x0, float y0, float z0, int num_points, float *densities);
+
+    /** @return the density at @p point, interpolated (trilinearly)
+     *  from the surrounding grid points
+     */
+    float density(const Vector &point);
+
+    /** Estimate the normal at @p point, by interpolating (trilinearly)
+     *  the central-difference gradients of the surrounding grid points
+     */
+    void fNormal(const Vector *point, Vector *normal);
+
+    /** @return the number of grid points served from the cache
+     */
+    unsigned long hits() const { return _hits; }
+
+    /** @return the number of grid points that had to be evaluated
+     */
+    unsigned long misses() const { return _misses; }
+
+    /** @return the ratio of hits to requested grid points
+     */
+    float hitRate() const;
+
+    /** Reset the hit and miss counters
+     */
+    void resetStats();
+
+    /** @return the memory limit, in bytes
+     */
+    unsigned long memoryLimit() const { return _maxBytes; }
+
+    /** @return the memory currently held by bricks, in bytes
+     */
+    unsigned long memoryUsed() const;
+
+    /** @return the most memory held by bricks at any one time
+     */
+    unsigned long memoryPeak() const { return _peakBytes; }
+
+protected:
+
+    enum {
+        BRICK_SHIFT = 3,
+        BRICK_SIZE  = (1 << BRICK_SHIFT),
+        BRICK_MASK  = (BRICK_SIZE - 1),
+        BRICK_LINES = (BRICK_SIZE * BRICK_SIZE)
+    };
+
+    struct BrickKey {
+        int x, y, z;
+
+        bool operator<(const BrickKey &other) const
+        {
+            if (x != other.x)
+                return (x < other.x);
+            if (y != other.y)
+                return (y < other.y);
+            return (z < other.z);
+        }
+    };
+
+    struct Brick;
+
+    typedef std::map<BrickKey, Brick *> BricksMap;
+    typedef std::list<Brick *> BricksList;
+
+    struct Brick {
+        BrickKey key;
+        float densities[BRICK_LINES * BRICK_SIZE];  // [x][y][z]
+        unsigned int valid[BRICK_LINES / 32];       // one bit per z-line
+        BricksList::iterator lru;
+    };
+
+    /** Find or create the brick holding grid point (gx,gy,gz), and
+     *  make sure its z-line through that point is evaluated
+     *
+     *  @return the first density of the z-line
+     */
+    const float *getLine(int gx, int gy, int gz, int count);
+
+    /** @return the density at grid point (gx,gy,gz)
+     */
+    float sample(int gx, int gy, int gz)
+    {
+        return getLine(gx, gy, gz, 1)[gz & BRICK_MASK];
+    }
+
+    /** Drop the least recently used bricks, until another brick
+     *  fits within the memory limit
+     */
+    void evict();
+
+    /** Drop a brick
+     */
+    void dropBrick(Brick *brick);
+
+    /*
+     * data
+     */
+
+    const Isosurface *_iso;
+    Vector _origin;
+    Vector _voxelSize;
+
+    BricksMap _bricks;
+    BricksList _lru;                    // most recently used first
+    Brick *_lastBrick;
+
+    unsigned long _maxBytes;
+    unsigned long _peakBytes;
+    unsigned long _hits;
+    unsigned long _misses;
+};
+
+
+} // namespace ThreeD
+#endif // _THREED_DENSITYCACHE_H
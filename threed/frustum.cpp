@@ -0,0 +1,70 @@
+//----------------------------------------------------------------------------
+// ThreeD View Frustum
+//----------------------------------------------------------------------------
+
+#include <threed/frustum.h>
+
+using namespace ThreeD;
+
+//----------------------------------------------------------------------------
+
+Frustum::Frustum()
+{
+    // planes at infinity, which every point is inside of
+
+    for (int i = 0; i < NUM_PLANES; ++i)
+        _planes[i] = Plane(0.0, 0.0, 0.0, 1.0);
+}
+
+//----------------------------------------------------------------------------
+
+void Frustum::extract(const double projection[16], const double modelview[16])
+{
+    // clip = projection * modelview.  A point is in the volume if
+    // -w <= x, y, z <= w in clip coordinates, so each plane is the
+    // fourth row of the matrix plus or minus one of the others
+
+    double m[16];
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            double sum = 0.0;
+            for (int k = 0; k < 4; ++k)
+                sum += projection[k * 4 + row] * modelview[col * 4 + k];
+            m[col * 4 + row] = sum;
+        }
+    }
+
+#define ROW(r,col) m[(col) * 4 + (r)]
+
+    for (int i = 0; i < NUM_PLANES; ++i) {
+        int r = i / 2;
+        double sign = (i & 1) ? -1.0 : 1.0;
+        _planes[i] = Plane(ROW(3, 0) + sign * ROW(r, 0),
+                           ROW(3, 1) + sign * ROW(r, 1),
+                           ROW(3, 2) + sign * ROW(r, 2),
+                           ROW(3, 3) + sign * ROW(r, 3));
+    }
+
+#undef ROW
+}
+
+//----------------------------------------------------------------------------
+
+bool Frustum::outside(const BoundingBox &bbox) const
+{
+    // the corner of the box farthest along the normal of a plane is
+    // the last to leave the volume through that plane
+
+    const Vector &vmin = bbox.vmin();
+    const Vector &vmax = bbox.vmax();
+
+    for (int i = 0; i < NUM_PLANES; ++i) {
+        const Plane &p = _planes[i];
+        double x = (p.a() >= 0.0 ? vmax.x() : vmin.x());
+        double y = (p.b() >= 0.0 ? vmax.y() : vmin.y());
+        double z = (p.c() >= 0.0 ? vmax.z() : vmin.z());
+        if (p.a() * x + p.b() * y + p.c() * z + p.d() < 0.0)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,57 @@
+//----------------------------------------------------------------------------
+// ThreeD View Frustum
+//----------------------------------------------------------------------------
+
+#ifndef _THREED_FRUSTUM_H
+#define _THREED_FRUSTUM_H
+
+#include <threed/plane.h>
+#include <threed/boundingbox.h>
+
+namespace ThreeD {
+
+
+/**
+ * Frustum, the volume seen through a projection:  six planes, whose
+ * normals point into the volume.
+ */
+class Frustum
+{
+public:
+    enum {
+        NUM_PLANES = 6                  // left, right, bottom, top, near, far
+    };
+
+    /**
+     * Constructor.
+     *
+     * Constructs a frustum that contains everything.
+     */
+    Frustum();
+
+    /**
+     * Extracts the planes from the OpenGL matrices @p projection and
+     * @p modelview, in column order (Gribb and Hartmann).  The planes
+     * are in the coordinates that @p modelview maps to the eye.
+     */
+    void extract(const double projection[16], const double modelview[16]);
+
+    /**
+     * @return true if the box @p bbox lies wholly on the outer side of
+     * one of the planes.  A box across the corner of the frustum may
+     * lie outside without being reported.
+     */
+    bool outside(const BoundingBox &bbox) const;
+
+    /**
+     * @return plane @p i of the frustum.
+     */
+    const Plane &plane(int i) const { return _planes[i]; }
+
+protected:
+    Plane _planes[NUM_PLANES];
+};
+
+
+} // namespace ThreeD
+#endif // _THREED_FRUSTUM_H
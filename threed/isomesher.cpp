@@ -3,6 +3,9 @@
 //----------------------------------------------------------------------------
 
 #include <threed/isomesher.h>
+#include <threed/densitycache.h>
+#include <threed/misc.h>
+#include <math.h>
 
 using namespace ThreeD;
 
@@ -28,11 +31,23 @@ uint32_t GetTickCount(void) {
 IsoMesher::IsoMesher(Isosurface *iso)
 {
     _iso = iso;
+    _cache = 0;
+    _cacheNormals = false;
+    _distanceField = false;
+    _tileSizeX = 0;
+    _tileSizeZ = 0;
+    _pool = 0;
     _progressFunc = 0;
 }
 
 //----------------------------------------------------------------------------
 
+IsoMesher::~IsoMesher()
+{
+}
+
+//----------------------------------------------------------------------------
+
 void IsoMesher::setVoxelSize(float x, float y, float z)
 {
     _voxelSize = Vector(x, y, z);
@@ -51,6 +66,261 @@ void IsoMesher::setProgressFunc(
 
 //----------------------------------------------------------------------------
 
+void IsoMesher::setDensityCache(DensityCache *cache, bool normals)
+{
+    _cache = cache;
+    _cacheNormals = (cache != 0 && normals);
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::setDistanceField(bool distanceField)
+{
+    _distanceField = distanceField;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::setTileSize(int xVoxels, int zVoxels)
+{
+    _tileSizeX = xVoxels;
+    _tileSizeZ = zVoxels;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::setThreadPool(ThreadPool *pool)
+{
+    _pool = pool;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::getTileSize(
+    int gridX, int gridZ, int *tileX, int *tileZ) const
+{
+    *tileX = (_tileSizeX > 0 ? _tileSizeX : gridX);
+
+    // tiles along z start where the isosurface starts a run, so a
+    // tile evaluates the same points as the whole line would
+
+    int chunk = Isosurface::RUN_CHUNK;
+    if (_tileSizeZ > 0)
+        *tileZ = (_tileSizeZ + chunk - 1) / chunk * chunk;
+    else
+        *tileZ = gridZ;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::setCacheGrid(const Vector &origin)
+{
+    if (_cache)
+        _cache->setGrid(origin, _voxelSize);
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::computeDensities(
+    float x0, float y0, float z0, int num_points, float *densities,
+    int stride)
+{
+    if (_cache && stride == 1)
+        _cache->fDensity(x0, y0, z0, num_points, densities);
+    else if (_distanceField)
+        computeDistances(x0, y0, z0, num_points, densities, stride);
+    else {
+        float dz = _voxelSize.z() * stride;
+        _iso->fDensity(x0, y0, z0, dz, num_points, densities);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::computeLine(
+    float x0, float y0, float z0, int first, int num_points,
+    float *densities)
+{
+    float dz = _voxelSize.z();
+    int end = first + num_points;
+    int i = first;
+    while (i < end) {
+        int n = THREED_MIN(end, (i / Isosurface::RUN_CHUNK + 1) *
+                                Isosurface::RUN_CHUNK) - i;
+        computeDensities(x0, y0, z0 + i * dz, n, &densities[i - first]);
+        i += n;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::computeDistances(
+    float x0, float y0, float z0, int num_points, float *densities,
+    int stride)
+{
+    // a point d away from the surface has no surface within d of it,
+    // so the points after it along z, at k * dz, are at least
+    // d - k * dz away.  A point is skipped while that bound exceeds
+    // the largest voxel edge, so neither it nor any grid point next
+    // to it can change sign, and no edge that the meshers intersect
+    // ever ends at a filled density.  The bound itself is what gets
+    // filled in, so it stays a safe distance for the brick mesher.
+    //
+    // points are evaluated in runs, which double while no point can
+    // be skipped, and shrink to one point after a skip, to probe
+    // whether the next span can be skipped too.  Runs are parts of
+    // the one run the meshers would evaluate otherwise, so that each
+    // point evaluated gets the same density either way
+
+    float dz = _voxelSize.z() * stride;
+    float edge = _voxelSize.x();
+    if (_voxelSize.y() > edge)
+        edge = _voxelSize.y();
+    if (_voxelSize.z() > edge)
+        edge = _voxelSize.z();
+    edge *= stride;
+
+    int run = 1;
+    int i = 0;
+    while (i < num_points) {
+        int n = num_points - i;
+        if (n > run)
+            n = run;
+        if (n == num_points)
+            _iso->fDensity(x0, y0, z0, dz, n, densities);
+        else
+            _iso->fDensityRun(x0, y0, z0, dz, i, n, &densities[i]);
+        i += n;
+
+        float d = densities[i - 1];
+        float dist = (d < 0.0f ? -d : d) - edge;
+        int skip = 0;
+        while (i < num_points && dist > dz) {
+            dist -= dz;
+            densities[i++] = (d < 0.0f ? -dist - edge : dist + edge);
+            ++skip;
+        }
+
+        if (skip != 0)
+            run = 1;
+        else if (run < Isosurface::RUN_CHUNK)
+            run *= 2;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::computeSigns(
+    const float *densities, int num_points, SignWord *signs)
+{
+    int words = signWords(num_points);
+    for (int w = 0; w < words; ++w) {
+        int first = w * SIGN_BITS;
+        int n = num_points - first;
+        if (n > SIGN_BITS)
+            n = SIGN_BITS;
+
+        // signbit() reads the density where it lies, and takes -0 as
+        // negative, the same as fsign() does for the corners of a cube
+
+        const float *d = densities + first;
+        SignWord word = 0;
+        for (int b = 0; b < n; ++b)
+            if (! signbit(d[b]))
+                word |= (SignWord)1 << b;
+        signs[w] = word;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::findMixedCubes(
+    const SignWord *lines[4], int num_points, SignWord *mixed)
+{
+    // a cube is mixed unless its eight corners are all inside or all
+    // outside, so it is mixed where the union of its corner bits is
+    // set and their intersection is not.  The four lines give the
+    // corners at z, and the same bits shifted down by one, with the
+    // low bit of the next word carried in, give the corners at z + 1
+
+    int words = signWords(num_points);
+    SignWord anyNext = 0, allNext = 0;
+
+    for (int w = words - 1; w >= 0; --w) {
+        SignWord any = lines[0][w] | lines[1][w] | lines[2][w] | lines[3][w];
+        SignWord all = lines[0][w] & lines[1][w] & lines[2][w] & lines[3][w];
+        SignWord anyCube = any | (any >> 1) | (anyNext << (SIGN_BITS - 1));
+        SignWord allCube = all & ((all >> 1) | (allNext << (SIGN_BITS - 1)));
+        mixed[w] = anyCube & ~allCube;
+        anyNext = any;
+        allNext = all;
+    }
+
+    // there is no cube past the last point
+
+    int last = num_points - 1;
+    int lastWord = last / SIGN_BITS;
+    mixed[lastWord] &= ((SignWord)1 << (last % SIGN_BITS)) - 1;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::computeNormal(
+    const Vector *point, Vector *normal, const Isosurface *leaf)
+{
+    if (_cacheNormals)
+        _cache->fNormal(point, normal);
+    else if (leaf)
+        leaf->fNormal(point, normal);
+    else
+        _iso->fNormal(point, normal);
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher::computeMaterials(
+    const Vector *points, const float *densities,
+    const Isosurface *const *leaves, int num_points,
+    MaterialPalette::Id *materials)
+{
+    enum { CHUNK = 64 };
+    Vector unknown[CHUNK];
+    int unknownIndex[CHUNK];
+    const Isosurface *found[CHUNK];
+    float foundDensities[CHUNK];
+    MaterialPalette &palette = _mesh->palette();
+
+    int i = 0;
+    while (i < num_points) {
+
+        // points with a known leaf ask it directly, and the others,
+        // such as grid points that were on the surface, wait for a
+        // chunk to fill
+
+        int n = 0;
+        for (; i < num_points && n < CHUNK; ++i) {
+            if (leaves[i])
+                materials[i] = palette.add(
+                    leaves[i]->fMaterial(&points[i], densities[i]));
+            else {
+                unknown[n] = points[i];
+                unknownIndex[n++] = i;
+            }
+        }
+        if (n == 0)
+            continue;
+
+        _iso->fLeaves(unknown, n, foundDensities, found);
+        for (int j = 0; j < n; ++j) {
+            int k = unknownIndex[j];
+            materials[k] = palette.add(
+                found[j]->fMaterial(&points[k], densities[k]));
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
 bool IsoMesher::invokeProgressFunc()
 {
     bool cancel = false;
@@ -98,10 +368,11 @@ void IsoMesher::intersect_xaxis(
     float z = p0->v->z();
     float xm;
     float density;
+    const Isosurface *leaf;
 
     while (1) {
         xm = (xa + xb) * 0.5f;
-        _iso->fDensity(xm, y, z, 0, 1, &density);
+        leaf = _iso->fDensityLeaf(xm, y, z, &density);
         density += 1e-4f;
         if (fabs(density) < TOLERANCE_DENSITY)
             break;
@@ -115,6 +386,7 @@ void IsoMesher::intersect_xaxis(
     }
 
     out->density = density;
+    out->leaf = leaf;
     *out->v = Vector(xm, y, z);
 }
 
@@ -135,10 +407,11 @@ void IsoMesher::intersect_yaxis(
     float z = p0->v->z();
     float ym;
     float density;
+    const Isosurface *leaf;
 
     while (1) {
         ym = (ya + yb) * 0.5f;
-        _iso->fDensity(x, ym, z, 0, 1, &density);
+        leaf = _iso->fDensityLeaf(x, ym, z, &density);
         density += 1e-4f;
         if (fabs(density) < TOLERANCE_DENSITY)
             break;
@@ -152,6 +425,7 @@ void IsoMesher::intersect_yaxis(
     }
 
     out->density = density;
+    out->leaf = leaf;
     *out->v = Vector(x, ym, z);
 }
 
@@ -172,10 +446,11 @@ void IsoMesher::intersect_zaxis(
     float y = p0->v->y();
     float zm;
     float density;
+    const Isosurface *leaf;
 
     while (1) {
         zm = (za + zb) * 0.5f;
-        _iso->fDensity(x, y, zm, 0, 1, &density);
+        leaf = _iso->fDensityLeaf(x, y, zm, &density);
         density += 1e-4f;
         if (fabs(density) < TOLERANCE_DENSITY)
             break;
@@ -189,6 +464,7 @@ void IsoMesher::intersect_zaxis(
     }
 
     out->density = density;
+    out->leaf = leaf;
     *out->v = Vector(x, y, zm);
 }
 
@@ -226,10 +502,11 @@ void IsoMesher::intersect_xaxis(
     float z = p0->v->z();
     float xm;
     float density;
+    const Isosurface *leaf;
 
     while (1) {
         xm = xb - (fb * (xb - xa) / (fb - fa));
-        _iso->fDensity(xm, y, z, 0, 1, &density);
+        leaf = _iso->fDensityLeaf(xm, y, z, &density);
         density += 1e-4f;
         if (fabs(density) < TOLERANCE_DENSITY)
             break;
@@ -245,7 +522,7 @@ void IsoMesher::intersect_xaxis(
         }
 
         xm = (xa + xb) * 0.5f;
-        _iso->fDensity(xm, y, z, 0, 1, &density);
+        leaf = _iso->fDensityLeaf(xm, y, z, &density);
         density += 1e-4f;
         if (fsign(density)) {       // pm < 0
             xa = xm;
@@ -257,6 +534,7 @@ void IsoMesher::intersect_xaxis(
     }
 
     out->density = density;
+    out->leaf = leaf;
     *out->v = Vector(xm, y, z);
 }
 
@@ -282,10 +560,11 @@ void IsoMesher::intersect_yaxis(
     float z = p0->v->z();
     float ym;
     float density;
+    const Isosurface *leaf;
 
     while (1) {
         ym = yb - (fb * (yb - ya) / (fb - fa));
-        _iso->fDensity(x, ym, z, 0, 1, &density);
+        leaf = _iso->fDensityLeaf(x, ym, z, &density);
         density += 1e-4f;
         if (fabs(density) < TOLERANCE_DENSITY)
             break;
@@ -301,7 +580,7 @@ void IsoMesher::intersect_yaxis(
         }
 
         ym = (ya + yb) * 0.5f;
-        _iso->fDensity(x, ym, z, 0, 1, &density);
+        leaf = _iso->fDensityLeaf(x, ym, z, &density);
         density += 1e-4f;
         if (fsign(density)) {       // pm < 0
             ya = ym;
@@ -313,6 +592,7 @@ void IsoMesher::intersect_yaxis(
     }
 
     out->density = density;
+    out->leaf = leaf;
     *out->v = Vector(x, ym, z);
 }
 
@@ -338,10 +618,11 @@ void IsoMesher::intersect_zaxis(
     float y = p0->v->y();
     float zm;
     float density;
+    const Isosurface *leaf;
 
     while (1) {
         zm = zb - (fb * (zb - za) / (fb - fa));
-        _iso->fDensity(x, y, zm, 0, 1, &density);
+        leaf = _iso->fDensityLeaf(x, y, zm, &density);
         density += 1e-4f;
         if (fabs(density) < TOLERANCE_DENSITY)
             break;
@@ -357,7 +638,7 @@ void IsoMesher::intersect_zaxis(
         }
 
         zm = (za + zb) * 0.5f;
-        _iso->fDensity(x, y, zm, 0, 1, &density);
+        leaf = _iso->fDensityLeaf(x, y, zm, &density);
         density += 1e-4f;
         if (fsign(density)) {       // pm < 0
             za = zm;
@@ -369,6 +650,7 @@ void IsoMesher::intersect_zaxis(
     }
 
     out->density = density;
+    out->leaf = leaf;
     *out->v = Vector(x, y, zm);
 }
 
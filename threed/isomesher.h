@@ -11,8 +11,21 @@
 namespace ThreeD {
 
 
+class DensityCache;
+class ThreadPool;
+
+
 /**
  * IsoMesher
+ *
+ * createMesh() prepares the isosurface before evaluating it, which
+ * writes to the isosurface unless it was prepared already.  Several
+ * meshers may mesh the same isosurface in separate threads, provided
+ * the caller prepares it first, through Isosurface::prepare() or
+ * getBoundingBox() with an identity transform, before any of them
+ * starts; that it is not edited meanwhile (see Isosurface); and that
+ * each mesher has its own density cache and thread pool, if any.
+ * bench/stress_meshers.cpp runs the meshers so, for ThreadSanitizer.
  */
 class IsoMesher
 {
@@ -21,6 +34,10 @@ public:
      */
     IsoMesher(Isosurface *iso);
 
+    /** destructor
+     */
+    virtual ~IsoMesher();
+
     /** Set the voxel size
      */
     void setVoxelSize(float x, float y, float z);
@@ -29,6 +46,50 @@ public:
      */
     void setProgressFunc(bool (*func)(void *, int), void *parm);
 
+    /** Set a cache of densities to consult, instead of evaluating
+     *  the isosurface for every grid point.  If @p normals is true,
+     *  normals are also estimated from the cached densities.
+     *  The cache is not destroyed with the mesher.
+     */
+    void setDensityCache(DensityCache *cache, bool normals = false);
+
+    /** Declare that the density of the isosurface is a signed
+     *  distance, or a bound on it:  it changes by at most one unit
+     *  per unit of distance in mesher coordinates.  Runs of grid
+     *  points along the z axis then skip the points whose distance to
+     *  the surface is known from an earlier point to exceed a voxel,
+     *  and fill them with that bound instead of evaluating them.
+     *  Densities that are not distances lose surface with this mode.
+     *  Runs through the density cache are not affected.
+     */
+    void setDistanceField(bool distanceField);
+
+    /** Set the size, in voxels along x and z, of the tiles that the
+     *  MC and DC meshers sweep along y one at a time, so that the rows
+     *  they keep stay small however wide the grid:  on a slice 4096
+     *  points across, 64 by 512 tiles keep 5 MB where whole slices
+     *  keep 140 MB (MC) or 217 MB (DC).  The size along z is rounded
+     *  up to a multiple of Isosurface::RUN_CHUNK.  Zero, the default,
+     *  sweeps whole slices of the grid.
+     *
+     *  The mesh has the same faces either way, though they come out in
+     *  another order, and points closer than the tolerance of
+     *  Mesh::addPoint() may merge the other way round.
+     */
+    void setTileSize(int xVoxels, int zVoxels);
+
+    /** Set a pool of threads to mesh with, or 0 to mesh on the calling
+     *  thread.  The pool is kept across calls to createMesh(), and is
+     *  not destroyed with the mesher.  Work that runs on the pool does
+     *  not consult the density cache, which is not shared by threads.
+     *
+     *  createMesh() prepares the isosurface on the calling thread,
+     *  before it hands work to the pool.  Meshers that run at once on
+     *  one isosurface each need a pool of their own, and the
+     *  isosurface prepared before any of them starts (see IsoMesher).
+     */
+    void setThreadPool(ThreadPool *pool);
+
     /**
      */
     virtual Mesh *createMesh() = 0;
@@ -38,9 +99,92 @@ protected:
     struct Point {
         float density;
         Vector *v;
+        const Isosurface *leaf;         // winner, if found by a solver
+    };
+
+    /*
+     * A line of grid points along the z axis keeps the signs of its
+     * densities in a bit plane, one bit per point, set for points
+     * outside the isosurface.  Bit z of the plane is bit z % SIGN_BITS
+     * of word z / SIGN_BITS.
+     */
+
+    typedef unsigned long SignWord;
+
+    enum {
+        SIGN_BITS = sizeof(SignWord) * 8
     };
 
-    /** Intersect a voxel edge along the x axis
+    /** @return the number of words in the bit plane of
+     *  @p num_points points
+     */
+    static int signWords(int num_points)
+    {
+        return (num_points + SIGN_BITS - 1) / SIGN_BITS;
+    }
+
+    /** Fill the bit plane @p signs of a line of @p num_points points
+     *  from their @p densities
+     */
+    static void computeSigns(const float *densities, int num_points,
+                             SignWord *signs);
+
+    /** Find the cubes between four lines of @p num_points points that
+     *  have corners both inside and outside the isosurface.  The lines
+     *  hold the corners 0 to 3 of the cubes, and bit z of @p mixed is
+     *  set if the cube from z to z + 1 is mixed.
+     */
+    static void findMixedCubes(const SignWord *lines[4], int num_points,
+                               SignWord *mixed);
+
+    /** @return the corner index of the cube from z to z + 1 between
+     *  four lines, as found by findMixedCubes()
+     */
+    static int cubeIndex(const SignWord *lines[4], int z)
+    {
+        int w0 = z / SIGN_BITS, b0 = z % SIGN_BITS;
+        int w1 = (z + 1) / SIGN_BITS, b1 = (z + 1) % SIGN_BITS;
+        int index = 0;
+        for (int n = 0; n < 4; ++n) {
+            index |= (int)((lines[n][w0] >> b0) & 1) << n;
+            index |= (int)((lines[n][w1] >> b1) & 1) << (n + 4);
+        }
+        return index;
+    }
+
+    /** @return the position of the lowest set bit of @p word, which
+     *  must not be zero
+     */
+    static int lowestBit(SignWord word)
+    {
+#ifdef __GNUC__
+        return __builtin_ctzl(word);
+#else
+        int bit = 0;
+        while (! (word & 1)) {
+            word >>= 1;
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    /** @return the number of set bits in @p word
+     */
+    static int countBits(SignWord word)
+    {
+#ifdef __GNUC__
+        return __builtin_popcountl(word);
+#else
+        int count = 0;
+        for (; word != 0; word &= word - 1)
+            ++count;
+        return count;
+#endif
+    }
+
+    /** Intersect a voxel edge along the x axis.  The intersection
+     *  keeps the leaf isosurface that wins there.
      */
     void intersect_xaxis(Point *p0, Point *p1, Point *out) const;
 
@@ -52,6 +196,59 @@ protected:
      */
     void intersect_zaxis(Point *p0, Point *p1, Point *out) const;
 
+    /** Find the width of the tiles, in voxels, over a grid of
+     *  @p gridX by @p gridZ points (see setTileSize())
+     */
+    void getTileSize(int gridX, int gridZ, int *tileX, int *tileZ) const;
+
+    /** Anchor the grid of the density cache, if any, at @p origin
+     */
+    void setCacheGrid(const Vector &origin);
+
+    /** Compute the densities of a run of grid points along the
+     *  z axis, @p stride voxels apart, through the density cache if
+     *  there is one.  Runs that skip grid points bypass the cache,
+     *  which would evaluate whole lines of the grid.
+     */
+    void computeDensities(
+        float x0, float y0, float z0, int num_points, float *densities,
+        int stride = 1);
+
+    /** Compute the densities of grid points @p first to
+     *  first + num_points - 1 of the line along z that starts at
+     *  (x0,y0,z0).  They are evaluated in the runs the isosurface
+     *  would split the whole line into (see Isosurface::fDensity()),
+     *  so the densities of a tile of the line match those of the
+     *  whole line, provided @p first is a multiple of RUN_CHUNK.
+     */
+    void computeLine(
+        float x0, float y0, float z0, int first, int num_points,
+        float *densities);
+
+    /** Compute the densities of a run as computeDensities(), skipping
+     *  the points that the distance at earlier points shows to be
+     *  away from the surface
+     */
+    void computeDistances(
+        float x0, float y0, float z0, int num_points, float *densities,
+        int stride);
+
+    /** Compute the normal at a point on the isosurface, through
+     *  @p leaf, if the winning leaf at the point is known
+     */
+    void computeNormal(const Vector *point, Vector *normal,
+                       const Isosurface *leaf = 0);
+
+    /** Find the materials at @p num_points points on the isosurface,
+     *  whose densities (as found by the root solver) are
+     *  @p densities, and add them to the palette of the mesh.  Points
+     *  whose entry in @p leaves is null have their winning leaves
+     *  found in one pass, through Isosurface::fLeaves().
+     */
+    void computeMaterials(const Vector *points, const float *densities,
+                          const Isosurface *const *leaves, int num_points,
+                          MaterialPalette::Id *materials);
+
     /** Invoke progress function to update the percent
      */
     bool invokeProgressFunc(int percent)
@@ -73,6 +270,12 @@ protected:
     Isosurface *_iso;
     Vector _voxelSize;
     Mesh *_mesh;
+    DensityCache *_cache;
+    bool _cacheNormals;
+    bool _distanceField;
+    int _tileSizeX;
+    int _tileSizeZ;
+    ThreadPool *_pool;
 
     bool (*_progressFunc)(void *, int);
     void *_progressParm;
@@ -0,0 +1,1096 @@
+//----------------------------------------------------------------------------
+// ThreeD Incremental (Brick) Marching Cubes Isosurface Mesh Generator
+//----------------------------------------------------------------------------
+
+#include <threed/isomesher_brick.h>
+#include <threed/densitycache.h>
+#include <threed/meshface.h>
+#include <threed/misc.h>
+#include <threed/threadpool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using namespace ThreeD;
+
+//----------------------------------------------------------------------------
+
+#define DEFAULT_BRICK_SIZE 16
+#define WELD_TOLERANCE 1e-3             // as Mesh::addPoint()
+
+//----------------------------------------------------------------------------
+
+struct IsoMesher_Brick::BrickTask : public ThreadPool::Task {
+    const IsoMesher_Brick *mesher;
+    BrickKey key;
+    IndexedMesh *buffer;
+
+    virtual void run()
+    {
+        // a mesher of the task's own, which shares only the isosurface
+
+        IsoMesher_Brick worker(mesher->_iso);
+        worker._voxelSize = mesher->_voxelSize;
+        worker._distanceField = mesher->_distanceField;
+        worker._gridOrigin = mesher->_gridOrigin;
+        worker._gridBrickSize = mesher->_gridBrickSize;
+        worker.meshBrick(key, buffer);
+    }
+};
+
+//----------------------------------------------------------------------------
+
+IsoMesher_Brick::IsoMesher_Brick(Isosurface *iso)
+: IsoMesher_MC(iso)
+{
+    _brickSize = DEFAULT_BRICK_SIZE;
+    _gridBrickSize = DEFAULT_BRICK_SIZE;
+    _currentFaces = 0;
+    _lodDistance = 0.0f;
+    _lodMaxLevel = 0;
+    _mesh = 0;
+}
+
+//----------------------------------------------------------------------------
+
+IsoMesher_Brick::~IsoMesher_Brick()
+{
+    clearBricks();
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::setBrickSize(int voxels)
+{
+    if (voxels >= 1)
+        _brickSize = voxels;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::setLevelOfDetail(
+    const Vector &focus, float distance, int maxLevel)
+{
+    _lodFocus = focus;
+    _lodDistance = distance;
+    _lodMaxLevel = maxLevel;
+}
+
+//----------------------------------------------------------------------------
+
+Mesh *IsoMesher_Brick::createMesh()
+{
+    clearBricks();
+
+    // the grid is anchored at the unit-aligned corner of the bounding
+    // box, and stays anchored there across updates
+
+    BoundingBox bbox = _iso->getBoundingBox(Transform());
+    _gridOrigin = Vector(floor(bbox.vmin().x()),
+                         floor(bbox.vmin().y()),
+                         floor(bbox.vmin().z()));
+    _gridBrickSize = _brickSize;
+    setCacheGrid(_gridOrigin);
+
+    _mesh = new Mesh();
+    invalidate(bbox);
+
+    updateMesh();
+
+    if (numDirtyBricks() != 0) {        // cancelled?
+        delete _mesh;
+        _mesh = 0;
+        clearBricks();
+    }
+
+    return _mesh;
+}
+
+//----------------------------------------------------------------------------
+
+bool IsoMesher_Brick::createIndexedMesh(IndexedMesh *imesh)
+{
+    clearBricks();
+    _mesh = 0;
+
+    BoundingBox bbox = _iso->getBoundingBox(Transform());
+    _gridOrigin = Vector(floor(bbox.vmin().x()),
+                         floor(bbox.vmin().y()),
+                         floor(bbox.vmin().z()));
+    _gridBrickSize = _brickSize;
+    setCacheGrid(_gridOrigin);
+    _iso->prepare(Transform());
+
+    BrickKey first, last, key;
+    brickRange(bbox, &first, &last);
+    std::vector<BrickKey> keys;
+    for (key.x = first.x; key.x <= last.x; ++key.x)
+        for (key.y = first.y; key.y <= last.y; ++key.y)
+            for (key.z = first.z; key.z <= last.z; ++key.z)
+                keys.push_back(key);
+
+    // the bricks share nothing while they are meshed, so they may be
+    // meshed in any order; only the merge goes in grid order
+
+    int numBricks = (int)keys.size();
+    std::vector<IndexedMesh> buffers(numBricks);
+    int i;
+    if (_pool && _pool->numRunning() > 1) {
+        std::vector<BrickTask> tasks(numBricks);
+        for (i = 0; i < numBricks; ++i) {
+            tasks[i].mesher = this;
+            tasks[i].key = keys[i];
+            tasks[i].buffer = &buffers[i];
+            _pool->submit(&tasks[i]);
+        }
+        _pool->wait();
+
+        if (invokeProgressFunc(100))
+            return false;
+    } else {
+        for (i = 0; i < numBricks; ++i) {
+            meshBrick(keys[i], &buffers[i]);
+
+            _progressPercent = (int)((i + 1) * 100.0f / numBricks);
+            if (invokeProgressFunc())
+                return false;
+        }
+    }
+
+    mergeBricks(keys, buffers, imesh);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::invalidate(const BoundingBox &bbox)
+{
+    if (_cache)
+        _cache->invalidate(bbox);
+
+    if (! _mesh)
+        return;
+
+    BrickKey first, last, key;
+    brickRange(bbox, &first, &last);
+    for (key.x = first.x; key.x <= last.x; ++key.x)
+        for (key.y = first.y; key.y <= last.y; ++key.y)
+            for (key.z = first.z; key.z <= last.z; ++key.z)
+                getBrick(key)->dirty = true;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::brickRange(const BoundingBox &bbox,
+                                 BrickKey *first, BrickKey *last) const
+{
+    // grid range covered by the box, with one voxel of margin
+
+    const Vector &vmin = bbox.vmin();
+    const Vector &vmax = bbox.vmax();
+    int n = _gridBrickSize;
+
+    int gx0 = (int)floor((vmin.x() - _gridOrigin.x()) / _voxelSize.x()) - 1;
+    int gy0 = (int)floor((vmin.y() - _gridOrigin.y()) / _voxelSize.y()) - 1;
+    int gz0 = (int)floor((vmin.z() - _gridOrigin.z()) / _voxelSize.z()) - 1;
+    int gx1 = (int)ceil((vmax.x() - _gridOrigin.x()) / _voxelSize.x()) + 1;
+    int gy1 = (int)ceil((vmax.y() - _gridOrigin.y()) / _voxelSize.y()) + 1;
+    int gz1 = (int)ceil((vmax.z() - _gridOrigin.z()) / _voxelSize.z()) + 1;
+
+    // a brick owns grid points b*N through b*N+N inclusive, so a grid
+    // point on a brick boundary dirties the bricks on both sides
+
+    first->x = (int)floor((gx0 - 1) / (float)n);
+    first->y = (int)floor((gy0 - 1) / (float)n);
+    first->z = (int)floor((gz0 - 1) / (float)n);
+    last->x = (int)floor(gx1 / (float)n);
+    last->y = (int)floor(gy1 / (float)n);
+    last->z = (int)floor(gz1 / (float)n);
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::invalidate(
+    const BoundingBox &oldBBox, const BoundingBox &newBBox)
+{
+    invalidate(oldBBox);
+    invalidate(newBBox);
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::setChildTransform(
+    Isosurface *child, const Transform &t)
+{
+    BoundingBox oldBBox = child->globalBoundingBox();
+    child->setTransform(t);
+
+    // recompute the global transforms throughout the tree
+    _iso->prepare(Transform());
+
+    invalidate(oldBBox, child->globalBoundingBox());
+}
+
+//----------------------------------------------------------------------------
+
+Mesh *IsoMesher_Brick::updateMesh()
+{
+    if (! _mesh)
+        return 0;
+
+    _iso->prepare(Transform());
+    updateLevels();
+
+    // the seams of the dirty bricks and their neighbors are taken
+    // out, and stitched again once the bricks are updated
+
+    BricksSet seamBricks;
+    BricksMap::iterator it = _bricks.begin();
+    while (it != _bricks.end()) {
+        Brick *brick = (*it).second;
+        ++it;
+        if (! brick->dirty)
+            continue;
+        seamBricks.insert(brick);
+        for (int side = 0; side < NUM_SIDES; ++side) {
+            Brick *neighbor = findNeighbor(brick, side);
+            if (neighbor)
+                seamBricks.insert(neighbor);
+        }
+    }
+
+    BricksSet::iterator itSeams = seamBricks.begin();
+    while (itSeams != seamBricks.end()) {
+        Brick *brick = (*itSeams);
+        for (int side = 0; side < NUM_SIDES; ++side)
+            removeFaces(&brick->seams[side]);
+        ++itSeams;
+    }
+
+    int total = numDirtyBricks();
+    int done = 0;
+
+    it = _bricks.begin();
+    while (it != _bricks.end()) {
+        Brick *brick = (*it).second;
+        ++it;
+        if (! brick->dirty)
+            continue;
+
+        updateBrick(brick);
+
+        ++done;
+        _progressPercent = (int)(done * 100.0f / total);
+        if (invokeProgressFunc())
+            break;
+    }
+
+    // bricks still dirty after a cancel are stitched on the next update
+
+    itSeams = seamBricks.begin();
+    while (itSeams != seamBricks.end()) {
+        if (! (*itSeams)->dirty)
+            stitchSeams(*itSeams);
+        ++itSeams;
+    }
+
+    return _mesh;
+}
+
+//----------------------------------------------------------------------------
+
+int IsoMesher_Brick::numDirtyBricks() const
+{
+    int count = 0;
+    BricksMap::const_iterator it = _bricks.begin();
+    while (it != _bricks.end()) {
+        if ((*it).second->dirty)
+            ++count;
+        ++it;
+    }
+    return count;
+}
+
+//----------------------------------------------------------------------------
+
+int IsoMesher_Brick::numBricksAtLevel(int level) const
+{
+    int count = 0;
+    BricksMap::const_iterator it = _bricks.begin();
+    while (it != _bricks.end()) {
+        if ((*it).second->level == level)
+            ++count;
+        ++it;
+    }
+    return count;
+}
+
+//----------------------------------------------------------------------------
+
+IsoMesher_Brick::Brick *IsoMesher_Brick::getBrick(const BrickKey &key)
+{
+    BricksMap::iterator it = _bricks.lower_bound(key);
+    if (it != _bricks.end() && !(key < (*it).first))
+        return (*it).second;
+
+    Brick *brick = new Brick;
+    brick->key = key;
+    brick->level = 0;
+    brick->densities = 0;
+    brick->dirty = true;
+    _bricks.insert(it, BricksMap::value_type(key, brick));
+    return brick;
+}
+
+//----------------------------------------------------------------------------
+
+IsoMesher_Brick::Brick *IsoMesher_Brick::findNeighbor(
+    const Brick *brick, int side) const
+{
+    static const int offsets[NUM_SIDES][3] = {
+        { -1, 0, 0 }, { 1, 0, 0 },
+        { 0, -1, 0 }, { 0, 1, 0 },
+        { 0, 0, -1 }, { 0, 0, 1 }
+    };
+
+    BrickKey key;
+    key.x = brick->key.x + offsets[side][0];
+    key.y = brick->key.y + offsets[side][1];
+    key.z = brick->key.z + offsets[side][2];
+
+    BricksMap::const_iterator it = _bricks.find(key);
+    if (it == _bricks.end())
+        return 0;
+    return (*it).second;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::clearBricks()
+{
+    BricksMap::iterator it = _bricks.begin();
+    while (it != _bricks.end()) {
+        Brick *brick = (*it).second;
+        if (brick->densities)
+            free(brick->densities);
+        delete brick;
+        ++it;
+    }
+    _bricks.clear();
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::updateLevels()
+{
+    int n = _gridBrickSize;
+
+    // coarsest level that still divides the brick evenly
+
+    int maxLevel = 0;
+    if (_lodDistance > 0.0f) {
+        while (maxLevel < _lodMaxLevel && (n >> (maxLevel + 1)) >= 1 &&
+               ((n >> (maxLevel + 1)) << (maxLevel + 1)) == n)
+            ++maxLevel;
+    }
+
+    // the level a brick wants, by the distance of its center
+
+    Vector brickSize = _voxelSize * (float)n;
+    BricksMap::iterator it = _bricks.begin();
+    while (it != _bricks.end()) {
+        Brick *brick = (*it).second;
+        ++it;
+        const BrickKey &key = brick->key;
+        Vector center = _gridOrigin + brickSize *
+            Vector(key.x + 0.5f, key.y + 0.5f, key.z + 0.5f);
+        float distance = (float)(center - _lodFocus).length();
+
+        int level = 0;
+        float limit = _lodDistance;
+        while (level < maxLevel && distance > limit) {
+            ++level;
+            limit *= 2.0f;
+        }
+        brick->nextLevel = level;
+    }
+
+    // neighbors may differ by one level at most, so a seam is always
+    // between a brick and one twice as coarse
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        it = _bricks.begin();
+        while (it != _bricks.end()) {
+            Brick *brick = (*it).second;
+            ++it;
+            for (int side = 0; side < NUM_SIDES; ++side) {
+                Brick *neighbor = findNeighbor(brick, side);
+                if (neighbor && brick->nextLevel > neighbor->nextLevel + 1) {
+                    brick->nextLevel = neighbor->nextLevel + 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    it = _bricks.begin();
+    while (it != _bricks.end()) {
+        Brick *brick = (*it).second;
+        ++it;
+        if (brick->nextLevel == brick->level)
+            continue;
+        brick->level = brick->nextLevel;
+        if (brick->densities) {
+            free(brick->densities);
+            brick->densities = 0;
+        }
+        brick->dirty = true;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::computeBrick(const Brick *brick, float *densities)
+{
+    // a brick at level L samples every 2^L'th grid point.  Runs with
+    // a stride go around the density cache, which holds the grid at
+    // the voxel size
+
+    const BrickKey &key = brick->key;
+    int step = 1 << brick->level;
+    int n = _gridBrickSize >> brick->level;
+    int n1 = n + 1;
+    Vector voxelSize = _voxelSize * (float)step;
+    float z0 = _gridOrigin.z() + (key.z * n) * voxelSize.z();
+
+    for (int i = 0; i < n1; ++i) {
+        float x0 = _gridOrigin.x() + (key.x * n + i) * voxelSize.x();
+        for (int j = 0; j < n1; ++j) {
+            float y0 = _gridOrigin.y() + (key.y * n + j) * voxelSize.y();
+            computeDensities(x0, y0, z0, n1, densities, step);
+            for (int k = 0; k < n1; ++k)
+                densities[k] += 1e-4f;
+            densities += n1;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::removeFaces(BrickFacesList *faces)
+{
+    // group the faces by plane, so each plane is walked once
+
+    typedef std::map<Mesh::MeshPlane *, std::set<MeshFace *> > PlaneFacesMap;
+    PlaneFacesMap planeFaces;
+
+    BrickFacesList::const_iterator it = faces->begin();
+    while (it != faces->end()) {
+        planeFaces[(*it).plane].insert((*it).face);
+        ++it;
+    }
+
+    PlaneFacesMap::iterator itPlanes = planeFaces.begin();
+    while (itPlanes != planeFaces.end()) {
+        _mesh->removeFaces((*itPlanes).second, (*itPlanes).first);
+        ++itPlanes;
+    }
+
+    faces->clear();
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::updateBrick(Brick *brick)
+{
+    int n = _gridBrickSize >> brick->level;
+    int size = (n + 1) * (n + 1) * (n + 1);
+    float *densities = (float *)malloc(sizeof(float) * size);
+    computeBrick(brick, densities);
+
+    bool unchanged = (brick->densities != 0 &&
+        memcmp(brick->densities, densities, sizeof(float) * size) == 0);
+
+    if (brick->densities)
+        free(brick->densities);
+    brick->densities = densities;
+    brick->dirty = false;
+
+    // nothing to splice if the edit did not reach the grid points
+    if (unchanged)
+        return;
+
+    removeFaces(&brick->faces);
+
+    _currentFaces = &brick->faces;
+    const BrickKey &key = brick->key;
+    marchBlock(_gridOrigin, _voxelSize * (float)(1 << brick->level),
+               key.x * n, key.y * n, key.z * n, n, n, n, densities);
+    _currentFaces = 0;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::meshBrick(const BrickKey &key, IndexedMesh *buffer)
+{
+    Brick brick;
+    brick.key = key;
+    brick.level = 0;
+    brick.densities = 0;
+
+    int n = _gridBrickSize;
+    float *densities = (float *)malloc(sizeof(float) * (n + 1) * (n + 1) * (n + 1));
+    computeBrick(&brick, densities);
+
+    // march into a mesh of the brick's own, which merges the points
+    // the faces share, and collect the faces in the order they come
+
+    Mesh *mesh = _mesh;
+    _mesh = new Mesh();
+    BrickFacesList faces;
+    _currentFaces = &faces;
+    marchBlock(_gridOrigin, _voxelSize, key.x * n, key.y * n, key.z * n,
+               n, n, n, densities);
+    _currentFaces = 0;
+    free(densities);
+
+    std::map<const Vector *, int> pointIndex;
+    std::map<MaterialPalette::Id, int> materialIndex;
+    std::vector<MaterialPalette::Id> pointIds;
+    BrickFacesList::const_iterator it = faces.begin();
+    while (it != faces.end()) {
+        const MeshFace *face = (*it).face;
+        ++it;
+
+        for (int k = 0; k < 3; ++k) {
+            // a face vertex is the point of a MeshPoint
+            const Vector *v = face->vertexPtr(k);
+            std::pair<std::map<const Vector *, int>::iterator, bool> point =
+                pointIndex.insert(std::make_pair(v, (int)buffer->points.size()));
+            if (point.second) {
+                const Mesh::MeshPoint *mpoint = (const Mesh::MeshPoint *)v;
+                buffer->points.push_back(mpoint->point);
+                buffer->normals.push_back(mpoint->normal);
+                pointIds.push_back(mpoint->material);
+            }
+            buffer->faces.push_back((*point.first).second);
+        }
+
+        std::pair<std::map<MaterialPalette::Id, int>::iterator, bool> material =
+            materialIndex.insert(std::make_pair(
+                face->_material, (int)buffer->materials.size()));
+        if (material.second)
+            buffer->materials.push_back(_mesh->palette().get(face->_material));
+        buffer->faceMaterials.push_back((*material.first).second);
+    }
+
+    // the materials of the points, after those of the faces
+
+    buffer->pointMaterials.resize(pointIds.size());
+    for (unsigned int i = 0; i < pointIds.size(); ++i) {
+        std::pair<std::map<MaterialPalette::Id, int>::iterator, bool> material =
+            materialIndex.insert(std::make_pair(
+                pointIds[i], (int)buffer->materials.size()));
+        if (material.second)
+            buffer->materials.push_back(_mesh->palette().get(pointIds[i]));
+        buffer->pointMaterials[i] = (*material.first).second;
+    }
+
+    delete _mesh;
+    _mesh = mesh;
+}
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+// points on the sides of bricks are matched through cells of the
+// weld tolerance; a match lies in the point's cell or next to it
+
+struct WeldCell {
+    long k[3];
+
+    bool operator<(const WeldCell &other) const
+    {
+        for (int i = 0; i < 3; ++i)
+            if (k[i] != other.k[i])
+                return (k[i] < other.k[i]);
+        return false;
+    }
+};
+
+typedef std::multimap<WeldCell, int> WeldMap;
+
+WeldCell weldCell(const Vector &v)
+{
+    WeldCell cell;
+    cell.k[0] = (long)floor(v.x() / WELD_TOLERANCE);
+    cell.k[1] = (long)floor(v.y() / WELD_TOLERANCE);
+    cell.k[2] = (long)floor(v.z() / WELD_TOLERANCE);
+    return cell;
+}
+
+inline bool onSide(const Vector &v, const Vector &vmin, const Vector &vmax)
+{
+    return (fabs(v.x() - vmin.x()) < WELD_TOLERANCE ||
+            fabs(v.x() - vmax.x()) < WELD_TOLERANCE ||
+            fabs(v.y() - vmin.y()) < WELD_TOLERANCE ||
+            fabs(v.y() - vmax.y()) < WELD_TOLERANCE ||
+            fabs(v.z() - vmin.z()) < WELD_TOLERANCE ||
+            fabs(v.z() - vmax.z()) < WELD_TOLERANCE);
+}
+
+// @return the index of a point of @p welds within the tolerance of
+// @p v, or -1.  The cells are searched in a fixed order
+
+int findWeld(const WeldMap &welds, const std::vector<Vector> &points,
+             const Vector &v)
+{
+    WeldCell center = weldCell(v);
+    WeldCell cell;
+    for (int i = -1; i <= 1; ++i) {
+        cell.k[0] = center.k[0] + i;
+        for (int j = -1; j <= 1; ++j) {
+            cell.k[1] = center.k[1] + j;
+            for (int k = -1; k <= 1; ++k) {
+                cell.k[2] = center.k[2] + k;
+                WeldMap::const_iterator it = welds.lower_bound(cell);
+                for (; it != welds.end() && !(cell < (*it).first); ++it) {
+                    const Vector &v2 = points[(*it).second];
+                    if (fabs(v.x() - v2.x()) < WELD_TOLERANCE &&
+                        fabs(v.y() - v2.y()) < WELD_TOLERANCE &&
+                        fabs(v.z() - v2.z()) < WELD_TOLERANCE)
+                        return (*it).second;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::mergeBricks(const std::vector<BrickKey> &keys,
+                                  const std::vector<IndexedMesh> &buffers,
+                                  IndexedMesh *imesh) const
+{
+    typedef IndexedMesh::Material Material;
+
+    int numBricks = (int)keys.size();
+    std::vector<std::vector<int> > pointMap(numBricks);
+    std::vector<std::vector<int> > materialMap(numBricks);
+    std::vector<int> firstFace(numBricks + 1);
+    std::vector<Vector> sidePoints;     // by final index, where welded
+    WeldMap welds;
+    std::map<Material, int> materialIndex;
+    int numPoints = 0;
+    int numFaces = 0;
+    int b;
+
+    imesh->points.clear();
+    imesh->normals.clear();
+    imesh->pointMaterials.clear();
+    imesh->materials.clear();
+
+    // first pass, in grid order:  number the points of each brick
+    // after those of the bricks before it, but give the points on its
+    // sides that an earlier brick already has the number they got
+    // there.  The faces go at a running sum of face counts
+
+    Vector brickSize = _voxelSize * (float)_gridBrickSize;
+    for (b = 0; b < numBricks; ++b) {
+        const IndexedMesh &buffer = buffers[b];
+        const BrickKey &key = keys[b];
+        Vector vmin = _gridOrigin +
+            brickSize * Vector((float)key.x, (float)key.y, (float)key.z);
+        Vector vmax = vmin + brickSize;
+
+        int count = (int)buffer.materials.size();
+        materialMap[b].resize(count);
+        for (int m = 0; m < count; ++m) {
+            std::pair<std::map<Material, int>::iterator, bool> material =
+                materialIndex.insert(std::make_pair(
+                    buffer.materials[m], (int)imesh->materials.size()));
+            if (material.second)
+                imesh->materials.push_back(buffer.materials[m]);
+            materialMap[b][m] = (*material.first).second;
+        }
+
+        count = (int)buffer.points.size();
+        pointMap[b].resize(count);
+        for (int i = 0; i < count; ++i) {
+            const Vector &v = buffer.points[i];
+            int index = -1;
+            bool side = onSide(v, vmin, vmax);
+            if (side)
+                index = findWeld(welds, sidePoints, v);
+            if (index < 0) {
+                index = numPoints++;
+                imesh->points.push_back(v);
+                imesh->normals.push_back(buffer.normals[i]);
+                imesh->pointMaterials.push_back(
+                    materialMap[b][buffer.pointMaterials[i]]);
+                if (side) {
+                    sidePoints.resize(numPoints);
+                    sidePoints[index] = v;
+                    welds.insert(std::make_pair(weldCell(v), index));
+                }
+            }
+            pointMap[b][i] = index;
+        }
+
+        firstFace[b] = numFaces;
+        numFaces += buffer.numFaces();
+    }
+    firstFace[numBricks] = numFaces;
+
+    // second pass:  each brick copies its faces to its own place
+
+    imesh->faces.resize(numFaces * 3);
+    imesh->faceMaterials.resize(numFaces);
+    for (b = 0; b < numBricks; ++b) {
+        const IndexedMesh &buffer = buffers[b];
+        int *faces = (numFaces != 0 ? &imesh->faces[firstFace[b] * 3] : 0);
+        int *materials = (numFaces != 0 ? &imesh->faceMaterials[firstFace[b]] : 0);
+        int count = buffer.numFaces();
+        for (int f = 0; f < count; ++f) {
+            faces[f * 3 + 0] = pointMap[b][buffer.faces[f * 3 + 0]];
+            faces[f * 3 + 1] = pointMap[b][buffer.faces[f * 3 + 1]];
+            faces[f * 3 + 2] = pointMap[b][buffer.faces[f * 3 + 2]];
+            materials[f] = materialMap[b][buffer.faceMaterials[f]];
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::stitchSeams(Brick *brick)
+{
+    for (int side = 0; side < NUM_SIDES; ++side) {
+        Brick *neighbor = findNeighbor(brick, side);
+        if (neighbor && ! neighbor->dirty && neighbor->level > brick->level)
+            stitchSeam(brick, neighbor, side);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+struct SeamEdge {
+    const Vector *from, *to;
+    const MeshFace *face;               // 0 for a bridge
+    bool used;
+};
+
+// the points on a seam are ordered by their coordinates, not their
+// addresses, so the loops are walked and bridged the same way on every
+// run.  The points of the mesh are welded, so no two of them are equal
+
+inline bool seamPointBefore(const Vector *v0, const Vector *v1)
+{
+    if (v0->x() != v1->x())
+        return (v0->x() < v1->x());
+    if (v0->y() != v1->y())
+        return (v0->y() < v1->y());
+    return (v0->z() < v1->z());
+}
+
+struct SeamPointBefore {
+    bool operator()(const Vector *v0, const Vector *v1) const
+    {
+        return seamPointBefore(v0, v1);
+    }
+};
+
+typedef std::pair<const Vector *, const Vector *> SeamEdgeKey;
+
+struct SeamEdgeBefore {
+    bool operator()(const SeamEdgeKey &e0, const SeamEdgeKey &e1) const
+    {
+        if (e0.first != e1.first)
+            return seamPointBefore(e0.first, e1.first);
+        return seamPointBefore(e0.second, e1.second);
+    }
+};
+
+typedef std::map<SeamEdgeKey, const MeshFace *, SeamEdgeBefore> SeamEdgesMap;
+typedef std::map<const Vector *, int, SeamPointBefore> SeamPointsMap;
+typedef std::multimap<const Vector *, int, SeamPointBefore> SeamOutgoingMap;
+
+inline float axisCoord(const Vector &v, int axis)
+{
+    return (axis == 0 ? v.x() : (axis == 1 ? v.y() : v.z()));
+}
+
+// do edges p0-p1 and q0-q1 cross, seen along axis @p axis
+
+bool seamEdgesCross(const Vector &p0, const Vector &p1,
+                    const Vector &q0, const Vector &q1, int axis)
+{
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    double pu = axisCoord(p1, u) - axisCoord(p0, u);
+    double pv = axisCoord(p1, v) - axisCoord(p0, v);
+    double qu = axisCoord(q1, u) - axisCoord(q0, u);
+    double qv = axisCoord(q1, v) - axisCoord(q0, v);
+    double du = axisCoord(q0, u) - axisCoord(p0, u);
+    double dv = axisCoord(q0, v) - axisCoord(p0, v);
+    double side0 = pu * dv - pv * du;                   // q0 from p
+    double side1 = pu * (dv + qv) - pv * (du + qu);     // q1 from p
+    double side2 = qu * dv - qv * du;                   // p0 from q
+    double side3 = qu * (dv - pv) - qv * (du - pu);     // p1 from q
+    return (side0 * side1 < 0.0 && side2 * side3 < 0.0);
+}
+
+// cut @p loop into faces.  Where the contours of the two bricks
+// overlap, the loop crosses itself, and Mesh_Opt::triangulateLoop()
+// refuses it; the loop is then cut in two, from the start of one of
+// the crossing edges to the start of the other, and each part is cut
+// alone.  The parts turn opposite ways, and share the cut.  Returns
+// false if a part is left without faces
+
+bool triangulateSeamLoop(const std::vector<const Vector *> &loop, int axis,
+                         std::vector<const Vector *> *triangles)
+{
+    if (Mesh_Opt::triangulateLoop(loop, axis, triangles))
+        return true;
+
+    int n = (int)loop.size();
+    for (int i = 0; i < n; ++i) {
+        for (int j = i + 2; j < n; ++j) {
+            if (i == 0 && j == n - 1)
+                continue;
+            if (! seamEdgesCross(*loop[i], *loop[i + 1],
+                                 *loop[j], *loop[(j + 1) % n], axis))
+                continue;
+            std::vector<const Vector *> part0(
+                loop.begin() + i, loop.begin() + j + 1);
+            std::vector<const Vector *> part1(loop.begin() + j, loop.end());
+            part1.insert(part1.end(), loop.begin(), loop.begin() + i + 1);
+            bool filled0 = triangulateSeamLoop(part0, axis, triangles);
+            bool filled1 = triangulateSeamLoop(part1, axis, triangles);
+            return (filled0 && filled1);
+        }
+    }
+    return false;
+}
+
+// collect the edges of @p faces that lie in the plane where coordinate
+// @p axis is @p c.  An edge met in both directions is shared by two
+// faces, and is not a boundary of the surface
+
+void collectSeamEdges(const std::list<MeshFace *> &faces,
+                      int axis, float c, float tolerance,
+                      SeamEdgesMap *edges)
+{
+    std::list<MeshFace *>::const_iterator it = faces.begin();
+    while (it != faces.end()) {
+        const MeshFace *face = (*it);
+        ++it;
+        for (int i = 0; i < 3; ++i) {
+            const Vector *v0 = face->vertexPtr(i);
+            const Vector *v1 = face->vertexPtr((i + 1) % 3);
+            if (fabs(axisCoord(*v0, axis) - c) > tolerance ||
+                fabs(axisCoord(*v1, axis) - c) > tolerance)
+                continue;
+            SeamEdgesMap::iterator itReverse =
+                edges->find(SeamEdgeKey(v1, v0));
+            if (itReverse != edges->end())
+                edges->erase(itReverse);
+            else
+                (*edges)[SeamEdgeKey(v0, v1)] = face;
+        }
+    }
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::stitchSeam(Brick *brick, Brick *coarse, int side)
+{
+    // on the common side, the contour of the coarse brick cuts across
+    // the contour of the fine brick.  The boundary edges that the two
+    // leave on the side form closed loops, which are filled with faces
+
+    int axis = side >> 1;
+    int n = _gridBrickSize;
+    float voxel = axisCoord(_voxelSize, axis);
+    int key = (axis == 0 ? brick->key.x :
+              (axis == 1 ? brick->key.y : brick->key.z));
+    float c = axisCoord(_gridOrigin, axis) + (key + (side & 1)) * n * voxel;
+    float tolerance = voxel * 1e-3f;
+
+    std::list<MeshFace *> faces;
+    BrickFacesList::const_iterator itFaces = brick->faces.begin();
+    while (itFaces != brick->faces.end()) {
+        faces.push_back((*itFaces).face);
+        ++itFaces;
+    }
+    itFaces = coarse->faces.begin();
+    while (itFaces != coarse->faces.end()) {
+        faces.push_back((*itFaces).face);
+        ++itFaces;
+    }
+
+    SeamEdgesMap edgesMap;
+    collectSeamEdges(faces, axis, c, tolerance, &edgesMap);
+    if (edgesMap.empty())
+        return;
+
+    std::vector<SeamEdge> edges;
+    SeamPointsMap balance;              // outgoing minus incoming
+    SeamEdgesMap::const_iterator itEdges = edgesMap.begin();
+    while (itEdges != edgesMap.end()) {
+        SeamEdge edge;
+        edge.from = (*itEdges).first.first;
+        edge.to = (*itEdges).first.second;
+        edge.face = (*itEdges).second;
+        edge.used = false;
+        edges.push_back(edge);
+        ++balance[edge.from];
+        --balance[edge.to];
+        ++itEdges;
+    }
+
+    // the contours of the two bricks end at points that are close but
+    // not shared, where they cross the edges of the coarse voxels.
+    // Bridge each open end to the nearest open start
+
+    float reach = (float)(_voxelSize * (float)(1 << coarse->level)).length();
+    SeamPointsMap::iterator itEnd = balance.begin();
+    while (itEnd != balance.end()) {
+        while ((*itEnd).second < 0) {
+            SeamPointsMap::iterator itBest = balance.end();
+            double bestDistance = reach;
+            SeamPointsMap::iterator itStart = balance.begin();
+            while (itStart != balance.end()) {
+                if ((*itStart).second > 0) {
+                    double distance =
+                        (*(*itStart).first - *(*itEnd).first).length();
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        itBest = itStart;
+                    }
+                }
+                ++itStart;
+            }
+            if (itBest == balance.end())
+                break;
+
+            SeamEdge bridge;
+            bridge.from = (*itEnd).first;
+            bridge.to = (*itBest).first;
+            bridge.face = 0;
+            bridge.used = false;
+            edges.push_back(bridge);
+            ++(*itEnd).second;
+            --(*itBest).second;
+        }
+        ++itEnd;
+    }
+
+    // walk the edges into loops.  Where the two contours touch, a walk
+    // comes back to a point it has passed, and the part since then is
+    // a loop of its own; a walk is cut into such simple loops
+
+    SeamOutgoingMap outgoing;
+    int numEdges = (int)edges.size();
+    int e;
+    for (e = 0; e < numEdges; ++e)
+        outgoing.insert(std::make_pair(edges[e].from, e));
+
+    _currentFaces = &brick->seams[side];
+
+    for (e = 0; e < numEdges; ++e) {
+        if (edges[e].used)
+            continue;
+
+        std::vector<const Vector *> loop;
+        SeamPointsMap positions;
+        const MeshFace *source = 0;
+        int cur = e;
+        while (1) {
+            edges[cur].used = true;
+            positions[edges[cur].from] = (int)loop.size();
+            loop.push_back(edges[cur].from);
+            if (! source)
+                source = edges[cur].face;
+            const Vector *to = edges[cur].to;
+
+            SeamPointsMap::iterator itPosition = positions.find(to);
+            if (itPosition != positions.end()) {
+                int first = (*itPosition).second;
+                std::vector<const Vector *> part(
+                    loop.begin() + first, loop.end());
+                if (source)
+                    fillSeamLoop(&part, axis, source->_material);
+                for (unsigned int i = first; i < loop.size(); ++i)
+                    positions.erase(loop[i]);
+                loop.resize(first);
+                if (loop.empty())
+                    break;
+            }
+
+            int next = -1;
+            SeamOutgoingMap::iterator itOut = outgoing.lower_bound(to);
+            while (itOut != outgoing.end() && (*itOut).first == to) {
+                if (! edges[(*itOut).second].used) {
+                    next = (*itOut).second;
+                    break;
+                }
+                ++itOut;
+            }
+            if (next < 0)
+                break;
+            cur = next;
+        }
+    }
+
+    _currentFaces = 0;
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::fillSeamLoop(std::vector<const Vector *> *loop,
+                                   int axis, MaterialPalette::Id material)
+{
+    // the faces turn against the loop, so they meet the edges of the
+    // bricks' faces in the opposite direction.  A loop is a thin strip
+    // between the two contours, and bends with them, so it is cut by
+    // clipping ears rather than into a fan
+
+    if (loop->size() < 3)
+        return;
+    std::reverse(loop->begin(), loop->end());
+
+    std::vector<const Vector *> triangles;
+    triangulateSeamLoop(*loop, axis, &triangles);
+    for (unsigned int i = 0; i < triangles.size(); i += 3) {
+        MeshFace *face = new MeshFace(triangles[i], triangles[i + 1],
+            triangles[i + 2], material);
+        addFace(face);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_Brick::addFace(MeshFace *face)
+{
+    Mesh::MeshPlane *plane = _mesh->addFace(face);
+    if (! plane) {
+        delete face;
+        return;
+    }
+
+    BrickFace brickFace;
+    brickFace.face = face;
+    brickFace.plane = plane;
+    _currentFaces->push_back(brickFace);
+}
@@ -0,0 +1,260 @@
+//----------------------------------------------------------------------------
+// ThreeD Incremental (Brick) Marching Cubes Isosurface Mesh Generator
+//----------------------------------------------------------------------------
+
+#ifndef _THREED_ISOMESHER_BRICK_H
+#define _THREED_ISOMESHER_BRICK_H
+
+#include <threed/isomesher_mc.h>
+#include <threed/mesh_opt.h>
+#include <map>
+#include <list>
+#include <set>
+
+namespace ThreeD {
+
+
+/**
+ * IsoMesher, Marching Cubes over a grid of bricks
+ *
+ * The grid is divided into bricks of N x N x N voxels.  Each brick
+ * keeps its density grid and the list of faces it contributed to the
+ * mesh.  After an edit of the isosurface, only the bricks overlapping
+ * the edited region are evaluated again, and their faces are spliced
+ * into the mesh that was returned by createMesh().
+ *
+ * Typical use in an editor:
+ *
+ *     mesher.setChildTransform(child, newTrans);
+ *     mesher.updateMesh();
+ *
+ * With level of detail, bricks away from a focus point are meshed
+ * with larger voxels.  Where a brick meets a coarser neighbor, the
+ * contours that the two leave on their common side are joined by
+ * stitching faces, which close the crack between them.
+ *
+ * Faces are generated in the coordinates of the isosurface, so the
+ * mesh should not be transformed (or centralized) between updates.
+ *
+ * createIndexedMesh() meshes the bricks once, each into buffers of
+ * its own, and assembles the buffers in grid order, so that the
+ * output does not depend on the order in which the bricks are meshed.
+ */
+class IsoMesher_Brick : public IsoMesher_MC
+{
+public:
+    /** Construct a mesh generator
+     */
+    IsoMesher_Brick(Isosurface *iso);
+
+    /** destructor.  The mesh is not destroyed.
+     */
+    virtual ~IsoMesher_Brick();
+
+    /** Set the number of voxels along each side of a brick.
+     *  Takes effect on the next createMesh()
+     */
+    void setBrickSize(int voxels);
+
+    /** Set distance-based level of detail.  Bricks whose center is
+     *  within @p distance of @p focus are meshed at the voxel size,
+     *  and the voxel size doubles with each doubling of the distance,
+     *  up to @p maxLevel times (and no coarser than one voxel per
+     *  brick).  Adjacent bricks differ by one level at most.
+     *  A @p distance of zero disables level of detail.
+     *
+     *  Takes effect on the next createMesh() or updateMesh(), which
+     *  remeshes the bricks whose level changed.
+     */
+    void setLevelOfDetail(const Vector &focus, float distance, int maxLevel);
+
+    /** Create the mesh for all bricks.  The mesher keeps a reference
+     *  to the mesh for later calls to updateMesh()
+     */
+    virtual Mesh *createMesh();
+
+    /** Create the mesh of all bricks in indexed form, in @p imesh.
+     *  Each brick is meshed into a point and face buffer of its own,
+     *  with points numbered in the order the faces use them; the
+     *  buffers are then concatenated in grid order, at offsets that
+     *  are prefix sums of their sizes.  A point on a side shared by
+     *  bricks is kept by the first of them.  The points and faces
+     *  come out in the same order however the bricks are scheduled.
+     *
+     *  All bricks are meshed at the voxel size, without level of
+     *  detail, and the mesher keeps no bricks for updateMesh().  With
+     *  a thread pool, each brick is a task, and progress is reported
+     *  once all are done.
+     *
+     *  @return false if cancelled through the progress function
+     */
+    bool createIndexedMesh(IndexedMesh *imesh);
+
+    /** Mark the bricks overlapping @p bbox as dirty, and drop the
+     *  densities cached there
+     */
+    void invalidate(const BoundingBox &bbox);
+
+    /** Mark the bricks overlapping either the previous or the new
+     *  bounds of an edited part of the isosurface as dirty
+     */
+    void invalidate(const BoundingBox &oldBBox, const BoundingBox &newBBox);
+
+    /** Set the transform of @p child, some descendant of the meshed
+     *  isosurface, and invalidate the bricks it moved from and to
+     */
+    void setChildTransform(Isosurface *child, const Transform &t);
+
+    /** Re-evaluate the dirty bricks and splice their faces into
+     *  the mesh.  If cancelled through the progress function, the
+     *  remaining bricks stay dirty for the next update.
+     *
+     *  @return the updated mesh
+     */
+    Mesh *updateMesh();
+
+    /** @return the number of bricks waiting for an update
+     */
+    int numDirtyBricks() const;
+
+    /** @return the number of bricks meshed at @p level
+     */
+    int numBricksAtLevel(int level) const;
+
+protected:
+
+    enum {
+        NUM_SIDES = 6                   // -x, +x, -y, +y, -z, +z
+    };
+
+    struct BrickKey {
+        int x, y, z;
+
+        bool operator<(const BrickKey &other) const
+        {
+            if (x != other.x)
+                return (x < other.x);
+            if (y != other.y)
+                return (y < other.y);
+            return (z < other.z);
+        }
+    };
+
+    struct BrickFace {
+        MeshFace *face;
+        Mesh::MeshPlane *plane;
+    };
+
+    typedef std::list<BrickFace> BrickFacesList;
+
+    struct Brick {
+        BrickKey key;
+        int level;                      // voxels are 2^level times larger
+        float *densities;               // (N / 2^level + 1)^3 grid points
+        BrickFacesList faces;           // faces spliced into the mesh
+        BrickFacesList seams[NUM_SIDES];// stitches to coarser neighbors
+        bool dirty;
+        int nextLevel;                  // scratch for updateLevels()
+    };
+
+    struct BrickTask;
+    friend struct BrickTask;
+
+    // bricks in grid order, so the seams are stitched in the same
+    // order on every run
+    struct BrickBefore {
+        bool operator()(const Brick *brick0, const Brick *brick1) const
+        {
+            return (brick0->key < brick1->key);
+        }
+    };
+
+    typedef std::map<BrickKey, Brick *> BricksMap;
+    typedef std::set<Brick *, BrickBefore> BricksSet;
+
+    /** Find the range of bricks, @p first through @p last, that
+     *  hold the grid points overlapping @p bbox, with one voxel of
+     *  margin
+     */
+    void brickRange(const BoundingBox &bbox,
+                    BrickKey *first, BrickKey *last) const;
+
+    /** Find or create the brick at grid position @p key
+     */
+    Brick *getBrick(const BrickKey &key);
+
+    /** @return the neighbor of a brick on side @p side, or 0
+     */
+    Brick *findNeighbor(const Brick *brick, int side) const;
+
+    /** Delete all bricks
+     */
+    void clearBricks();
+
+    /** Compute the level of every brick, and mark the bricks whose
+     *  level changed as dirty
+     */
+    void updateLevels();
+
+    /** Compute the densities of all the grid points of a brick
+     */
+    void computeBrick(const Brick *brick, float *densities);
+
+    /** Remove a list of faces from the mesh
+     */
+    void removeFaces(BrickFacesList *faces);
+
+    /** Re-evaluate a dirty brick and regenerate its faces
+     */
+    void updateBrick(Brick *brick);
+
+    /** Mesh the brick at @p key, at the voxel size, into a mesh of
+     *  its own, and return its points and faces in @p buffer
+     */
+    void meshBrick(const BrickKey &key, IndexedMesh *buffer);
+
+    /** Concatenate the @p buffers of the bricks @p keys, in order,
+     *  into @p imesh
+     */
+    void mergeBricks(const std::vector<BrickKey> &keys,
+                     const std::vector<IndexedMesh> &buffers,
+                     IndexedMesh *imesh) const;
+
+    /** Stitch the seams between a brick and its coarser neighbors
+     */
+    void stitchSeams(Brick *brick);
+
+    /** Stitch the seam on side @p side of @p brick, whose neighbor
+     *  @p coarse is meshed at a larger voxel size
+     */
+    void stitchSeam(Brick *brick, Brick *coarse, int side);
+
+    /** Fill the loop @p loop, which passes no point twice, in the
+     *  plane across axis @p axis, with faces of material @p material
+     *  that turn against it
+     */
+    void fillSeamLoop(std::vector<const Vector *> *loop, int axis,
+                      MaterialPalette::Id material);
+
+    /** Record the faces of the brick being updated
+     */
+    virtual void addFace(MeshFace *face);
+
+    /*
+     * data
+     */
+
+    int _brickSize;
+    int _gridBrickSize;                 // brick size of the current grid
+    Vector _gridOrigin;
+    BricksMap _bricks;
+    BrickFacesList *_currentFaces;
+
+    Vector _lodFocus;
+    float _lodDistance;
+    int _lodMaxLevel;
+};
+
+
+} // namespace ThreeD
+#endif // _THREED_ISOMESHER_BRICK_H
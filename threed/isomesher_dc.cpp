@@ -32,52 +32,96 @@ Mesh *IsoMesher_DC::createMesh()
     int ymax = (int)ceil(bbox.vmax().y() + 3 * _voxelSize.y());
     int zmax = (int)ceil(bbox.vmax().z() + 3 * _voxelSize.z());
 
-    _xsize = (int)((xmax - xmin) / _voxelSize.x() + 1);
+    int gridX = (int)((xmax - xmin) / _voxelSize.x() + 1);
     int ysize = (int)((ymax - ymin) / _voxelSize.y() + 1);
-    _zsize = (int)((zmax - zmin) / _voxelSize.z() + 1);
-    _zsize = ((_zsize + 3) >> 2) << 2;  // round to x4
+    int gridZ = (int)((zmax - zmin) / _voxelSize.z() + 1);
+    gridZ = ((gridZ + 3) >> 2) << 2;    // round to x4
 
-    if (_xsize < 1 || ysize < 2 || _zsize < 1)
+    if (gridX < 1 || ysize < 2 || gridZ < 1)
         return 0;
 
-    // precalculate first two row (y slice) of the grid.
-
     _mesh = new Mesh();
 
-    Vector vRow = Vector(xmin, ymin, zmin);
-    Vector deltaRow = Vector(0, _voxelSize.y(), 0);
+    Vector vGrid = Vector(xmin, ymin, zmin);
+    setCacheGrid(vGrid);
+
+    // the grid is swept along y one tile at a time.  A tile generates
+    // the quads of tileX by tileZ voxels, which join the vertices of
+    // the cubes up to one past the tile, so a tile holds the grid
+    // points two past its far sides, and the next tiles compute those
+    // points and cubes again
+
+    int tileX, tileZ;
+    getTileSize(gridX, gridZ, &tileX, &tileZ);
+    int rowX = THREED_MIN(tileX + 2, gridX);
+    int rowZ = THREED_MIN(tileZ + 2, gridZ);
 
     Row row_space[3];
     Row *rows[3];
-    int y;
+    int i;
+
+    for (i = 0; i < 3; ++i) {
+        rows[i] = &row_space[i];
+        rows[i]->densities =
+            (float *)malloc(sizeof(float) * rowX * rowZ);
+        rows[i]->signs =
+            (SignWord *)malloc(sizeof(SignWord) * rowX * signWords(rowZ));
+        rows[i]->active =
+            (SignWord *)malloc(sizeof(SignWord) * rowX * signWords(rowZ));
+        rows[i]->ranks =
+            (int *)malloc(sizeof(int) * rowX * signWords(rowZ));
+    }
 
-    for (y = 0; y < 3; ++y) {
-        rows[y] = &row_space[y];
-        rows[y]->points =
-            (Vector *)malloc(sizeof(Vector) * _xsize * _zsize);
-        rows[y]->densities =
-            (float *)malloc(sizeof(float) * _xsize * _zsize);
-        rows[y]->cubes =
-            (Cube *)malloc(sizeof(Cube) * _xsize * _zsize);
-
-        if (y == 0 || y == 1) {
-            rows[y]->v = vRow;
-            computePoints(rows[y]);
-            vRow += deltaRow;
+    bool cancelled = false;
+    for (_tileX = 0; _tileX < gridX - 2 && ! cancelled; _tileX += tileX) {
+        for (_tileZ = 0; _tileZ < gridZ - 2 && ! cancelled; _tileZ += tileZ) {
+            _xsize = THREED_MIN(tileX + 2, gridX - _tileX);
+            _zsize = THREED_MIN(tileZ + 2, gridZ - _tileZ);
+            cancelled = sweepTile(vGrid, ysize, rows);
         }
     }
 
+    if (cancelled) {
+        delete _mesh;
+        _mesh = 0;
+    }
+
+    for (i = 0; i < 3; ++i) {
+        free(rows[i]->densities);
+        free(rows[i]->signs);
+        free(rows[i]->active);
+        free(rows[i]->ranks);
+    }
+
+    return _mesh;
+}
+
+//----------------------------------------------------------------------------
+
+bool IsoMesher_DC::sweepTile(
+    const Vector &vGrid, int ysize, Row *rows[3])
+{
+    // precalculate first two row (y slice) of the tile.
+
+    Vector vRow = vGrid;
+    Vector deltaRow = Vector(0, _voxelSize.y(), 0);
+    int y;
+
+    for (y = 0; y < 2; ++y) {
+        rows[y]->v = vRow;
+        computePoints(rows[y]);
+        vRow += deltaRow;
+    }
+
     computeCubes(&rows[0]);
 
     // go through the remaining rows, calculating each before
     // processing it and its preceeding row
 
     for (y = 2; y < ysize - 2; ++y) {
-        int percent = (int)(y * 100.0f / (ysize - 2));
-
         rows[2]->v = vRow;
         if (computePoints(rows[2]))
-            break;
+            return true;
         vRow += deltaRow;
 
         computeCubes(&rows[1]);
@@ -90,18 +134,7 @@ Mesh *IsoMesher_DC::createMesh()
         rows[2] = rows_0_save;
     }
 
-    if (y < ysize - 2) {        // cancelled?
-        delete _mesh;
-        _mesh = 0;
-    }
-
-    for (y = 0; y < 3; ++y) {
-        free(rows[y]->points);
-        free(rows[y]->densities);
-        free(rows[y]->cubes);
-    }
-
-    return _mesh;
+    return false;
 }
 
 //----------------------------------------------------------------------------
@@ -111,19 +144,15 @@ bool IsoMesher_DC::computePoints(Row *row)
     float x0 = row->v.x();
     float y0 = row->v.y();
     float z0 = row->v.z();
-    float dz = _voxelSize.z();
+    float dx = _voxelSize.x();
 
     for (int x = 0; x < _xsize; ++x) {
         float *densities = &row->densities[x * _zsize];
-        _iso->fDensity(x0, y0, z0, dz, _zsize, densities);
-
-        Vector *points = &row->points[x * _zsize];
-        for (int z = 0; z < _zsize; ++z) {
+        computeLine(x0 + (_tileX + x) * dx, y0, z0, _tileZ, _zsize,
+                    densities);
+        for (int z = 0; z < _zsize; ++z)
             densities[z] += 1e-4f;
-            points[z] = Vector(x0, y0, z0 + z * dz);
-        }
-
-        x0 += _voxelSize.x();
+        computeSigns(densities, _zsize, &row->signs[x * signWords(_zsize)]);
     }
 
     return false;
@@ -134,59 +163,90 @@ bool IsoMesher_DC::computePoints(Row *row)
 bool IsoMesher_DC::computeCubes(Row *rows[2])
 {
     int xsize_1 = _xsize - 1;
-    int zsize_1 = _zsize - 1;
+    float dx = _voxelSize.x();
+    float dz = _voxelSize.z();
+    int words = signWords(_zsize);
+    Row *row = rows[0];
+    int x, w;
+
+    // find the active cubes of the row first, so their records can be
+    // allocated at once, and stay put while their vertices are made
+
+    int count = 0;
+    for (x = 0; x < _xsize; ++x) {
+        SignWord *active = &row->active[x * words];
+        if (x < xsize_1) {
+            const SignWord *lines[4] = {
+                &rows[0]->signs[x * words],
+                &rows[0]->signs[(x + 1) * words],
+                &rows[1]->signs[(x + 1) * words],
+                &rows[1]->signs[x * words]
+            };
+            findMixedCubes(lines, _zsize, active);
+        } else {
+            for (w = 0; w < words; ++w)
+                active[w] = 0;
+        }
+
+        for (w = 0; w < words; ++w) {
+            row->ranks[x * words + w] = count;
+            count += countBits(active[w]);
+        }
+    }
+
+    row->cubes.resize(count);
+    Cube *cube = (count != 0 ? &row->cubes[0] : 0);
+
+    for (x = 0; x < xsize_1; ++x) {
 
-    for (int x = 0; x < xsize_1; ++x) {
-        for (int z = 0; z < zsize_1; ++z) {
-            Cube *cube = &rows[0]->cubes[x * _zsize + z];
+        // the lines of the four edges along z, in corner order
+
+        const SignWord *lines[4] = {
+            &rows[0]->signs[x * words],
+            &rows[0]->signs[(x + 1) * words],
+            &rows[1]->signs[(x + 1) * words],
+            &rows[1]->signs[x * words]
+        };
+        const SignWord *active = &row->active[x * words];
+
+        for (w = 0; w < words; ++w) {
+            for (SignWord bits = active[w]; bits != 0; bits &= bits - 1) {
+                int z = w * SIGN_BITS + lowestBit(bits);
 
 #define DENSITY_VAL(xi,yi,zi) rows[yi]->densities[(x + xi) * _zsize + (z + zi)]
-#define POINT_PTR(xi,yi,zi) &rows[yi]->points[(x + xi) * _zsize + (z + zi)]
+#define POINT_VAL(xi,yi,zi) Vector(rows[yi]->v.x() + (_tileX + x + xi) * dx,  \
+                                   rows[yi]->v.y(),  \
+                                   rows[yi]->v.z() + (_tileZ + z + zi) * dz)
 #define CORNER(n,xi,yi,zi) \
     corners[n].density = DENSITY_VAL(xi, yi, zi);  \
-    corners[n].v = POINT_PTR(xi, yi, zi);
-
-            Point corners[8];
-            CORNER(0,  0,0,0);
-            CORNER(1,  1,0,0);
-            CORNER(2,  1,1,0);
-            CORNER(3,  0,1,0);
-            CORNER(4,  0,0,1);
-            CORNER(5,  1,0,1);
-            CORNER(6,  1,1,1);
-            CORNER(7,  0,1,1);
+    corners_v[n] = POINT_VAL(xi, yi, zi);  \
+    corners[n].v = &corners_v[n];  \
+    corners[n].leaf = 0;
+
+                Point corners[8];
+                Vector corners_v[8];
+                CORNER(0,  0,0,0);
+                CORNER(1,  1,0,0);
+                CORNER(2,  1,1,0);
+                CORNER(3,  0,1,0);
+                CORNER(4,  0,0,1);
+                CORNER(5,  1,0,1);
+                CORNER(6,  1,1,1);
+                CORNER(7,  0,1,1);
 
 #undef CORNER
-#undef POINT_PTR
+#undef POINT_VAL
 #undef DENSITY_VAL
 
-            int index = 0;
-
-#define IF_DENSITY(i) if (! fsign(corners[i].density)) index |= (1 << i)
-
-            IF_DENSITY(0);
-            IF_DENSITY(1);
-            IF_DENSITY(2);
-            IF_DENSITY(3);
-            IF_DENSITY(4);
-            IF_DENSITY(5);
-            IF_DENSITY(6);
-            IF_DENSITY(7);
-
-#undef IF_DENSITY
-
-            if (_edgeTable[index] == 0) {
-                cube->index = 0;
-                cube->meshPoint = 0;
-                continue;
+                cube->index = cubeIndex(lines, z);
+                generateVertex(cube, corners);
+                ++cube;
             }
-
-            cube->index = index;
-            generateVertex(cube, corners);
         }
-
     }
 
+    resolveMaterials();
+
     return false;
 }
 
@@ -236,7 +296,7 @@ void IsoMesher_DC::generateVertex(Cube *cube, Point corners[8])
                 intersect_zaxis(&corners[n1], &corners[n2], &points[i]);
         }
 
-        _iso->fNormal(points[i].v, &normals[i]);
+        computeNormal(points[i].v, &normals[i], points[i].leaf);
 
         massPoint += *points[i].v;
         ++numIntersections;
@@ -249,11 +309,6 @@ void IsoMesher_DC::generateVertex(Cube *cube, Point corners[8])
     //
 
     Vector newPointNormal;
-    Isosurface::Material newPointMat;
-
-    newPointMat.diffuse = 0.0;
-    newPointMat.specular = 0.0;
-    newPointMat.brilliance = 0.0;
 
     double matrix[12][3];
     double vector[12];
@@ -272,17 +327,13 @@ void IsoMesher_DC::generateVertex(Cube *cube, Point corners[8])
         Vector p = *points[i].v - massPoint;
         vector[rows] = (double)(normal * p);
 
+        _edgePoints.push_back(*points[i].v);
+        _edgeDensities.push_back(points[i].density);
+        _edgeLeaves.push_back(points[i].leaf);
+
         ++rows;
 
         newPointNormal += normal;
-
-        Isosurface::Material tmpMat =
-            _iso->fMaterial(points[i].v, points[i].density);
-        newPointMat.color += tmpMat.color;
-        newPointMat.ambient += tmpMat.ambient;
-        newPointMat.diffuse += tmpMat.diffuse;
-        newPointMat.specular += tmpMat.specular;
-        newPointMat.brilliance += tmpMat.brilliance;
     }
 
     Vector newPointV;
@@ -292,11 +343,35 @@ void IsoMesher_DC::generateVertex(Cube *cube, Point corners[8])
     cube->meshPoint = _mesh->addPoint(newPointV);
     cube->meshPoint->normal = newPointNormal.normalized();
 
-    cube->mat.color = newPointMat.color / (float)rows;
-    cube->mat.ambient = newPointMat.ambient / (float)rows;
-    cube->mat.diffuse = newPointMat.diffuse / (float)rows;
-    cube->mat.specular = newPointMat.specular / (float)rows;
-    cube->mat.brilliance = newPointMat.brilliance / (float)rows;
+    _edgeCubes.push_back(std::make_pair(cube, rows));
+}
+
+//----------------------------------------------------------------------------
+
+void IsoMesher_DC::resolveMaterials()
+{
+    int numPoints = (int)_edgePoints.size();
+    if (numPoints == 0)
+        return;
+
+    std::vector<MaterialPalette::Id> materials(numPoints);
+    computeMaterials(&_edgePoints[0], &_edgeDensities[0], &_edgeLeaves[0],
+                     numPoints, &materials[0]);
+
+    MaterialPalette &palette = _mesh->palette();
+    const MaterialPalette::Id *next = &materials[0];
+    for (unsigned int i = 0; i < _edgeCubes.size(); ++i) {
+        Cube *cube = _edgeCubes[i].first;
+        int count = _edgeCubes[i].second;
+        cube->material = palette.blend(next, count);
+        cube->meshPoint->material = cube->material;
+        next += count;
+    }
+
+    _edgePoints.clear();
+    _edgeDensities.clear();
+    _edgeLeaves.clear();
+    _edgeCubes.clear();
 }
 
 //----------------------------------------------------------------------------
@@ -305,79 +380,85 @@ bool IsoMesher_DC::generateQuads(Row *rows[2])
 {
     int xsize_2 = _xsize - 2;
     int zsize_2 = _zsize - 2;
+    int words = signWords(_zsize);
+
+    // only the active cubes of the row have quads, and the cubes
+    // around their edges are active too
 
-#define CUBE_PTR(xi,yi,zi) &rows[yi]->cubes[(x + xi) * _zsize + (z + zi)]
+#define CUBE_PTR(xi,yi,zi) findCube(rows[yi], x + xi, z + zi)
 
     for (int x = 0; x < xsize_2; ++x) {
-        for (int z = 0; z < zsize_2; ++z) {
-
-            Mesh::MeshPlane *meshPlane = 0;
-
-            Cube *cubes[4];
-            cubes[0] = CUBE_PTR(0,0,0);
-            int cube0_edgeInfo = _edgeTable[cubes[0]->index];
-            int flip_if_nonzero = 0;
-
-            for (int i = 0; i < 3; ++i) {
-
-                if (i == 0 && cube0_edgeInfo & (1 << 10)) {
-                    cubes[1] = CUBE_PTR(1,0,0);
-                    cubes[2] = CUBE_PTR(1,1,0);
-                    cubes[3] = CUBE_PTR(0,1,0);
-                    flip_if_nonzero = (cubes[0]->index & (1 << 6));
-                } else if (i == 1 && cube0_edgeInfo & (1 << 6)) {
-                    cubes[1] = CUBE_PTR(0,0,1);
-                    cubes[2] = CUBE_PTR(0,1,1);
-                    cubes[3] = CUBE_PTR(0,1,0);
-                    flip_if_nonzero = (cubes[0]->index & (1 << 7));
-                } else if (i == 2 && cube0_edgeInfo & (1 << 5)) {
-                    cubes[1] = CUBE_PTR(1,0,0);
-                    cubes[2] = CUBE_PTR(1,0,1);
-                    cubes[3] = CUBE_PTR(0,0,1);
-                    flip_if_nonzero = (cubes[0]->index & (1 << 5));
-                } else
+        const SignWord *active = &rows[0]->active[x * words];
+        Cube *cube0 = (rows[0]->cubes.empty() ? 0 :
+                       &rows[0]->cubes[rows[0]->ranks[x * words]]);
+
+        for (int w = 0; w < words; ++w) {
+            for (SignWord bits = active[w]; bits != 0;
+                 bits &= bits - 1, ++cube0) {
+                int z = w * SIGN_BITS + lowestBit(bits);
+                if (z >= zsize_2)
                     continue;
 
-                // create triangles (cube0,cube2,cube1)
-                //              and (cube0,cube3,cube2)
-                // flipping last two vertices if necessary
-
-                MeshPoint *p0 = cubes[0]->meshPoint;
-                const Isosurface::Material &mat0 = cubes[0]->mat;
-
-                for (int j = 1; j < 3; ++j) {
-                    int ja, jb;
-                    if (flip_if_nonzero) {
-                        ja = j + 0;
-                        jb = j + 1;
-                    } else {
-                        ja = j + 1;
-                        jb = j + 0;
+                Mesh::MeshPlane *meshPlane = 0;
+
+                Cube *cubes[4];
+                cubes[0] = cube0;
+                int cube0_edgeInfo = _edgeTable[cubes[0]->index];
+                int flip_if_nonzero = 0;
+
+                for (int i = 0; i < 3; ++i) {
+
+                    if (i == 0 && cube0_edgeInfo & (1 << 10)) {
+                        cubes[1] = CUBE_PTR(1,0,0);
+                        cubes[2] = CUBE_PTR(1,1,0);
+                        cubes[3] = CUBE_PTR(0,1,0);
+                        flip_if_nonzero = (cubes[0]->index & (1 << 6));
+                    } else if (i == 1 && cube0_edgeInfo & (1 << 6)) {
+                        cubes[1] = CUBE_PTR(0,0,1);
+                        cubes[2] = CUBE_PTR(0,1,1);
+                        cubes[3] = CUBE_PTR(0,1,0);
+                        flip_if_nonzero = (cubes[0]->index & (1 << 7));
+                    } else if (i == 2 && cube0_edgeInfo & (1 << 5)) {
+                        cubes[1] = CUBE_PTR(1,0,0);
+                        cubes[2] = CUBE_PTR(1,0,1);
+                        cubes[3] = CUBE_PTR(0,0,1);
+                        flip_if_nonzero = (cubes[0]->index & (1 << 5));
+                    } else
+                        continue;
+
+                    // create triangles (cube0,cube2,cube1)
+                    //              and (cube0,cube3,cube2)
+                    // flipping last two vertices if necessary
+
+                    MeshPoint *p0 = cubes[0]->meshPoint;
+                    MaterialPalette::Id mat0 = cubes[0]->material;
+
+                    for (int j = 1; j < 3; ++j) {
+                        int ja, jb;
+                        if (flip_if_nonzero) {
+                            ja = j + 0;
+                            jb = j + 1;
+                        } else {
+                            ja = j + 1;
+                            jb = j + 0;
+                        }
+
+                        MeshPoint *p1 = cubes[ja]->meshPoint;
+                        MeshPoint *p2 = cubes[jb]->meshPoint;
+
+                        MaterialPalette::Id mat = _mesh->palette().blend(
+                            mat0, cubes[ja]->material, cubes[jb]->material);
+
+                        MeshFace *face = new MeshFace(
+                            &p2->point, &p1->point, &p0->point, mat);
+
+                        if (!meshPlane) {
+                            Plane p(face->vertex(0), face->vertex(1), face->vertex(2));
+                            meshPlane = _mesh->addPlane(p);
+                        }
+
+                        _mesh->addFace(face, meshPlane);
                     }
-
-                    MeshPoint *p1 = cubes[ja]->meshPoint;
-                    MeshPoint *p2 = cubes[jb]->meshPoint;
-
-                    const Isosurface::Material &mat1 = cubes[ja]->mat;
-                    const Isosurface::Material &mat2 = cubes[jb]->mat;
-
-                    Isosurface::Material mat;
-                    mat.color = (mat0.color + mat1.color + mat2.color) / 3.0f;
-                    mat.ambient = (mat0.ambient + mat1.ambient + mat2.ambient) / 3.0f;
-                    mat.diffuse = (mat0.diffuse + mat1.diffuse + mat2.diffuse) / 3.0f;
-                    mat.specular = (mat0.specular + mat1.specular + mat2.specular) / 3.0f;
-                    mat.brilliance = (mat0.brilliance + mat1.brilliance + mat2.brilliance) / 3.0f;
-
-                    MeshFace *face = new MeshFace(
-                        &p2->point, &p1->point, &p0->point,
-                        mat.color, mat.ambient, mat.diffuse, mat.specular, mat.brilliance);
-
-                    if (!meshPlane) {
-                        Plane p(face->vertex(0), face->vertex(1), face->vertex(2));
-                        meshPlane = _mesh->addPlane(p);
-                    }
-
-                    _mesh->addFace(face, meshPlane);
                 }
             }
         }
@@ -434,12 +515,11 @@ void IsoMesher_DC::generateFace(
         p2 = tmp;
     }
 
-    Isosurface::Material mat;
-    mat.color = Color(1.0f, 1.0f, 1.0f);
+    MaterialPalette::Material mat;
+    mat.c = Color(1.0f, 1.0f, 1.0f);
 
     MeshFace *face = new MeshFace(
-        &p2->point, &p1->point, &p0->point,
-        mat.color, mat.ambient, mat.diffuse, mat.specular, mat.brilliance);
+        &p2->point, &p1->point, &p0->point, _mesh->palette().add(mat));
     _mesh->addFace(face);
 }
 
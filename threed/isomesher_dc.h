@@ -6,6 +6,7 @@
 #define _THREED_ISOMESHER_DC_H
 
 #include <threed/isomesher.h>
+#include <vector>
 
 namespace ThreeD {
 
@@ -29,30 +30,60 @@ protected:
     typedef Mesh::MeshPoint MeshPoint;
 
     struct Cube {
-        int index;
         MeshPoint *meshPoint;
-        Isosurface::Material mat;
+        MaterialPalette::Id material;
+        unsigned char index;
     };
 
+    /** A row keeps only its active cubes, those with a vertex, in x
+     *  then z order.  The cube at (x,z) is found from its bit in the
+     *  active plane, and the count of active cubes before its word.
+     */
     struct Row {
-        Vector v;
-        Vector *points;
+        Vector v;                       // position of grid point (0,y,0)
         float *densities;
-        Cube *cubes;
+        SignWord *signs;                // bit plane of each line
+        SignWord *active;               // bit plane of active cubes
+        int *ranks;                     // active cubes before each word
+        std::vector<Cube> cubes;
     };
 
-    /** Compute a row (y-slice) of grid points
+    /** Sweep the tile at _tileX, _tileZ along y, through @p ysize
+     *  rows of grid points.  @return true if cancelled
+     */
+    bool sweepTile(const Vector &vGrid, int ysize, Row *rows[3]);
+
+    /** Compute a row (y-slice) of the grid points of the tile
      */
     bool computePoints(Row *row);
 
-    /** Compute a row (y-slice) of cubes (voxels)
+    /** Compute a row (y-slice) of cubes (voxels).  Only the cubes
+     *  that the bit planes of the rows show to be mixed get a vertex,
+     *  and a record in the row.
      */
     bool computeCubes(Row *rows[2]);
 
-    /** Generate a new (QEF-minimizing) vertex
+    /** @return the active cube of @p row at @p x, @p z
+     */
+    Cube *findCube(Row *row, int x, int z)
+    {
+        int words = signWords(_zsize);
+        int w = x * words + z / SIGN_BITS;
+        SignWord below = ((SignWord)1 << (z % SIGN_BITS)) - 1;
+        return &row->cubes[row->ranks[w] + countBits(row->active[w] & below)];
+    }
+
+    /** Generate a new (QEF-minimizing) vertex.  The material of the
+     *  cube is left to resolveMaterials()
      */
     void generateVertex(Cube *cube, Point corners[8]);
 
+    /** Find the materials of the intersections gathered by
+     *  generateVertex() over a row of cubes, in one pass, and give
+     *  each cube the blend of its intersections
+     */
+    void resolveMaterials();
+
     /** Generate a quad for voxels sharing an edge
      */
     bool generateQuads(Row *rows[2]);
@@ -61,8 +92,15 @@ protected:
      * data
      */
 
-    int _xsize;
+    int _xsize;                         // grid points in a tile row
     int _zsize;
+    int _tileX;                         // grid index of the tile
+    int _tileZ;
+
+    std::vector<Vector> _edgePoints;    // intersections of a row
+    std::vector<float> _edgeDensities;
+    std::vector<const Isosurface *> _edgeLeaves;
+    std::vector<std::pair<Cube *, int> > _edgeCubes;    // and their cubes
 
     static int _edgeTable[256];
 };
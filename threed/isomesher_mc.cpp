@@ -4,13 +4,36 @@
 
 #include <threed/isomesher_mc.h>
 #include <threed/meshface.h>
+#include <threed/misc.h>
+#include <threed/threadpool.h>
 //#include <malloc.h>
 #include <stdlib.h>
+#include <vector>
 
 using namespace ThreeD;
 
 //----------------------------------------------------------------------------
 
+struct IsoMesher_MC::RowTask : public ThreadPool::Task {
+    IsoMesher_MC *mesher;
+    Row *row;
+    Vector vRow;
+    bool ready;                         // under the lock
+    pthread_mutex_t *lock;
+    pthread_cond_t *done;
+
+    virtual void run()
+    {
+        mesher->computeRow(vRow, row);
+        pthread_mutex_lock(lock);
+        ready = true;
+        pthread_cond_broadcast(done);
+        pthread_mutex_unlock(lock);
+    }
+};
+
+//----------------------------------------------------------------------------
+
 IsoMesher_MC::IsoMesher_MC(Isosurface *iso)
 : IsoMesher(iso)
 {
@@ -30,68 +53,183 @@ Mesh *IsoMesher_MC::createMesh()
     int ymax = (int)ceil(bbox.vmax().y()) + 2;
     int zmax = (int)ceil(bbox.vmax().z()) + 2;
 
-    _xsize = (int)((xmax - xmin) / _voxelSize.x() + 1);
+    int gridX = (int)((xmax - xmin) / _voxelSize.x() + 1);
     int ysize = (int)((ymax - ymin) / _voxelSize.y() + 1);
-    _zsize = (int)((zmax - zmin) / _voxelSize.z() + 1);
-    _zsize = ((_zsize + 3) >> 2) << 2;  // round to x4
+    int gridZ = (int)((zmax - zmin) / _voxelSize.z() + 1);
+    gridZ = ((gridZ + 3) >> 2) << 2;    // round to x4
 
-    if (_xsize < 1 || ysize < 2 || _zsize < 1)
+    if (gridX < 1 || ysize < 2 || gridZ < 1)
         return 0;
 
-    // precalculate first row (y slice) of the grid
-
     _mesh = new Mesh();
 
-    Vector vRow = Vector(xmin, ymin, zmin);
-    Vector deltaRow = Vector(0, _voxelSize.y(), 0);
+    Vector vGrid = Vector(xmin, ymin, zmin);
+    setCacheGrid(vGrid);
+
+    // the grid is swept along y one tile at a time.  A tile holds
+    // the cubes of tileX by tileZ voxels and the grid points at their
+    // corners, so the points along its far sides are computed again
+    // by the next tiles
+
+    int tileX, tileZ;
+    getTileSize(gridX, gridZ, &tileX, &tileZ);
+    int rowX = THREED_MIN(tileX + 1, gridX);
+    int rowZ = THREED_MIN(tileZ + 1, gridZ);
+
+    // pipelined, the rows form a ring that the threads of the pool
+    // can run ahead in, by a row each and two to spare.  The density
+    // cache is not shared with them
+
+    bool pipelined = (_pool && _pool->numRunning() > 1);
+    int numRows = (pipelined ? _pool->numRunning() + 2 : 2);
+    DensityCache *cache = _cache;
+    bool cacheNormals = _cacheNormals;
+    if (pipelined) {
+        _cache = 0;
+        _cacheNormals = false;
+    }
 
-    Row row_space[2];
+    std::vector<Row> row_space(numRows);
     Row *rows[2];
-    int y;
+    int i;
 
+    for (i = 0; i < numRows; ++i) {
+        row_space[i].densities =
+            (float *)malloc(sizeof(float) * rowX * rowZ);
+        row_space[i].signs =
+            (SignWord *)malloc(sizeof(SignWord) * rowX * signWords(rowZ));
+    }
     rows[0] = &row_space[0];
-    rows[0]->points =
-        (Vector *)malloc(sizeof(Vector) * _xsize * _zsize);
-    rows[0]->densities =
-        (float *)malloc(sizeof(float) * _xsize * _zsize);
-
     rows[1] = &row_space[1];
-    rows[1]->points =
-        (Vector *)malloc(sizeof(Vector) * _xsize * _zsize);
-    rows[1]->densities =
-        (float *)malloc(sizeof(float) * _xsize * _zsize);
+
+    bool cancelled = false;
+    for (_tileX = 0; _tileX < gridX - 1 && ! cancelled; _tileX += tileX) {
+        for (_tileZ = 0; _tileZ < gridZ - 1 && ! cancelled; _tileZ += tileZ) {
+            _xsize = THREED_MIN(tileX + 1, gridX - _tileX);
+            _zsize = THREED_MIN(tileZ + 1, gridZ - _tileZ);
+            if (pipelined)
+                cancelled = sweepTilePipelined(vGrid, ysize,
+                                               &row_space[0], numRows);
+            else
+                cancelled = sweepTile(vGrid, ysize, rows);
+        }
+    }
+
+    if (cancelled) {
+        delete _mesh;
+        _mesh = 0;
+    }
+
+    for (i = 0; i < numRows; ++i) {
+        free(row_space[i].densities);
+        free(row_space[i].signs);
+    }
+
+    _cache = cache;
+    _cacheNormals = cacheNormals;
+
+    return _mesh;
+}
+
+//----------------------------------------------------------------------------
+
+bool IsoMesher_MC::sweepTile(
+    const Vector &vGrid, int ysize, Row *rows[2])
+{
+    // precalculate first row (y slice) of the tile
+
+    Vector vRow = vGrid;
+    Vector deltaRow = Vector(0, _voxelSize.y(), 0);
 
     computeRow(vRow, rows[0]);
 
     // go through the remaining rows, calculating each before
     // processing it and its preceeding row
 
-    for (y = 1; y < ysize - 1; ++y) {
-        int percent = (int)(y * 100.0f / (ysize - 1));
-
+    for (int y = 1; y < ysize - 1; ++y) {
         vRow += deltaRow;
         if (computeRow(vRow, rows[1]))
-            break;
+            return true;
 
         if (marchCubes(rows))
-            break;
+            return true;
 
         Row *rows_0_save = rows[0];
         rows[0] = rows[1];
         rows[1] = rows_0_save;
     }
 
-    if (y < ysize - 1) {        // cancelled?
-        delete _mesh;
-        _mesh = 0;
+    return false;
+}
+
+//----------------------------------------------------------------------------
+
+bool IsoMesher_MC::sweepTilePipelined(
+    const Vector &vGrid, int ysize, Row *ring, int numRows)
+{
+    // row y goes into ring slot y % numRows, once the row that held
+    // the slot before has been marched as the lower row of a pair.
+    // The rows are computed by the pool in any order, and marched
+    // here in order
+
+    int numY = ysize - 1;
+    Vector vRow = vGrid;
+    Vector deltaRow = Vector(0, _voxelSize.y(), 0);
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    pthread_mutex_init(&lock, 0);
+    pthread_cond_init(&done, 0);
+
+    std::vector<RowTask> tasks(numRows);
+    int next = 0;                       // next row to hand out
+    bool cancelled = false;
+
+    for (int y = 0; y < numY && ! cancelled; ++y) {
+
+        while (next < numY && next - numRows < y - 1) {
+            RowTask &task = tasks[next % numRows];
+            task.mesher = this;
+            task.row = &ring[next % numRows];
+            task.vRow = vRow;
+            task.ready = false;
+            task.lock = &lock;
+            task.done = &done;
+            _pool->submit(&task);
+            vRow += deltaRow;
+            ++next;
+        }
+
+        // rows dealt to this thread's deque wait for it, so it runs
+        // queued rows until row y is ready.  Once none is queued,
+        // row y is running on another thread
+
+        RowTask &task = tasks[y % numRows];
+        while (1) {
+            pthread_mutex_lock(&lock);
+            bool ready = task.ready;
+            pthread_mutex_unlock(&lock);
+            if (ready || ! _pool->runOne())
+                break;
+        }
+        pthread_mutex_lock(&lock);
+        while (! task.ready)
+            pthread_cond_wait(&done, &lock);
+        pthread_mutex_unlock(&lock);
+
+        if (y > 0) {
+            Row *rows[2] = { &ring[(y - 1) % numRows], &ring[y % numRows] };
+            cancelled = marchCubes(rows);
+        }
     }
 
-    free(rows[0]->points);
-    free(rows[0]->densities);
-    free(rows[1]->points);
-    free(rows[1]->densities);
+    // rows still being computed after a cancel are dropped
+    _pool->wait();
 
-    return _mesh;
+    pthread_cond_destroy(&done);
+    pthread_mutex_destroy(&lock);
+
+    return cancelled;
 }
 
 //----------------------------------------------------------------------------
@@ -99,22 +237,20 @@ Mesh *IsoMesher_MC::createMesh()
 bool IsoMesher_MC::computeRow(
     const Vector &vRow, Row *row)
 {
+    row->v = vRow;
+
     float x0 = vRow.x();
     float y0 = vRow.y();
     float z0 = vRow.z();
-    float dz = _voxelSize.z();
+    float dx = _voxelSize.x();
 
     for (int x = 0; x < _xsize; ++x) {
         float *densities = &row->densities[x * _zsize];
-        _iso->fDensity(x0, y0, z0, dz, _zsize, densities);
-
-        Vector *points = &row->points[x * _zsize];
-        for (int z = 0; z < _zsize; ++z) {
+        computeLine(x0 + (_tileX + x) * dx, y0, z0, _tileZ, _zsize,
+                    densities);
+        for (int z = 0; z < _zsize; ++z)
             densities[z] += 1e-4f;
-            points[z] = Vector(x0, y0, z0 + z * dz);
-        }
-
-        x0 += _voxelSize.x();
+        computeSigns(densities, _zsize, &row->signs[x * signWords(_zsize)]);
     }
 
     return false;
@@ -125,54 +261,113 @@ bool IsoMesher_MC::computeRow(
 bool IsoMesher_MC::marchCubes(Row *rows[2])
 {
     int xsize_1 = _xsize - 1;
-    int zsize_1 = _zsize - 1;
+    float dx = _voxelSize.x();
+    float dz = _voxelSize.z();
+    int words = signWords(_zsize);
+    std::vector<SignWord> mixed(words);
 
     for (int x = 0; x < xsize_1; ++x) {
-        for (int z = 0; z < zsize_1; ++z) {
+
+        // the lines of the four edges along z, in corner order
+
+        const SignWord *lines[4] = {
+            &rows[0]->signs[x * words],
+            &rows[0]->signs[(x + 1) * words],
+            &rows[1]->signs[(x + 1) * words],
+            &rows[1]->signs[x * words]
+        };
+        findMixedCubes(lines, _zsize, &mixed[0]);
+
+        for (int w = 0; w < words; ++w) {
+            for (SignWord bits = mixed[w]; bits != 0; bits &= bits - 1) {
+                int z = w * SIGN_BITS + lowestBit(bits);
 
 #define DENSITY_VAL(xi,yi,zi) rows[yi]->densities[(x + xi) * _zsize + (z + zi)]
-#define POINT_PTR(xi,yi,zi) &rows[yi]->points[(x + xi) * _zsize + (z + zi)]
+#define POINT_VAL(xi,yi,zi) Vector(rows[yi]->v.x() + (_tileX + x + xi) * dx,  \
+                                   rows[yi]->v.y(),  \
+                                   rows[yi]->v.z() + (_tileZ + z + zi) * dz)
 #define CORNER(n,xi,yi,zi) \
     corners[n].density = DENSITY_VAL(xi, yi, zi);  \
-    corners[n].v = POINT_PTR(xi, yi, zi);
-
-            Point corners[8];
-            CORNER(0,  0,0,0);
-            CORNER(1,  1,0,0);
-            CORNER(2,  1,1,0);
-            CORNER(3,  0,1,0);
-            CORNER(4,  0,0,1);
-            CORNER(5,  1,0,1);
-            CORNER(6,  1,1,1);
-            CORNER(7,  0,1,1);
+    corners_v[n] = POINT_VAL(xi, yi, zi);  \
+    corners[n].v = &corners_v[n];  \
+    corners[n].leaf = 0;
+
+                Point corners[8];
+                Vector corners_v[8];
+                CORNER(0,  0,0,0);
+                CORNER(1,  1,0,0);
+                CORNER(2,  1,1,0);
+                CORNER(3,  0,1,0);
+                CORNER(4,  0,0,1);
+                CORNER(5,  1,0,1);
+                CORNER(6,  1,1,1);
+                CORNER(7,  0,1,1);
 
 #undef CORNER
-#undef POINT_PTR
+#undef POINT_VAL
 #undef DENSITY_VAL
 
-            int index = 0;
-
-#define IF_DENSITY(i) if (! fsign(corners[i].density)) index |= (1 << i)
+                generateFaces(corners, cubeIndex(lines, z));
+            }
+        }
+    }
 
-            IF_DENSITY(0);
-            IF_DENSITY(1);
-            IF_DENSITY(2);
-            IF_DENSITY(3);
-            IF_DENSITY(4);
-            IF_DENSITY(5);
-            IF_DENSITY(6);
-            IF_DENSITY(7);
+    return false;
+}
 
-#undef IF_DENSITY
+//----------------------------------------------------------------------------
 
-            if (_edgeTable[index] == 0)
-                continue;
+void IsoMesher_MC::marchBlock(
+    const Vector &gridOrigin, const Vector &voxelSize,
+    int x0, int y0, int z0, int nx, int ny, int nz,
+    const float *densities)
+{
+    // grid offsets of the eight corners, in the order used by marchCubes
+    static int offsets[8][3] = {
+        { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+        { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 }
+    };
 
-            generateFaces(corners, index);
+    int ystride = nz + 1;
+    int xstride = (ny + 1) * ystride;
+
+    for (int x = 0; x < nx; ++x) {
+        for (int y = 0; y < ny; ++y) {
+            for (int z = 0; z < nz; ++z) {
+
+                const float *d = &densities[x * xstride + y * ystride + z];
+
+                Point corners[8];
+                int index = 0;
+                int n;
+
+                for (n = 0; n < 8; ++n) {
+                    corners[n].density = d[offsets[n][0] * xstride +
+                                           offsets[n][1] * ystride +
+                                           offsets[n][2]];
+                    if (! fsign(corners[n].density))
+                        index |= (1 << n);
+                }
+
+                if (_edgeTable[index] == 0)
+                    continue;
+
+                // grid positions are always computed from the grid
+                // origin, so that adjacent blocks agree on them
+                Vector v[8];
+                for (n = 0; n < 8; ++n) {
+                    v[n] = Vector(
+                        gridOrigin.x() + (x0 + x + offsets[n][0]) * voxelSize.x(),
+                        gridOrigin.y() + (y0 + y + offsets[n][1]) * voxelSize.y(),
+                        gridOrigin.z() + (z0 + z + offsets[n][2]) * voxelSize.z());
+                    corners[n].v = &v[n];
+                    corners[n].leaf = 0;
+                }
+
+                generateFaces(corners, index);
+            }
         }
     }
-
-    return false;
 }
 
 //----------------------------------------------------------------------------
@@ -187,6 +382,11 @@ void IsoMesher_MC::generateFaces(Point corners[8], int index)
     Point points[12];
     Vector points_v[12];
     MeshPoint *meshPoints[12];
+    MaterialPalette::Id materials[12];
+    Vector edgePoints[12];
+    float edgeDensities[12];
+    const Isosurface *edgeLeaves[12];
+    int numEdges = 0;
     int i;
 
     for (i = 0; i < 12; ++i) {
@@ -214,7 +414,24 @@ void IsoMesher_MC::generateFaces(Point corners[8], int index)
         }
 
         meshPoints[i] = _mesh->addPoint(*points[i].v);
-        _iso->fNormal(points[i].v, &meshPoints[i]->normal);
+        computeNormal(points[i].v, &meshPoints[i]->normal, points[i].leaf);
+        edgePoints[numEdges] = *points[i].v;
+        edgeDensities[numEdges] = points[i].density;
+        edgeLeaves[numEdges] = points[i].leaf;
+        ++numEdges;
+    }
+
+    // the materials of all the intersections at once, then spread
+    // back over the edges
+
+    MaterialPalette::Id edgeMaterials[12];
+    computeMaterials(edgePoints, edgeDensities, edgeLeaves, numEdges,
+                     edgeMaterials);
+    for (i = 0, numEdges = 0; i < 12; ++i) {
+        if (_edgeTable[index] & (1 << i)) {
+            materials[i] = edgeMaterials[numEdges++];
+            meshPoints[i]->material = materials[i];
+        }
     }
 
     //
@@ -233,30 +450,24 @@ void IsoMesher_MC::generateFaces(Point corners[8], int index)
         if (meshp0 == meshp1 || meshp1 == meshp2 || meshp2 == meshp0)
             continue;
 
-        const Point &p1 = points[i0];
-        const Point &p2 = points[i1];
-        const Point &p3 = points[i2];
-
-        Isosurface::Material mat1 = _iso->fMaterial(p1.v, p1.density);
-        Isosurface::Material mat2 = _iso->fMaterial(p2.v, p1.density);
-        Isosurface::Material mat3 = _iso->fMaterial(p3.v, p1.density);
-
-        Isosurface::Material mat;
-        mat.color = (mat1.color + mat2.color + mat3.color) / 3.0f;
-        mat.ambient = (mat1.ambient + mat2.ambient + mat3.ambient) / 3.0f;
-        mat.diffuse = (mat1.diffuse + mat2.diffuse + mat3.diffuse) / 3.0f;
-        mat.specular = (mat1.specular + mat2.specular + mat3.specular) / 3.0f;
-        mat.brilliance = (mat1.brilliance + mat2.brilliance + mat3.brilliance) / 3.0f;
+        MaterialPalette::Id material = _mesh->palette().blend(
+            materials[i0], materials[i1], materials[i2]);
 
         MeshFace *face = new MeshFace(
-            &meshp2->point, &meshp1->point, &meshp0->point,
-            mat.color, mat.ambient, mat.diffuse, mat.specular, mat.brilliance);
-        _mesh->addFace(face);
+            &meshp2->point, &meshp1->point, &meshp0->point, material);
+        addFace(face);
     }
 }
 
 //----------------------------------------------------------------------------
 
+void IsoMesher_MC::addFace(MeshFace *face)
+{
+    _mesh->addFace(face);
+}
+
+//----------------------------------------------------------------------------
+
 int IsoMesher_MC::_edgeTable[256] = {
     0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
     0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
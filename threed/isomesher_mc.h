@@ -12,6 +12,12 @@ namespace ThreeD {
 
 /**
  * IsoMesher
+ *
+ * With a thread pool of more than one thread (see setThreadPool()),
+ * the sweep is pipelined:  the threads of the pool compute the rows of
+ * densities ahead, into a ring of a few rows, while the calling thread
+ * marches the cubes between the rows that are done, and builds the
+ * mesh.  The mesh is the same as without the pool.
  */
 class IsoMesher_MC : public IsoMesher
 {
@@ -29,28 +35,61 @@ protected:
     typedef Mesh::MeshPoint MeshPoint;
 
     struct Row {
-        Vector *points;
+        Vector v;                       // position of grid point (0,y,0)
         float *densities;
+        SignWord *signs;                // bit plane of each line
     };
 
-    /** Compute a row (y-slice) of grid points
+    /** Sweep the tile at _tileX, _tileZ along y, through @p ysize
+     *  rows of grid points.  @return true if cancelled
+     */
+    bool sweepTile(const Vector &vGrid, int ysize, Row *rows[2]);
+
+    struct RowTask;
+    friend struct RowTask;
+
+    /** Sweep the tile as sweepTile(), with the rows computed on the
+     *  threads of the pool, into the @p numRows rows of @p ring
+     */
+    bool sweepTilePipelined(const Vector &vGrid, int ysize,
+                            Row *ring, int numRows);
+
+    /** Compute a row (y-slice) of the grid points of the tile
      */
     bool computeRow(const Vector &vRow, Row *row);
 
-    /** Perform marching cubes on two adjacent voxel slices
+    /** Perform marching cubes on two adjacent voxel slices.  Only
+     *  the cubes that the bit planes of the rows show to be mixed are
+     *  visited.
      */
     bool marchCubes(Row *rows[2]);
 
+    /** March the cubes of a block of nx * ny * nz voxels.  The block
+     *  holds (nx + 1) * (ny + 1) * (nz + 1) densities, ordered by x,
+     *  then y, then z.  The first density is that of grid point
+     *  (x0,y0,z0), and grid point (i,j,k) lies at gridOrigin plus
+     *  (i,j,k) times @p voxelSize.
+     */
+    void marchBlock(const Vector &gridOrigin, const Vector &voxelSize,
+                    int x0, int y0, int z0, int nx, int ny, int nz,
+                    const float *densities);
+
     /** Generate triangles within a voxel
      */
     void generateFaces(Point corners[8], int index);
 
+    /** Add a generated face to the mesh
+     */
+    virtual void addFace(MeshFace *face);
+
     /*
      * data
      */
 
-    int _xsize;
+    int _xsize;                         // grid points in a tile row
     int _zsize;
+    int _tileX;                         // grid index of the tile
+    int _tileZ;
 
     static int _edgeTable[256];
     static int _triTable[256][16];
@@ -3,10 +3,18 @@
 //----------------------------------------------------------------------------
 
 #include <threed/isosurface.h>
+#include <threed/misc.h>
 
 using namespace ThreeD;
 
 
+//----------------------------------------------------------------------------
+
+Isosurface::Isosurface()
+{
+    _prepared = false;
+}
+
 //----------------------------------------------------------------------------
 
 Isosurface::~Isosurface()
@@ -18,6 +26,7 @@ Isosurface::~Isosurface()
 void Isosurface::setTransform(const Transform &t)
 {
     _localTrans = t;
+    _prepared = false;
 }
 
 //----------------------------------------------------------------------------
@@ -25,19 +34,116 @@ void Isosurface::setTransform(const Transform &t)
 void Isosurface::addBoundingBox(const BoundingBox &bbox)
 {
     _bbox.merge(bbox);
+    _prepared = false;
+}
+
+//----------------------------------------------------------------------------
+
+void Isosurface::prepare(const Transform &combinedTrans)
+{
+    Transform globalTrans(_localTrans);
+    globalTrans *= combinedTrans;
+
+    if (! setGlobalTrans(globalTrans))
+        return;
+
+    _globalBBox = _bbox;
+    _globalBBox.transform(_globalTrans);
 }
 
 //----------------------------------------------------------------------------
 
-BoundingBox Isosurface::getBoundingBox(
-    const Transform &combinedTrans)
+bool Isosurface::setGlobalTrans(const Transform &globalTrans)
 {
-    _globalTrans = _localTrans;
-    _globalTrans *= combinedTrans;
-    _globalTransInv = _globalTrans;
+    if (_prepared && globalTrans == _globalTrans)
+        return false;
+
+    _globalTrans = globalTrans;
+    _globalTransInv = globalTrans;
     _globalTransInv.invert();
+    _prepared = true;
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void Isosurface::fDensity(
+    float x0, float y0, float z0,
+    float dz, int num_points, float *densities) const
+{
+    fDensityRun(x0, y0, z0, dz, 0, num_points, densities);
+}
+
+//----------------------------------------------------------------------------
+
+void Isosurface::fDensityRun(
+    float x0, float y0, float z0, float dz,
+    int first, int num_points, float *densities) const
+{
+    float xs[RUN_CHUNK], ys[RUN_CHUNK], zs[RUN_CHUNK];
 
-    BoundingBox bbox(_bbox);
-    bbox.transform(_globalTrans);
-    return bbox;
+    // chunk c of the run starts at z0 + c * RUN_CHUNK * dz
+
+    int end = first + num_points;
+    int i = first;
+    while (i < end) {
+        int start = i - i % RUN_CHUNK;
+        int n = THREED_MIN(end, start + RUN_CHUNK) - i;
+        _globalTransInv.transformRun(
+            x0, y0, z0 + start * dz, dz, i - start, n, xs, ys, zs);
+        fDensityPoints(xs, ys, zs, n, &densities[i - first]);
+        i += n;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void Isosurface::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    for (int i = 0; i < num_points; ++i) {
+        float x, y, z;
+        _globalTrans.transform(xs[i], ys[i], zs[i], &x, &y, &z);
+        fDensity(x, y, z, 0, 1, &densities[i]);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+const Isosurface *Isosurface::fDensityLeaf(
+    float x, float y, float z, float *density) const
+{
+    fDensity(x, y, z, 0, 1, density);
+    return this;
+}
+
+//----------------------------------------------------------------------------
+
+void Isosurface::fLeaves(const Vector *points, int num_points,
+                         float *densities, const Isosurface **leaves) const
+{
+    float xs[RUN_CHUNK], ys[RUN_CHUNK], zs[RUN_CHUNK];
+
+    for (int i = 0; i < num_points; i += RUN_CHUNK) {
+        int n = THREED_MIN(num_points - i, RUN_CHUNK);
+        for (int j = 0; j < n; ++j) {
+            xs[j] = points[i + j].x();
+            ys[j] = points[i + j].y();
+            zs[j] = points[i + j].z();
+        }
+        _globalTransInv.transformPoints(xs, ys, zs, n, xs, ys, zs);
+        fLeavesPoints(xs, ys, zs, n, &densities[i], &leaves[i]);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void Isosurface::fLeavesPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities, const Isosurface **leaves) const
+{
+    fDensityPoints(xs, ys, zs, num_points, densities);
+    for (int i = 0; i < num_points; ++i)
+        leaves[i] = this;
 }
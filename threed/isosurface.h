@@ -20,6 +20,18 @@ class Mesh;
 
 /**
  * Isosurface
+ *
+ * An isosurface is evaluated in two phases.  prepare() composes the
+ * global transforms and bounding boxes of the isosurface and its
+ * descendants.  After that, the evaluation methods (fDensity() and
+ * friends) are const, and keep any scratch storage on the stack of
+ * the caller, so any number of threads and meshers may evaluate the
+ * same isosurface at once.
+ *
+ * prepare() writes nothing if neither the transforms nor the bounding
+ * boxes changed since the previous call, so meshers may prepare an
+ * isosurface that other threads are evaluating, as long as nobody
+ * calls setTransform() or addBoundingBox() in the meantime.
  */
 class Isosurface
 {
@@ -33,6 +45,14 @@ public:
         float specular;
     };
 
+    enum {
+        RUN_CHUNK = 64                  // points transformed at a time
+    };
+
+    /** constructor
+     */
+    Isosurface();
+
     /** destructor
      */
     virtual ~Isosurface();
@@ -41,36 +61,114 @@ public:
      */
     void setTransform(const Transform &t);
 
+    /** @return the transform set by setTransform()
+     */
+    const Transform &transform() const { return _localTrans; }
+
     /**
      */
     void addBoundingBox(const BoundingBox &bbox);
 
-    /**
-     *
+    /** Prepare the isosurface for evaluation, given the transform
+     *  combined from all its ancestors
      */
-    virtual BoundingBox getBoundingBox(
-        const Transform &combinedTrans);
+    virtual void prepare(const Transform &combinedTrans);
 
-    /**
-     *
+    /** Prepare the isosurface for evaluation.
+     *  @return the bounding box, in the coordinates of the mesher
+     */
+    BoundingBox getBoundingBox(const Transform &combinedTrans)
+    {
+        prepare(combinedTrans);
+        return _globalBBox;
+    }
+
+    /** @return the bounding box computed by the most recent call
+     *  to prepare(), in the coordinates of the mesher
+     */
+    const BoundingBox &globalBoundingBox() const { return _globalBBox; }
+
+    /** Compute the densities of a run of points along the z axis,
+     *  in the coordinates of the mesher.  The default implementation
+     *  transforms the run into the coordinates of the isosurface and
+     *  calls fDensityPoints().  Runs are evaluated in chunks of
+     *  RUN_CHUNK points, chunk i starting at z0 + i * dz, so a run
+     *  split into runs at those points gets the same densities.
      */
     virtual void fDensity(
         float x0, float y0, float z0,
-        float dz, int num_points, float *densities) = 0;
+        float dz, int num_points, float *densities) const;
+
+    /** Compute the densities of points @p first to
+     *  first + num_points - 1 of the run that fDensity() evaluates
+     *  from (x0,y0,z0), the same as a run of more than one point
+     *  through them gets, without evaluating the points before
+     *  @p first.  The default implementation transforms the points as
+     *  the default fDensity() does, and calls fDensityPoints().
+     */
+    virtual void fDensityRun(
+        float x0, float y0, float z0, float dz,
+        int first, int num_points, float *densities) const;
+
+    /** Compute the densities of points given in the coordinates of
+     *  the isosurface, ie. already transformed by the inverse of the
+     *  global transform.  The default implementation transforms each
+     *  point back and calls fDensity(), so a subclass must implement
+     *  at least one of the two.
+     */
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+    /** Compute the density at one point, in the coordinates of the
+     *  mesher, as fDensity() does, along with the leaf isosurface that
+     *  wins there (see fLeaves()).  The default implementation calls
+     *  fDensity() and is its own leaf.
+     *
+     *  @return the winning leaf
+     */
+    virtual const Isosurface *fDensityLeaf(
+        float x, float y, float z, float *density) const;
+
+    /** Compute the densities of @p num_points points, in the
+     *  coordinates of the mesher, and for each point the leaf
+     *  isosurface that wins there:  the one whose surface, normal
+     *  and material show at the point.  An isosurface that does not
+     *  combine others is its own leaf.  The material at a point is
+     *  then leaves[i]->fMaterial(), without evaluating the whole tree
+     *  again.
+     */
+    void fLeaves(const Vector *points, int num_points,
+                 float *densities, const Isosurface **leaves) const;
+
+    /** Compute the densities and the winning leaves of points given
+     *  in the coordinates of the isosurface.  The default
+     *  implementation calls fDensityPoints(), and is its own leaf.
+     */
+    virtual void fLeavesPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities, const Isosurface **leaves) const;
 
     /**
      *
      */
     virtual void fNormal(
-        const Vector *point, Vector *normal) = 0;
+        const Vector *point, Vector *normal) const = 0;
 
     /**
      *
      */
     virtual const Material &fMaterial(
-        const Vector *point, float density) = 0;
+        const Vector *point, float density) const = 0;
 
 protected:
+
+    /** Set the global transform and its inverse.
+     *  @return false, having written nothing, if the isosurface was
+     *  already prepared with the same global transform
+     */
+    bool setGlobalTrans(const Transform &globalTrans);
+
     /*
      * data
      */
@@ -79,6 +177,8 @@ protected:
     Transform _globalTrans;
     Transform _globalTransInv;
     BoundingBox _bbox;
+    BoundingBox _globalBBox;
+    bool _prepared;
 };
 
 
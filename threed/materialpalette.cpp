@@ -0,0 +1,247 @@
+//----------------------------------------------------------------------------
+// ThreeD Material Palette
+//----------------------------------------------------------------------------
+
+#include <threed/materialpalette.h>
+#include <threed/misc.h>
+#include <algorithm>
+#include <math.h>
+
+using namespace ThreeD;
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+#define GRID_CELLS 16                   // cells of nearest() per color unit
+
+inline int compareColors(const Color &a, const Color &b)
+{
+    if (a.red() != b.red())
+        return (a.red() < b.red() ? -1 : 1);
+    if (a.green() != b.green())
+        return (a.green() < b.green() ? -1 : 1);
+    if (a.blue() != b.blue())
+        return (a.blue() < b.blue() ? -1 : 1);
+    return 0;
+}
+
+inline float colorDistance2(const Color &a, const Color &b)
+{
+    float r = a.red() - b.red();
+    float g = a.green() - b.green();
+    float bl = a.blue() - b.blue();
+    return (r * r + g * g + bl * bl);
+}
+
+// squared distance between two materials:  their colors, and their
+// shininess, scaled to the range of a color
+
+float distance2(const MaterialPalette::Material &a,
+                const MaterialPalette::Material &b)
+{
+    float s = (a.shininess - b.shininess) * (1.0f / 128.0f);
+    return (colorDistance2(a.c, b.c) + colorDistance2(a.ambient, b.ambient) +
+            colorDistance2(a.diffuse, b.diffuse) +
+            colorDistance2(a.specular, b.specular) + s * s);
+}
+
+// colors outside 0..1 go to the cells at the edges, which keeps the
+// cells between two colors no more than the distance between them
+
+inline int gridCell(float f)
+{
+    int cell = (int)floor(f * GRID_CELLS);
+    return THREED_MAX(0, THREED_MIN(cell, GRID_CELLS - 1));
+}
+
+inline int gridIndex(int x, int y, int z)
+{
+    return ((x * GRID_CELLS + y) * GRID_CELLS + z);
+}
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------
+
+bool MaterialPalette::Material::operator<(const Material &other) const
+{
+    int k = compareColors(c, other.c);
+    if (k == 0)
+        k = compareColors(ambient, other.ambient);
+    if (k == 0)
+        k = compareColors(diffuse, other.diffuse);
+    if (k == 0)
+        k = compareColors(specular, other.specular);
+    if (k != 0)
+        return (k < 0);
+    return (shininess < other.shininess);
+}
+
+//----------------------------------------------------------------------------
+
+MaterialPalette::MaterialPalette()
+{
+    _last = 0;
+}
+
+//----------------------------------------------------------------------------
+
+void MaterialPalette::clear()
+{
+    _materials.clear();
+    _index.clear();
+    _blends.clear();
+    _grid.clear();
+    _misses.clear();
+    _last = 0;
+}
+
+//----------------------------------------------------------------------------
+
+bool MaterialPalette::add(const Material &mat, Id *id)
+{
+    // meshers ask for the same material many times in a row
+
+    if (! _materials.empty() && _materials[_last] == mat) {
+        *id = _last;
+        return true;
+    }
+
+    MaterialsMap::const_iterator it = _index.find(mat);
+    if (it != _index.end())
+        _last = (*it).second;
+    else if (_materials.size() < MAX_MATERIALS) {
+        _last = (Id)_materials.size();
+        _materials.push_back(mat);
+        _index[mat] = _last;
+        _grid.clear();                  // made again by nearest()
+    } else {
+        // a mesher asks for the material at a corner once per cube
+        it = _misses.find(mat);
+        if (it != _misses.end())
+            *id = (*it).second;
+        else {
+            if (_misses.size() >= MAX_MATERIALS)
+                _misses.clear();
+            *id = _misses[mat] = nearest(mat);
+        }
+        return false;
+    }
+    *id = _last;
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+bool MaterialPalette::add(const Isosurface::Material &mat, Id *id)
+{
+    Material m;
+    m.c = mat.color;
+    m.ambient = mat.ambient;
+    m.diffuse = mat.diffuse;
+    m.specular = mat.specular;
+    m.shininess = mat.brilliance;
+    return add(m, id);
+}
+
+//----------------------------------------------------------------------------
+
+MaterialPalette::Id MaterialPalette::nearest(const Material &mat)
+{
+    // the materials are binned by their main color.  Rings of cells
+    // around the color of @p mat are searched, until a ring is farther
+    // in color than the nearest material found
+
+    if (_grid.size() == 0) {
+        _grid.resize(GRID_CELLS * GRID_CELLS * GRID_CELLS);
+        for (int i = 0; i < (int)_materials.size(); ++i) {
+            const Color &c = _materials[i].c;
+            _grid[gridIndex(gridCell(c.red()), gridCell(c.green()),
+                            gridCell(c.blue()))].push_back((Id)i);
+        }
+    }
+
+    int cx = gridCell(mat.c.red());
+    int cy = gridCell(mat.c.green());
+    int cz = gridCell(mat.c.blue());
+    float best = -1.0f;
+    Id bestId = 0;
+    for (int r = 0; r < GRID_CELLS; ++r) {
+        float gap = (float)(r - 1) / GRID_CELLS;
+        if (best >= 0.0f && gap > 0.0f && gap * gap >= best)
+            break;
+        int last = GRID_CELLS - 1;
+        int x0 = THREED_MAX(cx - r, 0), x1 = THREED_MIN(cx + r, last);
+        int y0 = THREED_MAX(cy - r, 0), y1 = THREED_MIN(cy + r, last);
+        int z0 = THREED_MAX(cz - r, 0), z1 = THREED_MIN(cz + r, last);
+        for (int x = x0; x <= x1; ++x) {
+            for (int y = y0; y <= y1; ++y) {
+                // only the cells on the shell of the ring
+                bool shell = (x == cx - r || x == cx + r ||
+                              y == cy - r || y == cy + r);
+                for (int z = z0; z <= z1; ++z) {
+                    if (! shell && z != cz - r && z != cz + r)
+                        continue;
+                    const std::vector<Id> &ids = _grid[gridIndex(x, y, z)];
+                    for (unsigned int k = 0; k < ids.size(); ++k) {
+                        float d = distance2(mat, _materials[ids[k]]);
+                        if (best < 0.0f || d < best) {
+                            best = d;
+                            bestId = ids[k];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return bestId;
+}
+
+//----------------------------------------------------------------------------
+
+MaterialPalette::Id MaterialPalette::blend(const Id *ids, int count)
+{
+    int i;
+    for (i = 1; i < count; ++i)
+        if (ids[i] != ids[0])
+            break;
+    if (i >= count)
+        return ids[0];
+
+    // the average does not depend on the order of the materials,
+    // nor on the order in which they got their ids, since they are
+    // summed in the order of their values
+
+    std::vector<Id> key(ids, ids + count);
+    std::sort(key.begin(), key.end());
+    BlendsMap::const_iterator it = _blends.find(key);
+    if (it != _blends.end())
+        return (*it).second;
+
+    std::vector<Material> mats(count);
+    for (i = 0; i < count; ++i)
+        mats[i] = _materials[key[i]];
+    std::sort(mats.begin(), mats.end());
+
+    Material sum = mats[0];
+    for (i = 1; i < count; ++i) {
+        const Material &m = mats[i];
+        sum.c += m.c;
+        sum.ambient += m.ambient;
+        sum.diffuse += m.diffuse;
+        sum.specular += m.specular;
+        sum.shininess += m.shininess;
+    }
+
+    Material avg;
+    avg.c = sum.c / (float)count;
+    avg.ambient = sum.ambient / (float)count;
+    avg.diffuse = sum.diffuse / (float)count;
+    avg.specular = sum.specular / (float)count;
+    avg.shininess = sum.shininess / (float)count;
+
+    Id id = add(avg);
+    _blends[key] = id;
+    return id;
+}
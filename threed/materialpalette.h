@@ -0,0 +1,148 @@
+//----------------------------------------------------------------------------
+// ThreeD Material Palette
+//----------------------------------------------------------------------------
+
+#ifndef _THREED_MATERIALPALETTE_H
+#define _THREED_MATERIALPALETTE_H
+
+#include <threed/isosurface.h>
+#include <threed/color.h>
+#include <map>
+#include <vector>
+
+namespace ThreeD {
+
+
+/**
+ * MaterialPalette, the materials of the faces of a mesh
+ *
+ * Each distinct material is kept once, and faces refer to it by a
+ * 16-bit id.  Materials come from the isosurface, through add(), or
+ * are blends of materials already in the palette, through blend();
+ * blends are remembered by the ids they mix, so mixing the same ids
+ * again costs a lookup and no arithmetic.
+ *
+ * A palette holds at most MAX_MATERIALS materials.  Once it is full,
+ * a material that is not in the palette is not added:  add() says so,
+ * and gives the nearest material in the palette in its place, so a
+ * color that varies over a surface still shows, in coarser steps.
+ */
+class MaterialPalette
+{
+public:
+    typedef unsigned short Id;
+
+    enum {
+        MAX_MATERIALS = 65536
+    };
+
+    /**
+     * Material, the way it is drawn
+     */
+    struct Material {
+        Color c;
+        Color ambient;
+        Color diffuse;
+        Color specular;
+        float shininess;
+
+        bool operator==(const Material &other) const
+        {
+            return (c == other.c && ambient == other.ambient &&
+                    diffuse == other.diffuse &&
+                    specular == other.specular &&
+                    shininess == other.shininess);
+        }
+
+        bool operator<(const Material &other) const;
+    };
+
+    /** Construct an empty palette
+     */
+    MaterialPalette();
+
+    /** Drop all materials
+     */
+    void clear();
+
+    /** Find @p mat in the palette, adding it if it is not there, and
+     *  put its id in @p id
+     *
+     *  @return false if the palette is full and @p mat is not in it;
+     *  @p id is then that of the nearest material
+     */
+    bool add(const Material &mat, Id *id);
+
+    /** @return the id of @p mat, adding it if it is not in the
+     *  palette, or of the nearest material if the palette is full
+     */
+    Id add(const Material &mat)
+    {
+        Id id;
+        add(mat, &id);
+        return id;
+    }
+
+    /** Find the isosurface material @p mat in the palette, as above
+     */
+    bool add(const Isosurface::Material &mat, Id *id);
+
+    /** @return the id of the isosurface material @p mat, as above
+     */
+    Id add(const Isosurface::Material &mat)
+    {
+        Id id;
+        add(mat, &id);
+        return id;
+    }
+
+    /** @return the id of the average of the @p count materials
+     *  @p ids, adding it if it is not in the palette
+     */
+    Id blend(const Id *ids, int count);
+
+    /** @return the id of the average of three materials
+     */
+    Id blend(Id id0, Id id1, Id id2)
+    {
+        if (id0 == id1 && id1 == id2)
+            return id0;
+        Id ids[3] = { id0, id1, id2 };
+        return blend(ids, 3);
+    }
+
+    /** @return the material of @p id */
+    const Material &get(Id id) const { return _materials[id]; }
+
+    /** @return the number of materials */
+    int size() const { return (int)_materials.size(); }
+
+    /** @return true if the palette holds MAX_MATERIALS materials */
+    bool full() const { return (_materials.size() >= MAX_MATERIALS); }
+
+    /** @return the id of the material nearest to @p mat, by the
+     *  distance between their colors; 0 if the palette is empty
+     */
+    Id nearest(const Material &mat);
+
+protected:
+
+    typedef std::map<Material, Id> MaterialsMap;
+    typedef std::map<std::vector<Id>, Id> BlendsMap;
+    typedef std::vector<std::vector<Id> > ColorGrid;
+
+    /*
+     * data
+     */
+
+    std::vector<Material> _materials;
+    MaterialsMap _index;
+    BlendsMap _blends;                  // sorted ids to their average
+    ColorGrid _grid;                    // ids by color, made by nearest()
+    MaterialsMap _misses;               // materials that did not fit
+    Id _last;                           // id of the previous lookup
+};
+
+
+} // namespace ThreeD
+#endif // _THREED_MATERIALPALETTE_H
@@ -359,3 +359,75 @@ void Matrix::transformNormal(
     *yo = (float)(M(1, 0) * xi + M(1, 1) * yi + M(1, 2) * zi);
     *zo = (float)(M(2, 0) * xi + M(2, 1) * yi + M(2, 2) * zi);
 }
+
+//----------------------------------------------------------------------------
+
+void Matrix::transformRun(
+    float x0, float y0, float z0, float dz, int first, int num_points,
+    float *xo, float *yo, float *zo) const
+{
+    int i;
+
+    if (! isAffine()) {
+        for (i = 0; i < num_points; ++i)
+            transform(x0, y0, z0 + (first + i) * dz, &xo[i], &yo[i], &zo[i]);
+        return;
+    }
+
+#define M(row,col) _matrix[row][col]
+
+    double xt = M(0, 0) * x0 + M(1, 0) * y0 + M(2, 0) * z0 + M(3, 0);
+    double yt = M(0, 1) * x0 + M(1, 1) * y0 + M(2, 1) * z0 + M(3, 1);
+    double zt = M(0, 2) * x0 + M(1, 2) * y0 + M(2, 2) * z0 + M(3, 2);
+
+    // consecutive points differ by the z row of the matrix times dz
+
+    double xs = M(2, 0) * dz;
+    double ys = M(2, 1) * dz;
+    double zs = M(2, 2) * dz;
+
+#undef M
+
+    for (i = 0; i < first; ++i) {
+        xt += xs;
+        yt += ys;
+        zt += zs;
+    }
+
+    for (i = 0; i < num_points; ++i) {
+        xo[i] = (float)xt;
+        yo[i] = (float)yt;
+        zo[i] = (float)zt;
+        xt += xs;
+        yt += ys;
+        zt += zs;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void Matrix::transformPoints(
+    const float *xi, const float *yi, const float *zi, int num_points,
+    float *xo, float *yo, float *zo) const
+{
+    int i;
+
+    if (! isAffine()) {
+        for (i = 0; i < num_points; ++i)
+            transform(xi[i], yi[i], zi[i], &xo[i], &yo[i], &zo[i]);
+        return;
+    }
+
+#define M(row,col) _matrix[row][col]
+
+    for (i = 0; i < num_points; ++i) {
+        float x = xi[i];
+        float y = yi[i];
+        float z = zi[i];
+        xo[i] = M(0, 0) * x + M(1, 0) * y + M(2, 0) * z + M(3, 0);
+        yo[i] = M(0, 1) * x + M(1, 1) * y + M(2, 1) * z + M(3, 1);
+        zo[i] = M(0, 2) * x + M(1, 2) * y + M(2, 2) * z + M(3, 2);
+    }
+
+#undef M
+}
@@ -134,6 +134,44 @@ public:
         float xi, float yi, float zi,
         float *xo, float *yo, float *zo) const;
 
+    /** Transforms points @p first to first + num_points - 1 of a
+     *  run starting at (x0,y0,z0), @p dz apart along the z axis, by
+     *  the current matrix.  The results are stored in @p xo, @p yo
+     *  and @p zo.  An affine matrix maps the run onto another run, so
+     *  only the first point is multiplied, and a step is added for
+     *  the rest, the points before @p first included, so a point
+     *  comes out the same whichever @p first it is reached from.
+     */
+    void transformRun(
+        float x0, float y0, float z0, float dz, int first, int num_points,
+        float *xo, float *yo, float *zo) const;
+
+    /** Transforms @p num_points points by the current matrix.
+     *  The output arrays may be the input arrays.
+     */
+    void transformPoints(
+        const float *xi, const float *yi, const float *zi, int num_points,
+        float *xo, float *yo, float *zo) const;
+
+    /** @return true if both matrices hold the same values. */
+    bool operator==(const Matrix &other) const
+    {
+        return (memcmp(_matrix, other._matrix, sizeof(MATRIX)) == 0);
+    }
+
+    /** @return true if the matrix is the identity matrix. */
+    bool isIdentity() const
+    {
+        return (memcmp(_matrix, _identity, sizeof(MATRIX)) == 0);
+    }
+
+    /** @return true if the matrix has no projective part. */
+    bool isAffine() const
+    {
+        return (_matrix[0][3] == 0.0f && _matrix[1][3] == 0.0f &&
+                _matrix[2][3] == 0.0f && _matrix[3][3] == 1.0f);
+    }
+
     /** Transforms (x,y,z) by the current matrix. */
     void transform(float *x, float *y, float *z) const
     {
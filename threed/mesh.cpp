@@ -4,6 +4,7 @@
 
 #include <threed/mesh.h>
 #include <threed/meshface.h>
+#include <threed/mesh_opt.h>
 #include <threed/transform.h>
 
 using namespace ThreeD;
@@ -39,6 +40,7 @@ Mesh::~Mesh()
         }
         itPlanes = _planes.erase(itPlanes);
     }
+    _planesIndex.clear();
 
     // delete points
 
@@ -47,17 +49,27 @@ Mesh::~Mesh()
 
 //----------------------------------------------------------------------------
 
-Mesh::MeshPoint *Mesh::addPoint(const Vector &v)
+unsigned long Mesh::pointKey(const Vector &v)
 {
     // points are held in a sorted map, where the key of
     // a point is its vector distance from (0,0,0) times 10.
     float x = v.x();
     float y = v.y();
     float z = v.z();
-    unsigned long key = (unsigned long)(10.0f * (
+    return (unsigned long)(10.0f * (
         (double)x * (double)x +
         (double)y * (double)y +
         (double)z * (double)z));
+}
+
+//----------------------------------------------------------------------------
+
+Mesh::MeshPoint *Mesh::addPoint(const Vector &v)
+{
+    float x = v.x();
+    float y = v.y();
+    float z = v.z();
+    unsigned long key = pointKey(v);
 
     // look at points in the vicinity of the point we're adding
     // and see if any of them is close enough to the new point
@@ -80,6 +92,7 @@ Mesh::MeshPoint *Mesh::addPoint(const Vector &v)
     // if match not found, create a new point
     MeshPoint mpoint;
     mpoint.point = v;
+    mpoint.material = 0;
     PointsMap::value_type pair(key, mpoint);
     if (it0 != _points.end())
         it = _points.insert(it0, pair);
@@ -96,36 +109,54 @@ Mesh::MeshPlane *Mesh::addPlane(const Plane &plane1)
 {
     Plane planeToAdd = plane1.normalized();
 
-    PlanesList::iterator itPlanes = _planes.begin();
-    if (itPlanes != _planes.end()) {
-        const Plane *plane2 = &(*itPlanes).p;
-        if (fabs(planeToAdd.a() - plane2->a()) < TOLERANCE &&
-            fabs(planeToAdd.b() - plane2->b()) < TOLERANCE &&
-            fabs(planeToAdd.c() - plane2->c()) < TOLERANCE &&
-            fabs(planeToAdd.d() - plane2->d()) < TOLERANCE)
-            return &(*itPlanes);
-        while (1) {
-            ++itPlanes;
-            if (itPlanes == _planes.end())
-                break;
-            plane2 = &(*itPlanes).p;
+    // a matching plane lies within half a cell of the new plane in
+    // each coefficient, so it is either in the same cell or in the
+    // nearer neighbouring cell:  at most 16 cells to look into
+
+    double coeffs[4] = {
+        planeToAdd.a(), planeToAdd.b(), planeToAdd.c(), planeToAdd.d()
+    };
+    PlaneKey key;
+    long side[4];
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        double f = coeffs[i] / (2.0 * TOLERANCE);
+        key.k[i] = (long)floor(f);
+        side[i] = (f - key.k[i] < 0.5) ? -1 : 1;
+    }
+
+    for (int probe = 0; probe < 16; ++probe) {
+        PlaneKey probeKey = key;
+        for (i = 0; i < 4; ++i)
+            if (probe & (1 << i))
+                probeKey.k[i] += side[i];
+
+        PlanesIndex::const_iterator it = _planesIndex.lower_bound(probeKey);
+        PlanesIndex::const_iterator it1 = _planesIndex.upper_bound(probeKey);
+        while (it != it1) {
+            MeshPlane *mplane = (*it).second;
+            const Plane *plane2 = &mplane->p;
             if (fabs(planeToAdd.a() - plane2->a()) < TOLERANCE &&
                 fabs(planeToAdd.b() - plane2->b()) < TOLERANCE &&
                 fabs(planeToAdd.c() - plane2->c()) < TOLERANCE &&
                 fabs(planeToAdd.d() - plane2->d()) < TOLERANCE)
-                return &(*itPlanes);
+                return mplane;
+            ++it;
         }
     }
 
     MeshPlane mpNew;
     mpNew.p = planeToAdd;
     _planes.push_back(mpNew);
-    return &(_planes.back());
+    MeshPlane *mplane = &(_planes.back());
+    _planesIndex.insert(PlanesIndex::value_type(key, mplane));
+    return mplane;
 }
 
 //----------------------------------------------------------------------------
 
-void Mesh::addFace(MeshFace *face, MeshPlane *mplane)
+Mesh::MeshPlane *Mesh::addFace(MeshFace *face, MeshPlane *mplane)
 {
     // compute the area of the face, and drop it if
     // the area is too small
@@ -135,7 +166,7 @@ void Mesh::addFace(MeshFace *face, MeshPlane *mplane)
     double face_s = (face_a + face_b + face_c) / 2.0f;
     double face_area2 = face_s * (face_s - face_a) * (face_s - face_b) * (face_s - face_c);
     if (face_area2 < 1e-7)
-        return;
+        return 0;
 
     // find the plane for the face
     if (! mplane) {
@@ -168,7 +199,7 @@ void Mesh::addFace(MeshFace *face, MeshPlane *mplane)
                      (oldVertex2 == newVertex2);
 
         if (same0 && same1 && same2)
-            return;
+            return 0;
 
         ++it;
     }
@@ -186,6 +217,59 @@ void Mesh::addFace(MeshFace *face, MeshPlane *mplane)
     mpoint2->faces.push_back(face);
 
     _boundsCached = false;
+    return mplane;
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh::removeFace(MeshFace *face, MeshPlane *mplane)
+{
+    mplane->faces.remove(face);
+    detachFace(face);
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh::removeFaces(const std::set<MeshFace *> &faces, MeshPlane *mplane)
+{
+    FacesList::iterator it = mplane->faces.begin();
+    while (it != mplane->faces.end()) {
+        MeshFace *face = (*it);
+        if (faces.find(face) != faces.end()) {
+            it = mplane->faces.erase(it);
+            detachFace(face);
+        } else
+            ++it;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh::detachFace(MeshFace *face)
+{
+    for (int i = 0; i < 3; ++i) {
+        MeshPoint *mpoint = (MeshPoint *)face->vertexPtr(i);
+        mpoint->faces.remove(face);
+        if (! mpoint->faces.empty())
+            continue;
+
+        // the point is now unreferenced, so drop it from the map.
+        // note the key may be stale if the mesh was transformed,
+        // in which case the point is simply left in place
+        unsigned long key = pointKey(mpoint->point);
+        PointsMap::iterator it = _points.lower_bound(key);
+        PointsMap::iterator it1 = _points.upper_bound(key);
+        while (it != it1) {
+            if (&(*it).second == mpoint) {
+                _points.erase(it);
+                break;
+            }
+            ++it;
+        }
+    }
+
+    delete face;
+    _boundsCached = false;
 }
 
 //----------------------------------------------------------------------------
@@ -197,7 +281,7 @@ void Mesh::draw()
         const FacesList &faces = (*itPlanes).faces;
         FacesList::const_iterator itFaces = faces.begin();
         while (itFaces != faces.end()) {
-            (*itFaces)->draw(_highlight);
+            (*itFaces)->draw(_palette, _highlight);
             ++itFaces;
         }
         ++itPlanes;
@@ -296,44 +380,8 @@ Vector Mesh::centralize()
 
 void Mesh::computeVertexNormals()
 {
-    PointsMap::iterator itPoints = _points.begin();
-    while (itPoints != _points.end()) {
-        MeshPoint &mpoint = (*itPoints).second;
-        ++itPoints;
-
-        Vector sum;
-        int count = 0;
-
-        FacesList &faces = mpoint.faces;
-        if (! faces.empty()) {
-
-            FacesList::iterator itFaces = faces.begin();
-            MeshFace *face1 = (*itFaces);
-            sum += face1->planeNormal();
-
-            ++itFaces;
-            while (itFaces != faces.end()) {
-                MeshFace *face2 = (*itFaces);
-                float dotprod = face1->planeNormal() * face2->planeNormal();
-                if (dotprod > -0.1 && dotprod < 0.1) {
-                    count = 0;
-                    break;
-                } else {
-                    sum += face2->planeNormal();
-                    ++count;
-                    ++itFaces;
-                }
-            }
-        }
-
-        //count = 0;
-
-        if (count > 0) {
-            sum /= (float)count;
-            mpoint.normal = sum.normalized();
-        } else
-            mpoint.normal = Vector();
-    }
+    // faces that meet at more than about 84 degrees make a crease
+    Mesh_Opt::computeNormals(this, 84.0f);
 }
 
 //----------------------------------------------------------------------------
@@ -9,8 +9,10 @@
 
 #include <threed/object.h>
 #include <threed/plane.h>
+#include <threed/materialpalette.h>
 #include <map>
 #include <list>
+#include <set>
 
 namespace ThreeD {
 
@@ -39,6 +41,7 @@ public:
         Vector point;
         Vector normal;
         FacesList faces;
+        MaterialPalette::Id material;   // of the isosurface at the point
     };
 
     typedef std::multimap<unsigned long, MeshPoint> PointsMap;
@@ -73,8 +76,25 @@ public:
      * Associates a mesh face with this mesh.
      * IMPORTANT:  The vertices that make up the mesh face
      * should be those returned by Mesh::addPoint().
+     *
+     * @return the plane that holds the face, or 0 if the face
+     * was dropped for having a degenerate area.
+     */
+    MeshPlane *addFace(MeshFace *face, MeshPlane *mplane = 0);
+
+    /**
+     * Removes and destroys a mesh face previously associated
+     * with this mesh through plane @p mplane.  Points that are
+     * no longer referenced by any face are removed as well.
      */
-    void addFace(MeshFace *face, MeshPlane *mplane = 0);
+    void removeFace(MeshFace *face, MeshPlane *mplane);
+
+    /**
+     * Removes and destroys a set of mesh faces which are all
+     * held by plane @p mplane, walking the faces of the plane
+     * only once.
+     */
+    void removeFaces(const std::set<MeshFace *> &faces, MeshPlane *mplane);
 
     /**
      * Apply the transform @p trans into this object.
@@ -116,6 +136,10 @@ public:
     /** Compute vertex normals. */
     void computeVertexNormals();
 
+    /** @return the palette that holds the materials of the faces */
+    MaterialPalette &palette() { return _palette; }
+    const MaterialPalette &palette() const { return _palette; }
+
     /**
      * Specifies the color to highlight the object with.
      * Specification of an empty Color() implies no highlighting.
@@ -123,11 +147,35 @@ public:
     virtual void highlight(const Color &color);
 
 protected:
+    /** @return the key of a point in the points map. */
+    static unsigned long pointKey(const Vector &v);
+
+    /** Detaches @p face from its vertices and destroys it. */
+    void detachFace(MeshFace *face);
+
+    // planes are indexed by their coefficients, quantized into
+    // cells twice the size of the plane matching tolerance
+    struct PlaneKey {
+        long k[4];
+
+        bool operator<(const PlaneKey &other) const
+        {
+            for (int i = 0; i < 4; ++i)
+                if (k[i] != other.k[i])
+                    return (k[i] < other.k[i]);
+            return false;
+        }
+    };
+
+    typedef std::multimap<PlaneKey, MeshPlane *> PlanesIndex;
+
     /*
      * data
      */
     PointsMap _points;
     PlanesList _planes;
+    PlanesIndex _planesIndex;
+    MaterialPalette _palette;
 
     Vector _bounds[2];              // top-left and bottom-right
     bool _boundsCached;             // if _bounds is ok to use
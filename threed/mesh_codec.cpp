@@ -0,0 +1,435 @@
+//----------------------------------------------------------------------------
+// ThreeD Mesh Encoder and Decoder
+//----------------------------------------------------------------------------
+
+#include <threed/mesh_codec.h>
+#include <threed/misc.h>
+#include <string.h>
+#include <math.h>
+
+using namespace ThreeD;
+
+//----------------------------------------------------------------------------
+
+#define MAGIC "TDM1"
+#define MAGIC_SIZE 4
+#define NUM_MATERIAL_FLOATS 13
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+class Writer
+{
+public:
+    Writer(std::vector<unsigned char> *data) : _data(data) {}
+
+    void byte(unsigned char b) { _data->push_back(b); }
+
+    void varint(unsigned int u)
+    {
+        while (u >= 0x80) {
+            _data->push_back((unsigned char)(u | 0x80));
+            u >>= 7;
+        }
+        _data->push_back((unsigned char)u);
+    }
+
+    // small numbers of either sign take few bytes (zigzag)
+    void signedVarint(int i)
+    {
+        varint(((unsigned int)i << 1) ^ (unsigned int)(i >> 31));
+    }
+
+    // little endian, whatever the machine
+    void real(float f)
+    {
+        unsigned int u;
+        memcpy(&u, &f, sizeof(u));
+        for (int k = 0; k < 4; ++k)
+            _data->push_back((unsigned char)(u >> (k * 8)));
+    }
+
+private:
+    std::vector<unsigned char> *_data;
+};
+
+// reads past the end yield zeros, and clear ok()
+
+class Reader
+{
+public:
+    Reader(const unsigned char *data, unsigned long size)
+        : _p(data), _end(data + size), _ok(true) {}
+
+    bool ok() const { return _ok; }
+
+    unsigned long left() const { return (unsigned long)(_end - _p); }
+
+    unsigned char byte()
+    {
+        if (_p >= _end) {
+            _ok = false;
+            return 0;
+        }
+        return *_p++;
+    }
+
+    unsigned int varint()
+    {
+        unsigned int u = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (_p >= _end)
+                break;
+            unsigned char b = *_p++;
+            u |= (unsigned int)(b & 0x7f) << shift;
+            if (! (b & 0x80))
+                return u;
+        }
+        _ok = false;
+        return 0;
+    }
+
+    int signedVarint()
+    {
+        unsigned int u = varint();
+        return (int)(u >> 1) ^ -(int)(u & 1);
+    }
+
+    float real()
+    {
+        if (left() < 4) {
+            _ok = false;
+            _p = _end;
+            return 0.0f;
+        }
+        unsigned int u = 0;
+        for (int k = 0; k < 4; ++k)
+            u |= (unsigned int)(*_p++) << (k * 8);
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+
+    bool magic()
+    {
+        if (left() < MAGIC_SIZE || memcmp(_p, MAGIC, MAGIC_SIZE) != 0)
+            return false;
+        _p += MAGIC_SIZE;
+        return true;
+    }
+
+private:
+    const unsigned char *_p;
+    const unsigned char *_end;
+    bool _ok;
+};
+
+inline float sign(float f)
+{
+    return (f >= 0.0f ? 1.0f : -1.0f);
+}
+
+// fold a unit vector onto the octahedron |x| + |y| + |z| = 1, and
+// unfold the lower half around the upper half into a square.  the
+// corner (0, 0) stands for the zero normal
+
+void octEncode(const Vector &n, int max, int *u, int *v)
+{
+    float sum = fabs(n.x()) + fabs(n.y()) + fabs(n.z());
+    if (sum <= 0.0f) {
+        *u = *v = 0;
+        return;
+    }
+    float x = n.x() / sum;
+    float y = n.y() / sum;
+    if (n.z() < 0.0f) {
+        float x1 = (1.0f - fabs(y)) * sign(x);
+        y = (1.0f - fabs(x)) * sign(y);
+        x = x1;
+    }
+    *u = (int)floor((x * 0.5f + 0.5f) * max + 0.5f);
+    *v = (int)floor((y * 0.5f + 0.5f) * max + 0.5f);
+    if (*u == 0 && *v == 0)
+        *u = *v = max;                  // also (0, 0, -1)
+}
+
+Vector octDecode(int u, int v, float scale)
+{
+    if (u == 0 && v == 0)
+        return Vector();
+    float x = u * scale - 1.0f;
+    float y = v * scale - 1.0f;
+    float z = 1.0f - fabs(x) - fabs(y);
+    if (z < 0.0f) {
+        float x1 = (1.0f - fabs(y)) * sign(x);
+        y = (1.0f - fabs(x)) * sign(y);
+        x = x1;
+    }
+    return Vector(x, y, z).normalized();
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+
+void Mesh_Codec::encode(const IndexedMesh &imesh,
+                        std::vector<unsigned char> *data,
+                        int positionBits, int normalBits)
+{
+    int numPoints = (int)imesh.points.size();
+    int numFaces = imesh.numFaces();
+    int numMaterials = (int)imesh.materials.size();
+    bool hasNormals = ((int)imesh.normals.size() == numPoints);
+    positionBits = THREED_MAX(1, THREED_MIN(positionBits, 24));
+    normalBits = (hasNormals ? THREED_MAX(2, THREED_MIN(normalBits, 16)) : 0);
+
+    data->clear();
+    data->reserve(numPoints * 6 + numFaces * 4 + 64);
+    Writer out(data);
+
+    Vector vmin(1e30f, 1e30f, 1e30f), vmax(-1e30f, -1e30f, -1e30f);
+    int i, k;
+    for (i = 0; i < numPoints; ++i) {
+        const Vector &v = imesh.points[i];
+        vmin = Vector(THREED_MIN(vmin.x(), v.x()), THREED_MIN(vmin.y(), v.y()),
+                      THREED_MIN(vmin.z(), v.z()));
+        vmax = Vector(THREED_MAX(vmax.x(), v.x()), THREED_MAX(vmax.y(), v.y()),
+                      THREED_MAX(vmax.z(), v.z()));
+    }
+    if (numPoints == 0)
+        vmin = vmax = Vector();
+    Vector extent = vmax - vmin;
+
+    for (k = 0; k < MAGIC_SIZE; ++k)
+        out.byte(MAGIC[k]);
+    out.varint(numPoints);
+    out.varint(numFaces);
+    out.varint(numMaterials);
+    out.byte((unsigned char)positionBits);
+    out.byte((unsigned char)normalBits);
+    out.real(vmin.x());
+    out.real(vmin.y());
+    out.real(vmin.z());
+    out.real(extent.x());
+    out.real(extent.y());
+    out.real(extent.z());
+
+    // the palette
+
+    for (i = 0; i < numMaterials; ++i) {
+        const IndexedMesh::Material &m = imesh.materials[i];
+        const Color *colors[4] = { &m.c, &m.ambient, &m.diffuse, &m.specular };
+        for (k = 0; k < 4; ++k) {
+            out.real(colors[k]->red());
+            out.real(colors[k]->green());
+            out.real(colors[k]->blue());
+        }
+        out.real(m.shininess);
+    }
+
+    // points, as steps from the previous point
+
+    float max = (float)((1 << positionBits) - 1);
+    float scale[3];
+    for (k = 0; k < 3; ++k) {
+        float e = (k == 0 ? extent.x() : k == 1 ? extent.y() : extent.z());
+        scale[k] = (e > 0.0f ? max / e : 0.0f);
+    }
+    int last[3] = { 0, 0, 0 };
+    for (i = 0; i < numPoints; ++i) {
+        Vector offset = imesh.points[i] - vmin;
+        int q[3];
+        q[0] = (int)floor(offset.x() * scale[0] + 0.5f);
+        q[1] = (int)floor(offset.y() * scale[1] + 0.5f);
+        q[2] = (int)floor(offset.z() * scale[2] + 0.5f);
+        for (k = 0; k < 3; ++k) {
+            q[k] = THREED_MAX(0, THREED_MIN(q[k], (int)max));
+            out.signedVarint(q[k] - last[k]);
+            last[k] = q[k];
+        }
+    }
+
+    if (normalBits > 0) {
+        int nmax = (1 << normalBits) - 1;
+        int lastU = 0, lastV = 0;
+        for (i = 0; i < numPoints; ++i) {
+            int u, v;
+            octEncode(imesh.normals[i], nmax, &u, &v);
+            out.signedVarint(u - lastU);
+            out.signedVarint(v - lastV);
+            lastU = u;
+            lastV = v;
+        }
+    }
+
+    // face corners, as distances back from the next point not used
+    // yet, which is zero for each point used for the first time
+
+    int next = 0;
+    for (i = 0; i < numFaces * 3; ++i) {
+        int p = imesh.faces[i];
+        out.signedVarint(next - p);
+        if (p >= next)
+            next = p + 1;
+    }
+
+    // and materials, in runs:  those of the faces, then those of the
+    // points, if any, which a decoder that does not know them ignores
+
+    i = 0;
+    while (i < numFaces) {
+        int m = imesh.faceMaterials[i];
+        int j = i + 1;
+        while (j < numFaces && imesh.faceMaterials[j] == m)
+            ++j;
+        out.varint(j - i);
+        out.varint(m);
+        i = j;
+    }
+
+    if ((int)imesh.pointMaterials.size() == numPoints) {
+        i = 0;
+        while (i < numPoints) {
+            int m = imesh.pointMaterials[i];
+            int j = i + 1;
+            while (j < numPoints && imesh.pointMaterials[j] == m)
+                ++j;
+            out.varint(j - i);
+            out.varint(m);
+            i = j;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh_Codec::encode(const Mesh *mesh, std::vector<unsigned char> *data,
+                        int positionBits, int normalBits)
+{
+    IndexedMesh imesh;
+    Mesh_Opt::getIndexedMesh(mesh, &imesh);
+    Mesh_Opt::optimizeVertexCache(&imesh);
+    encode(imesh, data, positionBits, normalBits);
+}
+
+//----------------------------------------------------------------------------
+
+bool Mesh_Codec::decode(const unsigned char *data, unsigned long size,
+                        IndexedMesh *imesh)
+{
+    Reader in(data, size);
+    if (! in.magic())
+        return false;
+
+    unsigned int numPoints = in.varint();
+    unsigned int numFaces = in.varint();
+    unsigned int numMaterials = in.varint();
+    int positionBits = in.byte();
+    int normalBits = in.byte();
+    float origin[3], extent[3];
+    int i, k;
+    for (k = 0; k < 3; ++k)
+        origin[k] = in.real();
+    for (k = 0; k < 3; ++k)
+        extent[k] = in.real();
+
+    // every point and face corner takes a byte at least, so check
+    // the counts before trusting them with memory
+
+    if (! in.ok() || positionBits < 1 || positionBits > 24 ||
+            normalBits == 1 || normalBits > 16 ||
+            numMaterials > in.left() / (NUM_MATERIAL_FLOATS * 4) ||
+            numPoints > in.left() / 3 || numFaces > in.left() / 3)
+        return false;
+
+    imesh->materials.resize(numMaterials);
+    for (i = 0; i < (int)numMaterials; ++i) {
+        IndexedMesh::Material &m = imesh->materials[i];
+        Color *colors[4] = { &m.c, &m.ambient, &m.diffuse, &m.specular };
+        for (k = 0; k < 4; ++k) {
+            float r = in.real();
+            float g = in.real();
+            float b = in.real();
+            *colors[k] = Color(r, g, b);
+        }
+        m.shininess = in.real();
+    }
+
+    float step[3];
+    for (k = 0; k < 3; ++k)
+        step[k] = extent[k] / (float)((1 << positionBits) - 1);
+    imesh->points.resize(numPoints);
+    int q[3] = { 0, 0, 0 };
+    for (i = 0; i < (int)numPoints; ++i) {
+        q[0] += in.signedVarint();
+        q[1] += in.signedVarint();
+        q[2] += in.signedVarint();
+        imesh->points[i] = Vector(origin[0] + q[0] * step[0],
+                                  origin[1] + q[1] * step[1],
+                                  origin[2] + q[2] * step[2]);
+    }
+
+    if (normalBits > 0) {
+        float scale = 2.0f / (float)((1 << normalBits) - 1);
+        imesh->normals.resize(numPoints);
+        int u = 0, v = 0;
+        for (i = 0; i < (int)numPoints; ++i) {
+            u += in.signedVarint();
+            v += in.signedVarint();
+            imesh->normals[i] = octDecode(u, v, scale);
+        }
+    } else
+        imesh->normals.clear();
+
+    imesh->faces.resize(numFaces * 3);
+    int next = 0;
+    for (i = 0; i < (int)numFaces * 3; ++i) {
+        int p = next - in.signedVarint();
+        if (p < 0 || p >= (int)numPoints)
+            return false;
+        imesh->faces[i] = p;
+        if (p >= next)
+            next = p + 1;
+    }
+
+    imesh->faceMaterials.resize(numFaces);
+    i = 0;
+    while (i < (int)numFaces) {
+        unsigned int run = in.varint();
+        unsigned int m = in.varint();
+        if (! in.ok() || run == 0 || run > numFaces - i || m >= numMaterials)
+            return false;
+        for (unsigned int j = 0; j < run; ++j)
+            imesh->faceMaterials[i++] = m;
+    }
+
+    imesh->pointMaterials.clear();
+    if (in.ok() && in.left() > 0 && numPoints > 0) {
+        imesh->pointMaterials.resize(numPoints);
+        i = 0;
+        while (i < (int)numPoints) {
+            unsigned int run = in.varint();
+            unsigned int m = in.varint();
+            if (! in.ok() || run == 0 || run > numPoints - i ||
+                    m >= numMaterials)
+                return false;
+            for (unsigned int j = 0; j < run; ++j)
+                imesh->pointMaterials[i++] = m;
+        }
+    }
+
+    return in.ok();
+}
+
+//----------------------------------------------------------------------------
+
+bool Mesh_Codec::decode(const unsigned char *data, unsigned long size,
+                        Mesh *mesh)
+{
+    IndexedMesh imesh;
+    if (! decode(data, size, &imesh))
+        return false;
+    Mesh_Opt::setIndexedMesh(mesh, imesh);
+    return true;
+}
@@ -0,0 +1,63 @@
+//----------------------------------------------------------------------------
+// ThreeD Mesh Encoder and Decoder
+//----------------------------------------------------------------------------
+
+#ifndef _THREED_MESH_CODEC_H
+#define _THREED_MESH_CODEC_H
+
+#include <threed/mesh_opt.h>
+#include <vector>
+
+namespace ThreeD {
+
+
+/**
+ * Mesh_Codec, a compact encoding of meshes for storage and transfer
+ *
+ * Positions are quantized to a grid over the bounding box of the mesh,
+ * so each coordinate is off by at most half a grid step:  the size of
+ * the box along that axis over 2^positionBits - 1, halved.  Normals are
+ * folded onto an octahedron and quantized to two normalBits numbers.
+ * Materials are written once, into a palette, and faces and points
+ * refer to the palette in runs.
+ *
+ * Points are written as differences from the previous point, and
+ * faces as distances from the highest point used so far, all in
+ * variable-length bytes, so a mesh in vertex cache order (see
+ * Mesh_Opt::optimizeVertexCache()) takes few bytes per face.
+ *
+ * The decoder reads the data front to back, once.
+ */
+class Mesh_Codec
+{
+public:
+    /** Encode @p imesh into @p data, which is cleared first
+     */
+    static void encode(const IndexedMesh &imesh, std::vector<unsigned char> *data,
+                       int positionBits = 16, int normalBits = 10);
+
+    /** Encode @p mesh into @p data, with its faces in vertex cache
+     *  order
+     */
+    static void encode(const Mesh *mesh, std::vector<unsigned char> *data,
+                       int positionBits = 16, int normalBits = 10);
+
+    /** Decode @p size bytes of @p data into @p imesh
+     *
+     *  @return false if the data is not a valid encoding
+     */
+    static bool decode(const unsigned char *data, unsigned long size,
+                       IndexedMesh *imesh);
+
+    /** Decode @p size bytes of @p data into @p mesh, replacing its
+     *  contents
+     *
+     *  @return false if the data is not a valid encoding
+     */
+    static bool decode(const unsigned char *data, unsigned long size,
+                       Mesh *mesh);
+};
+
+
+} // namespace ThreeD
+#endif // _THREED_MESH_CODEC_H
@@ -0,0 +1,2594 @@
+//----------------------------------------------------------------------------
+// ThreeD Mesh Optimizer
+//----------------------------------------------------------------------------
+
+#include <threed/mesh_opt.h>
+#include <threed/meshface.h>
+#include <threed/misc.h>
+#include <threed/threadpool.h>
+#include <algorithm>
+#include <math.h>
+
+using namespace ThreeD;
+
+//----------------------------------------------------------------------------
+
+#define BORDER_WEIGHT 100.0             // quadric weight of kept borders
+#define MIN_FACE_COSINE 0.2             // limit on turning a face
+#define MAX_SLIVER_LOOP 12              // longest hole closed for the time
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+// symmetric 4x4 matrix of a sum of squared distances to planes
+
+struct Quadric {
+    double aa, ab, ac, ad, bb, bc, bd, cc, cd, dd;
+
+    void clear()
+    {
+        aa = ab = ac = ad = bb = bc = bd = cc = cd = dd = 0.0;
+    }
+
+    void addPlane(double a, double b, double c, double d, double w)
+    {
+        aa += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+        bb += w * b * b; bc += w * b * c; bd += w * b * d;
+        cc += w * c * c; cd += w * c * d;
+        dd += w * d * d;
+    }
+
+    void add(const Quadric &q)
+    {
+        aa += q.aa; ab += q.ab; ac += q.ac; ad += q.ad;
+        bb += q.bb; bc += q.bc; bd += q.bd;
+        cc += q.cc; cd += q.cd;
+        dd += q.dd;
+    }
+
+    double error(double x, double y, double z) const
+    {
+        double e = x * (aa * x + 2.0 * (ab * y + ac * z + ad))
+                 + y * (bb * y + 2.0 * (bc * z + bd))
+                 + z * (cc * z + 2.0 * cd)
+                 + dd;
+        return (e > 0.0 ? e : 0.0);
+    }
+
+    // the point of least error, if the quadric is well conditioned
+
+    bool minimum(double *x, double *y, double *z) const
+    {
+        double c00 = bb * cc - bc * bc;
+        double c01 = ac * bc - ab * cc;
+        double c02 = ab * bc - ac * bb;
+        double det = aa * c00 + ab * c01 + ac * c02;
+        double scale = aa + bb + cc;
+        if (fabs(det) <= 1e-9 * scale * scale * scale)
+            return false;
+
+        double c11 = aa * cc - ac * ac;
+        double c12 = ab * ac - aa * bc;
+        double c22 = aa * bb - ab * ab;
+        *x = -(c00 * ad + c01 * bd + c02 * cd) / det;
+        *y = -(c01 * ad + c11 * bd + c12 * cd) / det;
+        *z = -(c02 * ad + c12 * bd + c22 * cd) / det;
+        return true;
+    }
+};
+
+struct Collapse {
+    float cost;
+    int p0, p1;                         // p1 is merged into p0
+    unsigned int stamp;                 // sum of the stamps of p0 and p1
+
+    // std::push_heap keeps the largest on top
+    bool operator<(const Collapse &other) const
+    {
+        return (cost > other.cost);
+    }
+};
+
+struct Edge {
+    int p0, p1;                         // p0 < p1
+    int face;
+
+    bool operator<(const Edge &other) const
+    {
+        if (p0 != other.p0)
+            return (p0 < other.p0);
+        return (p1 < other.p1);
+    }
+};
+
+struct DirectedEdge {
+    int p0, p1;
+    int face;
+
+    bool operator<(const DirectedEdge &other) const
+    {
+        if (p0 != other.p0)
+            return (p0 < other.p0);
+        return (p1 < other.p1);
+    }
+};
+
+struct PointRef {
+    const Vector *v;
+    int index;
+
+    bool operator<(const PointRef &other) const
+    {
+        return (v < other.v);
+    }
+};
+
+// interleave the bits of three 10-bit coordinates
+
+inline unsigned int spreadBits(unsigned int x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+inline unsigned int mortonCode(const Vector &v)
+{
+    return (spreadBits((unsigned int)v.x()) |
+           (spreadBits((unsigned int)v.y()) << 1) |
+           (spreadBits((unsigned int)v.z()) << 2));
+}
+
+inline void faceNormal(const Vector &v0, const Vector &v1, const Vector &v2,
+                       double *nx, double *ny, double *nz)
+{
+    double ux = v1.x() - v0.x(), uy = v1.y() - v0.y(), uz = v1.z() - v0.z();
+    double wx = v2.x() - v0.x(), wy = v2.y() - v0.y(), wz = v2.z() - v0.z();
+    *nx = uy * wz - uz * wy;
+    *ny = uz * wx - ux * wz;
+    *nz = ux * wy - uy * wx;
+}
+
+// working state of decimate()
+
+class Decimator
+{
+public:
+    Decimator(IndexedMesh *imesh);
+
+    int run(int targetFaces, float maxError);
+
+private:
+    void closeSlivers();
+    bool canFan(const std::vector<int> &loop,
+                const std::vector<DirectedEdge> &holeEdges,
+                const std::vector<DirectedEdge> &edges);
+    void computeQuadrics();
+    float collapseCost(int p0, int p1, Vector *target) const;
+    void pushCollapse(int p0, int p1);
+    bool canCollapse(int p0, int p1, const Vector &target);
+    void collapse(int p0, int p1, const Vector &target);
+    void pointFaces(int p, std::vector<int> *faces) const;
+    bool onBorder(int p, const std::vector<int> &faces);
+    void compact();
+
+    IndexedMesh *_imesh;
+    int _numPoints;
+    int _numFaces;
+    int _numMeshFaces;                  // faces past these close slivers
+    int _numLiveFaces;
+
+    std::vector<Quadric> _quadrics;
+    std::vector<unsigned int> _stamps;
+    std::vector<bool> _pointAlive;
+    std::vector<bool> _faceAlive;
+
+    // faces around each original point, in compressed rows.  When a
+    // point is merged into another, their circular chains are joined,
+    // so the faces around a point are those of every point in its
+    // chain.  Once the faces fit into the row of the point again, they
+    // are moved there, and the chain is cut
+    std::vector<int> _adjStart;
+    std::vector<int> _adjCount;
+    std::vector<int> _adjFaces;
+    std::vector<int> _chain;
+
+    std::vector<Collapse> _heap;
+
+    std::vector<int> _faces0, _faces1; // scratch
+
+    // points are marked with a new number for each set being built
+    std::vector<unsigned int> _marks;
+    unsigned int _lastMark;
+
+    unsigned int nextMark() { return ++_lastMark; }
+};
+
+} // namespace
+
+//----------------------------------------------------------------------------
+
+Decimator::Decimator(IndexedMesh *imesh)
+{
+    _imesh = imesh;
+    _numPoints = (int)imesh->points.size();
+    _numMeshFaces = imesh->numFaces();
+    _numLiveFaces = _numMeshFaces;
+    _marks.assign(_numPoints, 0);
+    _lastMark = 0;
+
+    closeSlivers();
+    _numFaces = imesh->numFaces();
+
+    _stamps.assign(_numPoints, 0);
+    _pointAlive.assign(_numPoints, true);
+    _faceAlive.assign(_numFaces, true);
+
+    const std::vector<int> &faces = imesh->faces;
+    int i;
+
+    _adjStart.assign(_numPoints + 1, 0);
+    for (i = 0; i < _numFaces * 3; ++i)
+        ++_adjStart[faces[i] + 1];
+    for (i = 0; i < _numPoints; ++i)
+        _adjStart[i + 1] += _adjStart[i];
+    _adjFaces.resize(_numFaces * 3);
+    _adjCount.assign(_numPoints, 0);
+    for (i = 0; i < _numFaces * 3; ++i) {
+        int p = faces[i];
+        _adjFaces[_adjStart[p] + _adjCount[p]++] = i / 3;
+    }
+
+    _chain.resize(_numPoints);
+    for (i = 0; i < _numPoints; ++i)
+        _chain[i] = i;
+}
+
+//----------------------------------------------------------------------------
+
+void Decimator::closeSlivers()
+{
+    // Mesh::addFace() drops faces of tiny area, leaving small holes.
+    // Their edges would be kept as borders, so the holes are closed
+    // for the time of the decimation.  The closing faces add no
+    // error, and are dropped from the result
+
+    std::vector<int> &faces = _imesh->faces;
+    std::vector<DirectedEdge> edges(_numMeshFaces * 3);
+    int i;
+    for (i = 0; i < _numMeshFaces * 3; ++i) {
+        edges[i].p0 = faces[i];
+        edges[i].p1 = faces[(i % 3 == 2) ? i - 2 : i + 1];
+        edges[i].face = i / 3;
+    }
+    std::sort(edges.begin(), edges.end());
+
+    // a hole runs against the edges of the faces around it
+
+    std::vector<DirectedEdge> holeEdges;
+    for (i = 0; i < (int)edges.size(); ++i) {
+        DirectedEdge reverse;
+        reverse.p0 = edges[i].p1;
+        reverse.p1 = edges[i].p0;
+        if (std::binary_search(edges.begin(), edges.end(), reverse))
+            continue;
+        reverse.face = edges[i].face;
+        holeEdges.push_back(reverse);
+    }
+    std::sort(holeEdges.begin(), holeEdges.end());
+
+    // walk the edges into loops, and close the short loops with fans
+
+    int numEdges = (int)holeEdges.size();
+    std::vector<bool> used(numEdges, false);
+    std::vector<int> loop;
+    for (i = 0; i < numEdges; ++i) {
+        if (used[i])
+            continue;
+        loop.clear();
+        int e = i;
+        bool closed = false;
+        while ((int)loop.size() < MAX_SLIVER_LOOP) {
+            used[e] = true;
+            loop.push_back(e);
+            int p = holeEdges[e].p1;
+            if (p == holeEdges[i].p0) {
+                closed = true;
+                break;
+            }
+            DirectedEdge key;
+            key.p0 = p;
+            key.p1 = -1;
+            e = (int)(std::upper_bound(holeEdges.begin(), holeEdges.end(), key)
+                      - holeEdges.begin());
+            while (e < numEdges && holeEdges[e].p0 == p && used[e])
+                ++e;
+            if (e == numEdges || holeEdges[e].p0 != p)
+                break;
+        }
+        if (! closed || loop.size() < 3 || ! canFan(loop, holeEdges, edges))
+            continue;
+
+        int material = _imesh->faceMaterials[holeEdges[i].face];
+        for (unsigned int k = 1; k + 1 < loop.size(); ++k) {
+            faces.push_back(holeEdges[loop[0]].p0);
+            faces.push_back(holeEdges[loop[k]].p0);
+            faces.push_back(holeEdges[loop[k + 1]].p0);
+            _imesh->faceMaterials.push_back(material);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+bool Decimator::canFan(const std::vector<int> &loop,
+                       const std::vector<DirectedEdge> &holeEdges,
+                       const std::vector<DirectedEdge> &edges)
+{
+    // the loop must not pass a point twice, and the diagonals of the
+    // fan must not be edges already
+
+    unsigned int mark = nextMark();
+    unsigned int k;
+    for (k = 0; k < loop.size(); ++k) {
+        int p = holeEdges[loop[k]].p0;
+        if (_marks[p] == mark)
+            return false;
+        _marks[p] = mark;
+    }
+
+    int p0 = holeEdges[loop[0]].p0;
+    for (k = 2; k + 1 < loop.size(); ++k) {
+        DirectedEdge diagonal;
+        diagonal.p0 = p0;
+        diagonal.p1 = holeEdges[loop[k]].p0;
+        if (std::binary_search(edges.begin(), edges.end(), diagonal))
+            return false;
+        std::swap(diagonal.p0, diagonal.p1);
+        if (std::binary_search(edges.begin(), edges.end(), diagonal))
+            return false;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void Decimator::computeQuadrics()
+{
+    const std::vector<Vector> &points = _imesh->points;
+    const std::vector<int> &faces = _imesh->faces;
+    const std::vector<int> &materials = _imesh->faceMaterials;
+
+    _quadrics.resize(_numPoints);
+    int i;
+    for (i = 0; i < _numPoints; ++i)
+        _quadrics[i].clear();
+
+    std::vector<double> normals(_numFaces * 3);
+    for (i = 0; i < _numMeshFaces; ++i) {
+        const int *f = &faces[i * 3];
+        double nx, ny, nz;
+        faceNormal(points[f[0]], points[f[1]], points[f[2]], &nx, &ny, &nz);
+        double len = sqrt(nx * nx + ny * ny + nz * nz);
+        if (len == 0.0)
+            continue;
+        nx /= len;
+        ny /= len;
+        nz /= len;
+        normals[i * 3 + 0] = nx;
+        normals[i * 3 + 1] = ny;
+        normals[i * 3 + 2] = nz;
+
+        const Vector &v = points[f[0]];
+        double d = -(nx * v.x() + ny * v.y() + nz * v.z());
+        for (int k = 0; k < 3; ++k)
+            _quadrics[f[k]].addPlane(nx, ny, nz, d, 1.0);
+    }
+
+    // sort the edges, so the faces sharing an edge are adjacent
+
+    std::vector<Edge> edges(_numFaces * 3);
+    for (i = 0; i < _numFaces * 3; ++i) {
+        int p0 = faces[i];
+        int p1 = faces[(i % 3 == 2) ? i - 2 : i + 1];
+        Edge &edge = edges[i];
+        edge.p0 = (p0 < p1 ? p0 : p1);
+        edge.p1 = (p0 < p1 ? p1 : p0);
+        edge.face = i / 3;
+    }
+    std::sort(edges.begin(), edges.end());
+
+    // an edge of only one face, or between two materials, is a border.
+    // it is kept in place by a plane through the edge, perpendicular
+    // to the face
+
+    int numEdges = 0;
+    int e0 = 0;
+    while (e0 < (int)edges.size()) {
+        int e1 = e0 + 1;
+        while (e1 < (int)edges.size() &&
+               edges[e1].p0 == edges[e0].p0 && edges[e1].p1 == edges[e0].p1)
+            ++e1;
+
+        bool border = (e1 - e0 != 2 ||
+            materials[edges[e0].face] != materials[edges[e0 + 1].face]);
+
+        if (border) {
+            const Vector &v0 = points[edges[e0].p0];
+            const Vector &v1 = points[edges[e0].p1];
+            double ex = v1.x() - v0.x();
+            double ey = v1.y() - v0.y();
+            double ez = v1.z() - v0.z();
+            for (int e = e0; e < e1; ++e) {
+                const double *n = &normals[edges[e].face * 3];
+                double px = ey * n[2] - ez * n[1];
+                double py = ez * n[0] - ex * n[2];
+                double pz = ex * n[1] - ey * n[0];
+                double len = sqrt(px * px + py * py + pz * pz);
+                if (len == 0.0)
+                    continue;
+                px /= len;
+                py /= len;
+                pz /= len;
+                double d = -(px * v0.x() + py * v0.y() + pz * v0.z());
+                _quadrics[edges[e].p0].addPlane(px, py, pz, d, BORDER_WEIGHT);
+                _quadrics[edges[e].p1].addPlane(px, py, pz, d, BORDER_WEIGHT);
+            }
+        }
+
+        edges[numEdges++] = edges[e0];
+        e0 = e1;
+    }
+
+    // queue the collapse of every edge, once the quadrics are complete
+
+    _heap.reserve(numEdges * 2);
+    for (i = 0; i < numEdges; ++i) {
+        Vector target;
+        Collapse collapse;
+        collapse.p0 = edges[i].p0;
+        collapse.p1 = edges[i].p1;
+        collapse.cost = collapseCost(collapse.p0, collapse.p1, &target);
+        collapse.stamp = 0;
+        _heap.push_back(collapse);
+    }
+    std::make_heap(_heap.begin(), _heap.end());
+}
+
+//----------------------------------------------------------------------------
+
+float Decimator::collapseCost(int p0, int p1, Vector *target) const
+{
+    const Vector &v0 = _imesh->points[p0];
+    const Vector &v1 = _imesh->points[p1];
+    Quadric q = _quadrics[p0];
+    q.add(_quadrics[p1]);
+
+    // the point of least error, unless the quadric is degenerate
+    // or that point is far from the edge; otherwise the better of
+    // the ends and the middle of the edge
+
+    float cost = 0.0f;
+    double x, y, z;
+    bool found = false;
+    if (q.minimum(&x, &y, &z)) {
+        double mx = (v0.x() + v1.x()) * 0.5;
+        double my = (v0.y() + v1.y()) * 0.5;
+        double mz = (v0.z() + v1.z()) * 0.5;
+        double ex = v1.x() - v0.x();
+        double ey = v1.y() - v0.y();
+        double ez = v1.z() - v0.z();
+        double dx = x - mx, dy = y - my, dz = z - mz;
+        if (dx * dx + dy * dy + dz * dz <= ex * ex + ey * ey + ez * ez) {
+            *target = Vector((float)x, (float)y, (float)z);
+            cost = (float)q.error(x, y, z);
+            found = true;
+        }
+    }
+    if (! found) {
+        Vector candidates[3] = { v0, v1, (v0 + v1) * 0.5f };
+        for (int i = 0; i < 3; ++i) {
+            const Vector &c = candidates[i];
+            float e = (float)q.error(c.x(), c.y(), c.z());
+            if (i == 0 || e < cost) {
+                cost = e;
+                *target = c;
+            }
+        }
+    }
+
+    return cost;
+}
+
+//----------------------------------------------------------------------------
+
+void Decimator::pushCollapse(int p0, int p1)
+{
+    Vector target;
+    Collapse collapse;
+    collapse.cost = collapseCost(p0, p1, &target);
+    collapse.p0 = p0;
+    collapse.p1 = p1;
+    collapse.stamp = _stamps[p0] + _stamps[p1];
+    _heap.push_back(collapse);
+    std::push_heap(_heap.begin(), _heap.end());
+}
+
+//----------------------------------------------------------------------------
+
+void Decimator::pointFaces(int p, std::vector<int> *faces) const
+{
+    faces->clear();
+    int q = p;
+    do {
+        int end = _adjStart[q] + _adjCount[q];
+        for (int i = _adjStart[q]; i < end; ++i) {
+            int f = _adjFaces[i];
+            if (_faceAlive[f])
+                faces->push_back(f);
+        }
+        q = _chain[q];
+    } while (q != p);
+}
+
+//----------------------------------------------------------------------------
+
+bool Decimator::onBorder(int p, const std::vector<int> &faces)
+{
+    // inside the surface, each edge around the point is on two faces,
+    // so each neighbor is counted twice:  once as the corner after the
+    // point, and once as the corner before it
+
+    unsigned int after = nextMark();
+    unsigned int both = nextMark();
+    int k;
+    unsigned int i;
+    for (i = 0; i < faces.size(); ++i) {
+        const int *f = &_imesh->faces[faces[i] * 3];
+        for (k = 0; k < 3; ++k)
+            if (f[k] == p)
+                break;
+        _marks[f[(k + 1) % 3]] = after;
+    }
+    for (i = 0; i < faces.size(); ++i) {
+        const int *f = &_imesh->faces[faces[i] * 3];
+        for (k = 0; k < 3; ++k)
+            if (f[k] == p)
+                break;
+        int before = f[(k + 2) % 3];
+        if (_marks[before] != after)
+            return true;
+        _marks[before] = both;
+    }
+    for (i = 0; i < faces.size(); ++i) {
+        const int *f = &_imesh->faces[faces[i] * 3];
+        for (k = 0; k < 3; ++k)
+            if (f[k] == p)
+                break;
+        if (_marks[f[(k + 1) % 3]] != both)
+            return true;
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------
+
+bool Decimator::canCollapse(int p0, int p1, const Vector &target)
+{
+    const std::vector<Vector> &points = _imesh->points;
+    const std::vector<int> &faces = _imesh->faces;
+
+    pointFaces(p0, &_faces0);
+    pointFaces(p1, &_faces1);
+
+    // link condition:  the points next to both ends must be exactly
+    // the far corners of the faces on the edge, or the collapse
+    // would pinch the surface
+
+    unsigned int ring0 = nextMark();
+    unsigned int ring1 = nextMark();
+    int shared = 0;
+    int common = 0;
+    unsigned int i;
+    int k;
+    for (i = 0; i < _faces0.size(); ++i) {
+        const int *f = &faces[_faces0[i] * 3];
+        if (f[0] == p1 || f[1] == p1 || f[2] == p1)
+            ++shared;
+        for (k = 0; k < 3; ++k)
+            _marks[f[k]] = ring0;
+    }
+    for (i = 0; i < _faces1.size(); ++i) {
+        const int *f = &faces[_faces1[i] * 3];
+        for (k = 0; k < 3; ++k) {
+            if (f[k] == p0 || f[k] == p1)
+                continue;
+            if (_marks[f[k]] == ring0)
+                ++common;
+            _marks[f[k]] = ring1;
+        }
+    }
+    if (shared == 0 || common != shared)
+        return false;
+
+    // an edge across the surface, between two points on borders,
+    // would pinch the surface as well
+
+    if (shared == 2 && onBorder(p0, _faces0) && onBorder(p1, _faces1))
+        return false;
+
+    // the faces that move must not turn over, or collapse to nothing
+
+    for (int side = 0; side < 2; ++side) {
+        const std::vector<int> &moving = (side == 0 ? _faces0 : _faces1);
+        int p = (side == 0 ? p0 : p1);
+        int other = (side == 0 ? p1 : p0);
+        for (i = 0; i < moving.size(); ++i) {
+            const int *f = &faces[moving[i] * 3];
+            if (f[0] == other || f[1] == other || f[2] == other)
+                continue;                   // on the edge, goes away
+            if (moving[i] >= _numMeshFaces)
+                continue;                   // closes a sliver
+
+            const Vector *v[3];
+            for (k = 0; k < 3; ++k)
+                v[k] = (f[k] == p ? &target : &points[f[k]]);
+
+            double ox, oy, oz, nx, ny, nz;
+            faceNormal(points[f[0]], points[f[1]], points[f[2]],
+                       &ox, &oy, &oz);
+            faceNormal(*v[0], *v[1], *v[2], &nx, &ny, &nz);
+            double olen = sqrt(ox * ox + oy * oy + oz * oz);
+            double nlen = sqrt(nx * nx + ny * ny + nz * nz);
+            if (nlen <= 1e-12 ||
+                ox * nx + oy * ny + oz * nz < MIN_FACE_COSINE * olen * nlen)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void Decimator::collapse(int p0, int p1, const Vector &target)
+{
+    std::vector<int> &faces = _imesh->faces;
+
+    // _faces0 and _faces1 still hold the faces around the two ends
+
+    unsigned int i;
+    for (i = 0; i < _faces1.size(); ++i) {
+        int *f = &faces[_faces1[i] * 3];
+        if (f[0] == p0 || f[1] == p0 || f[2] == p0) {
+            _faceAlive[_faces1[i]] = false;
+            if (_faces1[i] < _numMeshFaces)
+                --_numLiveFaces;
+        } else {
+            for (int k = 0; k < 3; ++k)
+                if (f[k] == p1)
+                    f[k] = p0;
+        }
+    }
+
+    _imesh->points[p0] = target;
+    _quadrics[p0].add(_quadrics[p1]);
+    _pointAlive[p1] = false;
+    ++_stamps[p0];
+    std::swap(_chain[p0], _chain[p1]);
+
+    pointFaces(p0, &_faces0);
+    if ((int)_faces0.size() <= _adjStart[p0 + 1] - _adjStart[p0]) {
+        std::copy(_faces0.begin(), _faces0.end(),
+                  _adjFaces.begin() + _adjStart[p0]);
+        _adjCount[p0] = (int)_faces0.size();
+        _chain[p0] = p0;
+    }
+
+    // queue the edges around the merged point again
+
+    unsigned int ring = nextMark();
+    _marks[p0] = ring;
+    for (i = 0; i < _faces0.size(); ++i) {
+        const int *f = &faces[_faces0[i] * 3];
+        for (int k = 0; k < 3; ++k) {
+            if (_marks[f[k]] != ring) {
+                _marks[f[k]] = ring;
+                pushCollapse(p0, f[k]);
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void Decimator::compact()
+{
+    std::vector<int> &faces = _imesh->faces;
+    std::vector<int> &materials = _imesh->faceMaterials;
+    std::vector<Vector> &points = _imesh->points;
+    std::vector<Vector> &normals = _imesh->normals;
+    std::vector<int> &pointMaterials = _imesh->pointMaterials;
+    bool hasNormals = ((int)normals.size() == _numPoints);
+    bool hasMaterials = ((int)pointMaterials.size() == _numPoints);
+    int i, k;
+
+    // keep the points that live faces still use, in their order
+
+    std::vector<int> remap(_numPoints, -1);
+    for (i = 0; i < _numMeshFaces; ++i)
+        if (_faceAlive[i])
+            for (k = 0; k < 3; ++k)
+                remap[faces[i * 3 + k]] = 0;
+
+    int numPoints = 0;
+    for (i = 0; i < _numPoints; ++i) {
+        if (remap[i] < 0)
+            continue;
+        remap[i] = numPoints;
+        points[numPoints] = points[i];
+        if (hasNormals)
+            normals[numPoints] = normals[i];
+        if (hasMaterials)
+            pointMaterials[numPoints] = pointMaterials[i];
+        ++numPoints;
+    }
+
+    int numFaces = 0;
+    for (i = 0; i < _numMeshFaces; ++i) {
+        if (! _faceAlive[i])
+            continue;
+        for (k = 0; k < 3; ++k)
+            faces[numFaces * 3 + k] = remap[faces[i * 3 + k]];
+        materials[numFaces] = materials[i];
+        ++numFaces;
+    }
+
+    points.resize(numPoints);
+    if (hasNormals)
+        normals.resize(numPoints);
+    if (hasMaterials)
+        pointMaterials.resize(numPoints);
+    faces.resize(numFaces * 3);
+    materials.resize(numFaces);
+}
+
+//----------------------------------------------------------------------------
+
+int Decimator::run(int targetFaces, float maxError)
+{
+    computeQuadrics();
+
+    double maxCost = (double)maxError * (double)maxError;
+
+    while (_numLiveFaces > targetFaces && ! _heap.empty()) {
+        Collapse top = _heap.front();
+        std::pop_heap(_heap.begin(), _heap.end());
+        _heap.pop_back();
+        if (top.cost > maxCost)
+            break;
+
+        // skip entries that an earlier collapse made stale
+        int p0 = top.p0;
+        int p1 = top.p1;
+        if (! _pointAlive[p0] || ! _pointAlive[p1] ||
+            _stamps[p0] + _stamps[p1] != top.stamp)
+            continue;
+
+        Vector target;
+        collapseCost(p0, p1, &target);
+        if (canCollapse(p0, p1, target))
+            collapse(p0, p1, target);
+    }
+
+    compact();
+    return _numLiveFaces;
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh_Opt::getIndexedMesh(const Mesh *mesh, IndexedMesh *imesh)
+{
+    getIndexedMesh(mesh, imesh, 0);
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh_Opt::getIndexedMesh(const Mesh *mesh, IndexedMesh *imesh,
+                              std::vector<const Mesh::MeshPoint *> *mpoints)
+{
+    imesh->points.clear();
+    imesh->normals.clear();
+    imesh->faces.clear();
+    imesh->faceMaterials.clear();
+    imesh->pointMaterials.clear();
+    imesh->materials.clear();
+
+    // number the points along a Morton curve, so points that are near
+    // in space are near in the arrays too
+
+    Vector vmin(1e30f, 1e30f, 1e30f), vmax(-1e30f, -1e30f, -1e30f);
+    Mesh::PointsMap::const_iterator itPoints = mesh->_points.begin();
+    while (itPoints != mesh->_points.end()) {
+        const Vector &v = (*itPoints).second.point;
+        vmin = Vector(THREED_MIN(vmin.x(), v.x()), THREED_MIN(vmin.y(), v.y()),
+                      THREED_MIN(vmin.z(), v.z()));
+        vmax = Vector(THREED_MAX(vmax.x(), v.x()), THREED_MAX(vmax.y(), v.y()),
+                      THREED_MAX(vmax.z(), v.z()));
+        ++itPoints;
+    }
+    Vector extent = vmax - vmin;
+    float size = THREED_MAX(extent.x(), THREED_MAX(extent.y(), extent.z()));
+    float scale = (size > 0.0f ? 1023.0f / size : 0.0f);
+
+    typedef std::pair<unsigned int, const Mesh::MeshPoint *> CodedPoint;
+    std::vector<CodedPoint> coded;
+    coded.reserve(mesh->_points.size());
+    itPoints = mesh->_points.begin();
+    while (itPoints != mesh->_points.end()) {
+        const Mesh::MeshPoint *mpoint = &(*itPoints).second;
+        unsigned int code = mortonCode((mpoint->point - vmin) * scale);
+        coded.push_back(CodedPoint(code, mpoint));
+        ++itPoints;
+    }
+    std::sort(coded.begin(), coded.end());
+
+    int numPoints = (int)coded.size();
+    int i;
+    std::vector<PointRef> refs(numPoints);
+    imesh->points.resize(numPoints);
+    imesh->normals.resize(numPoints);
+    if (mpoints)
+        mpoints->resize(numPoints);
+    for (i = 0; i < numPoints; ++i) {
+        const Mesh::MeshPoint *mpoint = coded[i].second;
+        if (mpoints)
+            (*mpoints)[i] = mpoint;
+        imesh->points[i] = mpoint->point;
+        imesh->normals[i] = mpoint->normal;
+        refs[i].v = &mpoint->point;
+        refs[i].index = i;
+    }
+
+    // faces refer to points by address; sort the addresses, and look
+    // each face corner up by binary search
+
+    std::sort(refs.begin(), refs.end());
+
+    std::vector<int> faces;
+    std::vector<int> materials;
+    std::vector<int> paletteIndex(mesh->_palette.size(), -1);
+    Mesh::PlanesList::const_iterator itPlanes = mesh->_planes.begin();
+    while (itPlanes != mesh->_planes.end()) {
+        const Mesh::FacesList &planeFaces = (*itPlanes).faces;
+        Mesh::FacesList::const_iterator itFaces = planeFaces.begin();
+        while (itFaces != planeFaces.end()) {
+            const MeshFace *face = (*itFaces);
+            ++itFaces;
+
+            for (int k = 0; k < 3; ++k) {
+                PointRef ref;
+                ref.v = face->vertexPtr(k);
+                std::vector<PointRef>::const_iterator it =
+                    std::lower_bound(refs.begin(), refs.end(), ref);
+                faces.push_back((*it).index);
+            }
+
+            // keep only the materials that faces use
+
+            int &index = paletteIndex[face->_material];
+            if (index < 0) {
+                index = (int)imesh->materials.size();
+                imesh->materials.push_back(
+                    mesh->_palette.get(face->_material));
+            }
+            materials.push_back(index);
+        }
+        ++itPlanes;
+    }
+
+    // then those of the points, after those of the faces.  The points
+    // of a mesh without a palette have no material
+
+    if (! paletteIndex.empty()) {
+        imesh->pointMaterials.resize(numPoints);
+        for (i = 0; i < numPoints; ++i) {
+            MaterialPalette::Id id = coded[i].second->material;
+            int &index = paletteIndex[id];
+            if (index < 0) {
+                index = (int)imesh->materials.size();
+                imesh->materials.push_back(mesh->_palette.get(id));
+            }
+            imesh->pointMaterials[i] = index;
+        }
+    }
+
+    // and order the faces by their lowest point
+
+    int numFaces = (int)materials.size();
+    std::vector<std::pair<int, int> > order(numFaces);
+    for (i = 0; i < numFaces; ++i) {
+        const int *f = &faces[i * 3];
+        order[i].first = THREED_MIN(f[0], THREED_MIN(f[1], f[2]));
+        order[i].second = i;
+    }
+    std::sort(order.begin(), order.end());
+
+    imesh->faces.resize(numFaces * 3);
+    imesh->faceMaterials.resize(numFaces);
+    for (i = 0; i < numFaces; ++i) {
+        int f = order[i].second;
+        imesh->faces[i * 3 + 0] = faces[f * 3 + 0];
+        imesh->faces[i * 3 + 1] = faces[f * 3 + 1];
+        imesh->faces[i * 3 + 2] = faces[f * 3 + 2];
+        imesh->faceMaterials[i] = materials[f];
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh_Opt::setIndexedMesh(Mesh *mesh, const IndexedMesh &imesh)
+{
+    // empty the mesh
+
+    Mesh::PlanesList::iterator itPlanes = mesh->_planes.begin();
+    while (itPlanes != mesh->_planes.end()) {
+        Mesh::FacesList &faces = (*itPlanes).faces;
+        while (! faces.empty()) {
+            delete faces.front();
+            faces.pop_front();
+        }
+        ++itPlanes;
+    }
+    mesh->_planes.clear();
+    mesh->_planesIndex.clear();
+    mesh->_points.clear();
+    mesh->_palette.clear();
+    mesh->_boundsCached = false;
+
+    // and fill it again
+
+    int numMaterials = (int)imesh.materials.size();
+    std::vector<MaterialPalette::Id> ids(numMaterials);
+    int i;
+    for (i = 0; i < numMaterials; ++i)
+        ids[i] = mesh->_palette.add(imesh.materials[i]);
+
+    int numPoints = (int)imesh.points.size();
+    bool hasNormals = ((int)imesh.normals.size() == numPoints);
+    bool hasMaterials = ((int)imesh.pointMaterials.size() == numPoints);
+    std::vector<Mesh::MeshPoint *> mpoints(numPoints);
+    for (i = 0; i < numPoints; ++i) {
+        mpoints[i] = mesh->addPoint(imesh.points[i]);
+        if (hasNormals)
+            mpoints[i]->normal = imesh.normals[i];
+        if (hasMaterials)
+            mpoints[i]->material = ids[imesh.pointMaterials[i]];
+    }
+
+    int numFaces = imesh.numFaces();
+    for (i = 0; i < numFaces; ++i) {
+        const int *f = &imesh.faces[i * 3];
+        MeshFace *face = new MeshFace(
+            &mpoints[f[0]]->point, &mpoints[f[1]]->point,
+            &mpoints[f[2]]->point, ids[imesh.faceMaterials[i]]);
+        if (! mesh->addFace(face))
+            delete face;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+int Mesh_Opt::decimate(IndexedMesh *imesh, int targetFaces, float maxError)
+{
+    Decimator decimator(imesh);
+    return decimator.run(targetFaces, maxError);
+}
+
+//----------------------------------------------------------------------------
+
+int Mesh_Opt::decimate(Mesh *mesh, int targetFaces, float maxError)
+{
+    IndexedMesh imesh;
+    getIndexedMesh(mesh, &imesh);
+    int numFaces = decimate(&imesh, targetFaces, maxError);
+    setIndexedMesh(mesh, imesh);
+    return numFaces;
+}
+
+//----------------------------------------------------------------------------
+
+#define STRAIGHT_DISTANCE 1e-4         // limit on a point to be dropped
+#define MIN_FACE_AREA2 2e-7             // with a margin over Mesh::addFace()
+#define GOOD_EAR 0.1                    // shape of ears cut right away
+#define EAR_TRIES 4                     // starting points for cutting ears
+#define LAST_EARS 3                     // corners another start may cut
+#define MIN_PLANE_COSINE 0.999          // faces that turn off their plane
+#define PLANE_GROUP_TOLERANCE 0.02      // planes that may hold one region
+#define MAX_PLANE_DISTANCE 1e-3         // points off the plane of a region
+#define MAX_PINCH_PASSES 4              // faces taken out of pinched regions
+
+namespace {
+
+// a connected set of faces of one plane and one material, the loops
+// of points around it (the outer loop, and one per hole), and the
+// faces that will replace it.  The faces may be held by several mesh
+// planes, each face by the one in @p facePlanes
+
+struct Region {
+    Mesh::MeshPlane *plane;
+    std::vector<MeshFace *> faces;
+    std::vector<Mesh::MeshPlane *> facePlanes;
+    std::vector<std::vector<const Vector *> > loops;
+    std::vector<const Vector *> triangles;  // three points per face
+    bool active;
+};
+
+typedef std::list<Region> RegionsList;
+
+typedef std::vector<Mesh::MeshPlane *> PlaneGroup;
+
+struct PlaneCell {
+    long k[4];
+
+    bool operator<(const PlaneCell &other) const
+    {
+        for (int i = 0; i < 4; ++i)
+            if (k[i] != other.k[i])
+                return (k[i] < other.k[i]);
+        return false;
+    }
+};
+
+struct PointEdge {
+    const Vector *p0, *p1;
+    int face;
+
+    bool operator<(const PointEdge &other) const
+    {
+        if (p0 != other.p0)
+            return (p0 < other.p0);
+        return (p1 < other.p1);
+    }
+};
+
+// the loops that pass by a point on the boundary of regions
+
+struct LoopPoint {
+    int uses;                           // times on a loop
+    int regionFaces;                    // faces in regions
+    const Vector *n0, *n1;              // neighbors on the first loop
+    bool straight;                      // on a line with the neighbors
+};
+
+typedef std::map<const Vector *, LoopPoint> LoopPointsMap;
+
+inline bool sameMaterial(const MeshFace *f0, const MeshFace *f1)
+{
+    return (f0->_material == f1->_material);
+}
+
+inline int findRoot(std::vector<int> &parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+inline bool pointBefore(const Vector &v0, const Vector &v1)
+{
+    if (v0.x() != v1.x())
+        return (v0.x() < v1.x());
+    if (v0.y() != v1.y())
+        return (v0.y() < v1.y());
+    return (v0.z() < v1.z());
+}
+
+inline bool isStraight(const Vector &v0, const Vector &v1, const Vector &v2)
+{
+    Vector u = v1 - v0;
+    Vector w = v2 - v1;
+    if ((float)(u * w) <= 0.0f)
+        return false;
+    double length = (v2 - v0).length();
+    return ((u % w).length() <= STRAIGHT_DISTANCE * length);
+}
+
+// project @p v onto the plane of axes other than @p axis
+
+inline void project(const Vector &v, int axis, bool mirror,
+                    double *x, double *y)
+{
+    double u = (axis == 0 ? v.y() : axis == 1 ? v.z() : v.x());
+    *x = (mirror ? -u : u);
+    *y = (axis == 0 ? v.z() : axis == 1 ? v.x() : v.y());
+}
+
+// twice the signed area of 2D triangle (a, b, c)
+
+inline double cross2(const std::vector<double> &x, const std::vector<double> &y,
+                     int a, int b, int c)
+{
+    return ((x[b] - x[a]) * (y[c] - y[a]) - (y[b] - y[a]) * (x[c] - x[a]));
+}
+
+//----------------------------------------------------------------------------
+
+// group the planes of a mesh that are the same within
+// PLANE_GROUP_TOLERANCE in each coefficient.  The faces of a flat side
+// that is not on an axis plane are spread over many mesh planes, as
+// the plane of a thin face is known only roughly.  Planes are taken
+// by their number of faces, then by their order in the mesh, so each
+// group is led by the plane known best
+
+void groupPlanes(Mesh::PlanesList *planes, std::vector<PlaneGroup> *groups)
+{
+    std::vector<Mesh::MeshPlane *> mplanes;
+    std::vector<std::pair<int, int> > order;
+    Mesh::PlanesList::iterator itPlanes = planes->begin();
+    while (itPlanes != planes->end()) {
+        Mesh::MeshPlane *mplane = &(*itPlanes);
+        ++itPlanes;
+        if (mplane->faces.empty())
+            continue;
+        order.push_back(std::pair<int, int>(
+            -(int)mplane->faces.size(), (int)mplanes.size()));
+        mplanes.push_back(mplane);
+    }
+    std::sort(order.begin(), order.end());
+
+    // as in Mesh::addPlane(), a leader within the tolerance is in the
+    // same cell or the nearer neighbor in each coefficient
+
+    std::multimap<PlaneCell, int> leaders;
+    for (unsigned int i = 0; i < order.size(); ++i) {
+        Mesh::MeshPlane *mplane = mplanes[order[i].second];
+        const Plane &p = mplane->p;
+        double coeffs[4] = { p.a(), p.b(), p.c(), p.d() };
+        PlaneCell cell;
+        long side[4];
+        int k;
+        for (k = 0; k < 4; ++k) {
+            double f = coeffs[k] / (2.0 * PLANE_GROUP_TOLERANCE);
+            cell.k[k] = (long)floor(f);
+            side[k] = (f - cell.k[k] < 0.5) ? -1 : 1;
+        }
+
+        int group = -1;
+        for (int probe = 0; probe < 16 && group < 0; ++probe) {
+            PlaneCell probeCell = cell;
+            for (k = 0; k < 4; ++k)
+                if (probe & (1 << k))
+                    probeCell.k[k] += side[k];
+            std::multimap<PlaneCell, int>::const_iterator it =
+                leaders.lower_bound(probeCell);
+            std::multimap<PlaneCell, int>::const_iterator it1 =
+                leaders.upper_bound(probeCell);
+            for (; it != it1 && group < 0; ++it) {
+                const Plane &q = (*groups)[(*it).second][0]->p;
+                if (fabs(p.a() - q.a()) < PLANE_GROUP_TOLERANCE &&
+                    fabs(p.b() - q.b()) < PLANE_GROUP_TOLERANCE &&
+                    fabs(p.c() - q.c()) < PLANE_GROUP_TOLERANCE &&
+                    fabs(p.d() - q.d()) < PLANE_GROUP_TOLERANCE)
+                    group = (*it).second;
+            }
+        }
+
+        if (group < 0) {
+            group = (int)groups->size();
+            groups->push_back(PlaneGroup());
+            leaders.insert(std::pair<const PlaneCell, int>(cell, group));
+        }
+        (*groups)[group].push_back(mplane);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// join faces of @p mplane, each held by a plane in @p facePlanes,
+// across the edges they share into regions, and find their loops
+
+void joinFaces(Mesh::MeshPlane *mplane, const std::vector<MeshFace *> &faces,
+               const std::vector<Mesh::MeshPlane *> &facePlanes,
+               RegionsList *regions)
+{
+    int numFaces = (int)faces.size();
+    if (numFaces < 2)
+        return;
+
+    // faces that turn the other way, on the back of a thin wall, are
+    // not joined to the others
+
+    const Plane &p = mplane->p;
+    std::vector<bool> reversed(numFaces);
+    int i, k;
+    for (i = 0; i < numFaces; ++i) {
+        double nx, ny, nz;
+        faceNormal(faces[i]->vertex(0), faces[i]->vertex(1),
+                   faces[i]->vertex(2), &nx, &ny, &nz);
+        reversed[i] = (nx * p.a() + ny * p.b() + nz * p.c() < 0.0);
+    }
+
+    int numEdges = numFaces * 3;
+    std::vector<PointEdge> edges(numEdges);
+    for (i = 0; i < numFaces; ++i) {
+        for (k = 0; k < 3; ++k) {
+            PointEdge &e = edges[i * 3 + k];
+            e.p0 = faces[i]->vertexPtr(k);
+            e.p1 = faces[i]->vertexPtr((k + 1) % 3);
+            e.face = i;
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    // the reverse of each edge, among the faces of the same material
+    // that turn the same way
+
+    std::vector<std::vector<int> > reverses(numEdges);
+    for (i = 0; i < numEdges; ++i) {
+        const PointEdge &e = edges[i];
+        PointEdge reverse;
+        reverse.p0 = e.p1;
+        reverse.p1 = e.p0;
+        std::vector<PointEdge>::const_iterator it =
+            std::lower_bound(edges.begin(), edges.end(), reverse);
+        while (it != edges.end() &&
+                    (*it).p0 == e.p1 && (*it).p1 == e.p0) {
+            if (sameMaterial(faces[e.face], faces[(*it).face]) &&
+                        reversed[e.face] == reversed[(*it).face])
+                reverses[i].push_back((int)(it - edges.begin()));
+            ++it;
+        }
+    }
+
+    // join the faces across the edges they share.  a point that
+    // starts two edges of the border of a set pinches it; the ragged
+    // side of a flat region does that where it meets the next side.
+    // take the faces at such points out, and join the rest again
+
+    std::vector<bool> kept(numFaces, true);
+    std::vector<int> parent(numFaces);
+    std::vector<int> sizes(numFaces);
+    std::map<int, std::vector<PointEdge> > borders;
+    std::set<int> pinched;
+    for (int pass = 0; ; ++pass) {
+        for (i = 0; i < numFaces; ++i) {
+            parent[i] = i;
+            sizes[i] = 0;
+        }
+        for (i = 0; i < numEdges; ++i) {
+            if (! kept[edges[i].face])
+                continue;
+            for (k = 0; k < (int)reverses[i].size(); ++k) {
+                int face = edges[reverses[i][k]].face;
+                if (kept[face])
+                    parent[findRoot(parent, face)] =
+                        findRoot(parent, edges[i].face);
+            }
+        }
+        for (i = 0; i < numFaces; ++i)
+            if (kept[i])
+                ++sizes[findRoot(parent, i)];
+
+        // the edges without a reverse in the same set make its
+        // border.  edges are visited in order, so the lists stay
+        // sorted
+
+        borders.clear();
+        for (i = 0; i < numEdges; ++i) {
+            const PointEdge &e = edges[i];
+            if (! kept[e.face])
+                continue;
+            int r = findRoot(parent, e.face);
+            if (sizes[r] < 2)
+                continue;
+            bool inner = false;
+            for (k = 0; k < (int)reverses[i].size() && ! inner; ++k) {
+                int face = edges[reverses[i][k]].face;
+                inner = (kept[face] && findRoot(parent, face) == r);
+            }
+            if (! inner)
+                borders[r].push_back(e);
+        }
+
+        std::set<std::pair<int, const Vector *> > pinches;
+        std::map<int, std::vector<PointEdge> >::const_iterator itBorders;
+        for (itBorders = borders.begin(); itBorders != borders.end();
+                    ++itBorders) {
+            const std::vector<PointEdge> &border = (*itBorders).second;
+            for (k = 1; k < (int)border.size(); ++k)
+                if (border[k].p0 == border[k - 1].p0)
+                    pinches.insert(std::pair<int, const Vector *>(
+                        (*itBorders).first, border[k].p0));
+        }
+        if (pinches.empty())
+            break;
+        if (pass == MAX_PINCH_PASSES) {
+            std::set<std::pair<int, const Vector *> >::const_iterator it;
+            for (it = pinches.begin(); it != pinches.end(); ++it)
+                pinched.insert((*it).first);
+            break;
+        }
+        for (i = 0; i < numEdges; ++i) {
+            const PointEdge &e = edges[i];
+            if (kept[e.face] && pinches.find(
+                        std::pair<int, const Vector *>(
+                            findRoot(parent, e.face), e.p0)) !=
+                        pinches.end())
+                kept[e.face] = false;
+        }
+    }
+
+    // make a region of each set of two or more faces, and walk its
+    // border into loops
+
+    std::map<int, Region *> regionOf;
+    for (i = 0; i < numFaces; ++i) {
+        if (! kept[i])
+            continue;
+        int r = findRoot(parent, i);
+        if (sizes[r] < 2)
+            continue;
+        Region *&region = regionOf[r];
+        if (! region) {
+            regions->push_back(Region());
+            region = &regions->back();
+            region->plane = mplane;
+            region->active = (pinched.find(r) == pinched.end());
+        }
+        region->faces.push_back(faces[i]);
+        region->facePlanes.push_back(facePlanes[i]);
+    }
+
+    std::map<int, std::vector<PointEdge> >::iterator itBorders =
+        borders.begin();
+    while (itBorders != borders.end()) {
+        Region *region = regionOf[(*itBorders).first];
+        std::vector<PointEdge> &border = (*itBorders).second;
+        ++itBorders;
+        if (! region->active)
+            continue;
+
+        int n = (int)border.size();
+        std::vector<bool> used(n, false);
+        for (k = 0; k < n && region->active; ++k) {
+            if (used[k])
+                continue;
+            region->loops.push_back(std::vector<const Vector *>());
+            std::vector<const Vector *> &loop = region->loops.back();
+            int j = k;
+            while (! used[j]) {
+                used[j] = true;
+                loop.push_back(border[j].p0);
+                PointEdge next;
+                next.p0 = border[j].p1;
+                next.p1 = 0;
+                std::vector<PointEdge>::const_iterator it =
+                    std::lower_bound(border.begin(), border.end(), next);
+                if (it == border.end() || (*it).p0 != next.p0) {
+                    region->active = false;
+                    break;
+                }
+                j = (int)(it - border.begin());
+            }
+            if (j != k)
+                region->active = false;
+
+            // start the loop at its least point, so the faces cut
+            // from it do not hang on where the points are in memory
+
+            int first = 0;
+            for (j = 1; j < (int)loop.size(); ++j)
+                if (pointBefore(*loop[j], *loop[first]))
+                    first = j;
+            std::rotate(loop.begin(), loop.begin() + first, loop.end());
+        }
+    }
+}
+
+// split the faces of a group of planes into regions
+
+void findRegions(const PlaneGroup &group, RegionsList *regions)
+{
+    // planes are matched with some tolerance, so a thin face may be
+    // held by a plane it is not really in; leave out faces that turn
+    // off the plane that leads the group
+
+    Mesh::MeshPlane *mplane = group[0];
+    const Plane &p = mplane->p;
+    double plength = sqrt(p.a() * p.a() + p.b() * p.b() + p.c() * p.c());
+    std::vector<MeshFace *> faces;
+    std::vector<Mesh::MeshPlane *> facePlanes;
+    double sx = 0.0, sy = 0.0, sz = 0.0;
+    double cx = 0.0, cy = 0.0, cz = 0.0, weight = 0.0;
+    unsigned int g;
+    int i, k;
+    for (g = 0; g < group.size(); ++g) {
+        Mesh::FacesList::const_iterator itFaces = group[g]->faces.begin();
+        while (itFaces != group[g]->faces.end()) {
+            MeshFace *face = (*itFaces);
+            ++itFaces;
+            double nx, ny, nz;
+            faceNormal(face->vertex(0), face->vertex(1), face->vertex(2),
+                       &nx, &ny, &nz);
+            double dot = nx * p.a() + ny * p.b() + nz * p.c();
+            double area = sqrt(nx * nx + ny * ny + nz * nz);
+            if (fabs(dot) < MIN_PLANE_COSINE * area * plength)
+                continue;
+            faces.push_back(face);
+            facePlanes.push_back(group[g]);
+
+            // a face may turn the other way, on the back of a thin wall
+            double sign = (dot < 0.0 ? -1.0 : 1.0);
+            Vector center = (face->vertex(0) + face->vertex(1) +
+                             face->vertex(2)) * (1.0f / 3.0f);
+            sx += nx * sign;
+            sy += ny * sign;
+            sz += nz * sign;
+            cx += center.x() * area;
+            cy += center.y() * area;
+            cz += center.z() * area;
+            weight += area;
+        }
+    }
+    if (faces.size() < 2 || weight <= 0.0)
+        return;
+
+    // the plane of a mesh is that of the first face it was made for,
+    // which is only as good as the tolerance.  Fit the plane to the
+    // faces, weighted by their area, and leave out the faces with a
+    // point off it
+
+    double slength = sqrt(sx * sx + sy * sy + sz * sz);
+    if (slength <= 0.0)
+        return;
+    double fa = sx / slength, fb = sy / slength, fc = sz / slength;
+    double fd = -(fa * cx + fb * cy + fc * cz) / weight;
+    int numCandidates = (int)faces.size();
+    int numFaces = 0;
+    for (i = 0; i < numCandidates; ++i) {
+        bool off = false;
+        for (k = 0; k < 3 && ! off; ++k) {
+            const Vector &v = faces[i]->vertex(k);
+            double d = v.x() * fa + v.y() * fb + v.z() * fc + fd;
+            off = (fabs(d) > MAX_PLANE_DISTANCE);
+        }
+        if (off)
+            continue;
+        faces[numFaces] = faces[i];
+        facePlanes[numFaces] = facePlanes[i];
+        ++numFaces;
+    }
+    faces.resize(numFaces);
+    facePlanes.resize(numFaces);
+    joinFaces(mplane, faces, facePlanes, regions);
+}
+
+// split a region of a group of planes into regions of one plane.
+// fails if its faces are all held by one plane
+
+bool splitRegion(const Region &region, RegionsList *regions)
+{
+    std::vector<Mesh::MeshPlane *> planes;
+    unsigned int i, k;
+    for (i = 0; i < region.facePlanes.size(); ++i) {
+        Mesh::MeshPlane *mplane = region.facePlanes[i];
+        if (std::find(planes.begin(), planes.end(), mplane) == planes.end())
+            planes.push_back(mplane);
+    }
+    if (planes.size() < 2)
+        return false;
+
+    for (k = 0; k < planes.size(); ++k) {
+        std::vector<MeshFace *> faces;
+        for (i = 0; i < region.faces.size(); ++i)
+            if (region.facePlanes[i] == planes[k])
+                faces.push_back(region.faces[i]);
+        std::vector<Mesh::MeshPlane *> facePlanes(faces.size(), planes[k]);
+        joinFaces(planes[k], faces, facePlanes, regions);
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+// find the points that can be dropped from the loops:  points that are
+// on a straight line, with the same neighbors, on every loop that they
+// are on, and whose faces are all in regions being merged
+
+void findStraightPoints(const RegionsList &regions,
+                        std::set<const Vector *> *points)
+{
+    LoopPointsMap loopPoints;
+
+    RegionsList::const_iterator it = regions.begin();
+    while (it != regions.end()) {
+        const Region &region = (*it);
+        ++it;
+        if (! region.active)
+            continue;
+        for (unsigned int i = 0; i < region.loops.size(); ++i) {
+            const std::vector<const Vector *> &loop = region.loops[i];
+            int n = (int)loop.size();
+            for (int k = 0; k < n; ++k) {
+                const Vector *v0 = loop[(k + n - 1) % n];
+                const Vector *v1 = loop[k];
+                const Vector *v2 = loop[(k + 1) % n];
+                bool straight = isStraight(*v0, *v1, *v2);
+                LoopPointsMap::iterator itPoint = loopPoints.find(v1);
+                if (itPoint == loopPoints.end()) {
+                    LoopPoint lp;
+                    lp.uses = 1;
+                    lp.regionFaces = 0;
+                    lp.n0 = v0;
+                    lp.n1 = v2;
+                    lp.straight = straight;
+                    loopPoints[v1] = lp;
+                } else {
+                    LoopPoint &lp = (*itPoint).second;
+                    ++lp.uses;
+                    if (! ((lp.n0 == v0 && lp.n1 == v2) ||
+                           (lp.n0 == v2 && lp.n1 == v0)))
+                        straight = false;
+                    lp.straight = (lp.straight && straight);
+                }
+            }
+        }
+    }
+
+    it = regions.begin();
+    while (it != regions.end()) {
+        const Region &region = (*it);
+        ++it;
+        if (! region.active)
+            continue;
+        for (unsigned int i = 0; i < region.faces.size(); ++i) {
+            for (int k = 0; k < 3; ++k) {
+                LoopPointsMap::iterator itPoint =
+                    loopPoints.find(region.faces[i]->vertexPtr(k));
+                if (itPoint != loopPoints.end())
+                    ++(*itPoint).second.regionFaces;
+            }
+        }
+    }
+
+    points->clear();
+    LoopPointsMap::const_iterator itPoint = loopPoints.begin();
+    while (itPoint != loopPoints.end()) {
+        const Mesh::MeshPoint *mpoint =
+            (const Mesh::MeshPoint *)(*itPoint).first;
+        const LoopPoint &lp = (*itPoint).second;
+        if (lp.straight && lp.regionFaces == (int)mpoint->faces.size())
+            points->insert((*itPoint).first);
+        ++itPoint;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// is direction a -> b inside the polygon, at its corner a
+
+bool locallyInside(const std::vector<double> &x, const std::vector<double> &y,
+                   int prev, int a, int next, int b)
+{
+    if (cross2(x, y, prev, a, next) >= 0.0)
+        return (cross2(x, y, a, next, b) >= 0.0 &&
+                cross2(x, y, a, b, prev) >= 0.0);
+    return (cross2(x, y, a, prev, b) <= 0.0 ||
+            cross2(x, y, a, b, next) <= 0.0);
+}
+
+bool inTriangle(const std::vector<double> &x, const std::vector<double> &y,
+                int a, int b, int c, int p)
+{
+    return (cross2(x, y, a, b, p) >= 0.0 &&
+            cross2(x, y, b, c, p) >= 0.0 &&
+            cross2(x, y, c, a, p) >= 0.0);
+}
+
+// join hole @p hole to polygon @p poly, through a bridge from the
+// rightmost point of the hole to a point of the polygon that it sees
+
+bool bridgeHole(const std::vector<double> &x, const std::vector<double> &y,
+                std::vector<int> *poly, const std::vector<int> &hole)
+{
+    int m = 0;
+    int h = (int)hole.size();
+    int k;
+    for (k = 1; k < h; ++k)
+        if (x[hole[k]] > x[hole[m]])
+            m = k;
+    int pm = hole[m];
+    double mx = x[pm], my = y[pm];
+
+    // cast a ray to the right, and find the edge it meets first.
+    // the edges that face the hole go up, as the polygon is CCW
+
+    std::vector<int> &p = *poly;
+    int n = (int)p.size();
+    int best = -1;
+    int edge0 = 0, edge1 = 0;
+    double bestX = 1e300;
+    for (k = 0; k < n; ++k) {
+        int a = p[k];
+        int b = p[(k + 1) % n];
+        if (y[a] > my || y[b] < my || y[a] == y[b])
+            continue;
+        double ix = x[a] + (my - y[a]) * (x[b] - x[a]) / (y[b] - y[a]);
+        if (ix < mx || ix >= bestX)
+            continue;
+        bestX = ix;
+        edge0 = a;
+        edge1 = b;
+        best = (x[a] > x[b] ? k : (k + 1) % n);
+    }
+    if (best < 0)
+        return false;
+
+    // a corner inside the triangle of the hole point, the ray hit,
+    // and the chosen end of the edge would hide that end; take the
+    // corner closest in angle to the ray instead
+
+    double px = x[p[best]], py = y[p[best]];
+    double bestTan = -1.0;
+    for (k = 0; k < n; ++k) {
+        int c = p[k];
+        double cx = x[c], cy = y[c];
+        if (cx < mx || cx > px || (cx == px && cy == py) || cx == mx)
+            continue;
+        bool inside;
+        if (py >= my)
+            inside = (cy >= my && (cx - mx) * (py - my) >= (cy - my) * (px - mx));
+        else
+            inside = (cy <= my && (cx - mx) * (my - py) >= (my - cy) * (px - mx));
+        if (! inside || cross2(x, y, edge0, edge1, c) < 0.0)
+            continue;
+        double t = fabs(cy - my) / (cx - mx);
+        int prev = p[(k + n - 1) % n];
+        int next = p[(k + 1) % n];
+        if ((bestTan < 0.0 || t < bestTan) &&
+                locallyInside(x, y, prev, c, next, pm)) {
+            bestTan = t;
+            best = k;
+        }
+    }
+
+    // splice:  ... p[best], hole[m] ... hole[m - 1], hole[m], p[best] ...
+
+    std::vector<int> bridge;
+    bridge.reserve(h + 2);
+    for (k = 0; k <= h; ++k)
+        bridge.push_back(hole[(m + k) % h]);
+    bridge.push_back(p[best]);
+    p.insert(p.begin() + best + 1, bridge.begin(), bridge.end());
+    return true;
+}
+
+// cut ears off CCW polygon @p poly, from corner @p start on, into
+// @p triangles.  ears smaller than @p minArea are not cut.  returns the
+// number of corners left where no ear can be cut, or 0
+
+int clipEars(const std::vector<double> &x, const std::vector<double> &y,
+             const std::vector<const Vector *> &points,
+             const std::vector<int> &poly, int start, double minArea,
+             std::vector<int> *triangles)
+{
+    int n = (int)poly.size();
+    std::vector<int> prev(n), next(n);
+    int k;
+    for (k = 0; k < n; ++k) {
+        prev[k] = (k + n - 1) % n;
+        next[k] = (k + 1) % n;
+    }
+
+    // walk around the polygon, and cut the first ear of a good shape.
+    // after a full turn without one, cut the best ear seen
+
+    int count = n;
+    int i = start;
+    int stall = 0;
+    int bestEar = -1;
+    double bestShape = 0.0;
+    while (count >= 3) {
+        int a = poly[prev[i]], b = poly[i], c = poly[next[i]];
+        bool ear = (cross2(x, y, a, b, c) > 0.0);
+        double shape = 0.0;
+        if (ear) {
+            Vector u = *points[b] - *points[a];
+            Vector v = *points[c] - *points[b];
+            Vector w = *points[c] - *points[a];
+            double area = (u % w).length() * 0.5;
+            double edges = (float)(u * u) + (float)(v * v) + (float)(w * w);
+            shape = 4.0 * sqrt(3.0) * area / edges;
+            ear = (area >= minArea &&
+                   (shape >= GOOD_EAR || shape > bestShape));
+        }
+        if (ear && count > 3) {
+            for (k = next[next[i]]; k != prev[i]; k = next[k]) {
+                int p = poly[k];
+                if (p == a || p == b || p == c)
+                    continue;
+                if (inTriangle(x, y, a, b, c, p)) {
+                    ear = false;
+                    break;
+                }
+            }
+        }
+
+        if (ear && shape < GOOD_EAR) {
+            bestEar = i;
+            bestShape = shape;
+            ear = false;
+        }
+        if (! ear && ++stall > count) {
+            if (bestEar < 0)
+                return count;
+            i = bestEar;
+            a = poly[prev[i]];
+            c = poly[next[i]];
+            ear = true;
+        }
+
+        if (ear) {
+            triangles->push_back(a);
+            triangles->push_back(poly[i]);
+            triangles->push_back(c);
+            next[prev[i]] = next[i];
+            prev[next[i]] = prev[i];
+            --count;
+            i = prev[i];
+            stall = 0;
+            bestEar = -1;
+            bestShape = 0.0;
+        } else
+            i = next[i];
+    }
+    return 0;
+}
+
+// compute the faces that replace a region, without the points in
+// @p dropped.  fails if the loops cannot be triangulated, or if
+// that would not make fewer faces
+
+bool triangulate(Region *region, const std::set<const Vector *> &dropped)
+{
+    region->triangles.clear();
+
+    // number the points, and count the loops that lose points
+
+    std::vector<const Vector *> points;
+    std::vector<std::vector<int> > loops;
+    int numDropped = 0;
+    unsigned int i;
+    for (i = 0; i < region->loops.size(); ++i) {
+        const std::vector<const Vector *> &loop = region->loops[i];
+        loops.push_back(std::vector<int>());
+        for (unsigned int k = 0; k < loop.size(); ++k) {
+            if (dropped.find(loop[k]) != dropped.end()) {
+                ++numDropped;
+                continue;
+            }
+            loops.back().push_back((int)points.size());
+            points.push_back(loop[k]);
+        }
+        if (loops.back().size() < 3)
+            return false;
+    }
+
+    // a region with n points on its loops, and h holes, takes
+    // n + 2h - 2 faces
+
+    int numLoops = (int)loops.size();
+    int numFaces = (int)points.size() + 2 * numLoops - 4;
+    if (numFaces >= (int)region->faces.size())
+        return false;
+
+    // project the points onto the axis plane nearest to the region,
+    // mirrored if needed so the faces turn counter-clockwise
+
+    double nx = 0.0, ny = 0.0, nz = 0.0;
+    for (i = 0; i < region->faces.size(); ++i) {
+        const MeshFace *face = region->faces[i];
+        double fx, fy, fz;
+        faceNormal(face->vertex(0), face->vertex(1), face->vertex(2),
+                   &fx, &fy, &fz);
+        nx += fx;
+        ny += fy;
+        nz += fz;
+    }
+    int axis = 2;
+    double sign = nz;
+    if (fabs(nx) >= fabs(ny) && fabs(nx) >= fabs(nz)) {
+        axis = 0;
+        sign = nx;
+    } else if (fabs(ny) >= fabs(nz)) {
+        axis = 1;
+        sign = ny;
+    }
+
+    bool mirror = (sign < 0.0);
+
+    // faces that fold over others make no polygon
+
+    double faceArea = 0.0;
+    for (i = 0; i < region->faces.size(); ++i) {
+        double fx[3], fy[3];
+        for (int k = 0; k < 3; ++k)
+            project(region->faces[i]->vertex(k), axis, mirror, &fx[k], &fy[k]);
+        double area = (fx[1] - fx[0]) * (fy[2] - fy[0])
+                    - (fy[1] - fy[0]) * (fx[2] - fx[0]);
+        if (area <= 0.0)
+            return false;
+        faceArea += area;
+    }
+
+    int numPoints = (int)points.size();
+    std::vector<double> x(numPoints), y(numPoints);
+    for (int k = 0; k < numPoints; ++k)
+        project(*points[k], axis, mirror, &x[k], &y[k]);
+
+    // the one loop that turns counter-clockwise is the outer loop.
+    // the loops hold as much area as the faces, unless faces overlap;
+    // measure them with all their points, as a dropped point may be
+    // a little off the line of its neighbors
+
+    int outer = -1;
+    double loopArea = 0.0;
+    std::vector<std::pair<double, int> > holes;
+    int l;
+    for (l = 0; l < numLoops; ++l) {
+        const std::vector<int> &loop = loops[l];
+        int n = (int)loop.size();
+        double area = 0.0;
+        double maxX = -1e300;
+        for (int k = 0; k < n; ++k) {
+            int a = loop[k], b = loop[(k + 1) % n];
+            area += x[a] * y[b] - x[b] * y[a];
+            maxX = THREED_MAX(maxX, x[a]);
+        }
+        const std::vector<const Vector *> &full = region->loops[l];
+        int m = (int)full.size();
+        for (int k = 0; k < m; ++k) {
+            double ax, ay, bx, by;
+            project(*full[k], axis, mirror, &ax, &ay);
+            project(*full[(k + 1) % m], axis, mirror, &bx, &by);
+            loopArea += ax * by - bx * ay;
+        }
+        if (area > 0.0) {
+            if (outer >= 0)
+                return false;
+            outer = l;
+        } else
+            holes.push_back(std::pair<double, int>(-maxX, l));
+    }
+    if (outer < 0 || fabs(loopArea - faceArea) > 1e-3 * faceArea)
+        return false;
+
+    // join the holes, rightmost first, and cut ears
+
+    std::vector<int> poly = loops[outer];
+    std::sort(holes.begin(), holes.end());
+    for (i = 0; i < holes.size(); ++i)
+        if (! bridgeHole(x, y, &poly, loops[holes[i].second]))
+            return false;
+
+    // cutting ears greedily may leave the last faces too thin to keep;
+    // if so, start somewhere else.  a polygon stuck with more corners
+    // left, as around a narrow hole, is stuck from any start
+
+    std::vector<int> triangles;
+    int n = (int)poly.size();
+    int tries = THREED_MIN(n, EAR_TRIES);
+    int left = 0;
+    for (int t = 0; t < tries; ++t) {
+        triangles.clear();
+        left = clipEars(x, y, points, poly, t * n / tries,
+                        sqrt(MIN_FACE_AREA2), &triangles);
+        if (left == 0 || left > LAST_EARS)
+            break;
+    }
+    if (left > 0)
+        return false;
+    if ((int)triangles.size() / 3 >= (int)region->faces.size())
+        return false;
+
+    region->triangles.resize(triangles.size());
+    for (i = 0; i < triangles.size(); ++i)
+        region->triangles[i] = points[triangles[i]];
+    return true;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+
+int Mesh_Opt::mergeCoplanarFaces(Mesh *mesh)
+{
+    RegionsList regions;
+    std::vector<PlaneGroup> groups;
+    groupPlanes(&mesh->_planes, &groups);
+    for (unsigned int g = 0; g < groups.size(); ++g)
+        findRegions(groups[g], &regions);
+
+    // a region that fails keeps its faces, and so all the points on
+    // its loops; which may keep points in the loops of its neighbors.
+    // repeat until all the remaining regions are triangulated.  the
+    // faces of a group of planes may fail as one region where those
+    // of each plane would not, as around the thin holes in a side
+    // meshed by MC; try those by plane
+
+    std::set<const Vector *> dropped;
+    RegionsList::iterator it;
+    bool failed = true;
+    while (failed) {
+        findStraightPoints(regions, &dropped);
+        failed = false;
+        it = regions.begin();
+        while (it != regions.end()) {
+            RegionsList::iterator itRegion = it;
+            Region &region = (*it);
+            ++it;
+            if (region.active && ! triangulate(&region, dropped)) {
+                if (splitRegion(region, &regions))
+                    regions.erase(itRegion);
+                else
+                    region.active = false;
+                failed = true;
+            }
+        }
+    }
+
+    // add the new faces before removing the old ones, so the points
+    // on the loops stay in the mesh
+
+    std::map<Mesh::MeshPlane *, std::set<MeshFace *> > oldFaces;
+    it = regions.begin();
+    while (it != regions.end()) {
+        Region &region = (*it);
+        ++it;
+        if (! region.active)
+            continue;
+        const MeshFace *model = region.faces.front();
+        for (unsigned int i = 0; i < region.triangles.size(); i += 3) {
+            MeshFace *face = new MeshFace(
+                region.triangles[i], region.triangles[i + 1],
+                region.triangles[i + 2], model->_material);
+            if (! mesh->addFace(face, region.plane))
+                delete face;
+        }
+        for (unsigned int i = 0; i < region.faces.size(); ++i)
+            oldFaces[region.facePlanes[i]].insert(region.faces[i]);
+    }
+
+    std::map<Mesh::MeshPlane *, std::set<MeshFace *> >::const_iterator
+        itOld = oldFaces.begin();
+    while (itOld != oldFaces.end()) {
+        mesh->removeFaces((*itOld).second, (*itOld).first);
+        ++itOld;
+    }
+
+    int numFaces = 0;
+    Mesh::PlanesList::iterator itPlanes = mesh->_planes.begin();
+    while (itPlanes != mesh->_planes.end()) {
+        numFaces += (int)(*itPlanes).faces.size();
+        ++itPlanes;
+    }
+    return numFaces;
+}
+
+//----------------------------------------------------------------------------
+
+bool Mesh_Opt::triangulateLoop(const std::vector<const Vector *> &loop,
+                               int axis,
+                               std::vector<const Vector *> *triangles)
+{
+    // a loop that passes a point twice keeps one number for it, so
+    // clipEars() sees the two corners as the same point
+
+    std::vector<const Vector *> points;
+    std::map<const Vector *, int> numbers;
+    std::vector<int> poly;
+    unsigned int i;
+    for (i = 0; i < loop.size(); ++i) {
+        std::map<const Vector *, int>::iterator it = numbers.find(loop[i]);
+        if (it == numbers.end()) {
+            it = numbers.insert(
+                std::make_pair(loop[i], (int)points.size())).first;
+            points.push_back(loop[i]);
+        }
+        poly.push_back((*it).second);
+    }
+    int n = (int)poly.size();
+    if (n < 3)
+        return false;
+
+    // mirror the projection of a clockwise loop, so clipEars() sees it
+    // turn counter-clockwise, and the faces keep the turn of the loop
+
+    int numPoints = (int)points.size();
+    std::vector<double> x(numPoints), y(numPoints);
+    int k;
+    for (k = 0; k < numPoints; ++k)
+        project(*points[k], axis, false, &x[k], &y[k]);
+    double loopArea = 0.0;
+    for (k = 0; k < n; ++k) {
+        int a = poly[k], b = poly[(k + 1) % n];
+        loopArea += x[a] * y[b] - x[b] * y[a];
+    }
+    if (loopArea == 0.0)
+        return false;
+    if (loopArea < 0.0) {
+        for (k = 0; k < numPoints; ++k)
+            x[k] = -x[k];
+        loopArea = -loopArea;
+    }
+
+    std::vector<int> faces;
+    int tries = THREED_MIN(n, EAR_TRIES);
+    bool clipped = false;
+    for (int t = 0; t < tries && ! clipped; ++t) {
+        faces.clear();
+        clipped = (clipEars(x, y, points, poly, t * n / tries, 0.0,
+                            &faces) == 0);
+    }
+    if (! clipped)
+        return false;
+
+    // on a loop that crosses itself, the ears overlap, and cover more
+    // than the area it encloses
+
+    double faceArea = 0.0;
+    for (i = 0; i < faces.size(); i += 3)
+        faceArea += cross2(x, y, faces[i], faces[i + 1], faces[i + 2]);
+    if (fabs(faceArea - loopArea) > 1e-3 * loopArea)
+        return false;
+
+    for (i = 0; i < faces.size(); ++i)
+        triangles->push_back(points[faces[i]]);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+// a weighted sum of face normals
+
+struct NormalSum {
+    float x, y, z, w;
+};
+
+// working state of computeNormals()
+
+class NormalPass
+{
+public:
+    NormalPass(IndexedMesh *imesh, float creaseAngle, ThreadPool *pool);
+
+    // compute the normals; split the points on creases if @p split,
+    // or else leave them without a normal
+    void run(bool split);
+
+private:
+    typedef void (NormalPass::*Stage)(int first, int last, int thread);
+
+    struct Range : public ThreadPool::Task {
+        NormalPass *pass;
+        Stage stage;
+        int first, last, thread;
+
+        virtual void run() { (pass->*stage)(first, last, thread); }
+    };
+
+    void parallel(Stage stage, int count);
+
+    void scatterFaces(int first, int last, int thread);
+    void sumPoints(int first, int last, int thread);
+    void findCreases(int first, int last, int thread);
+    void splitCreases(bool split);
+
+    IndexedMesh *_imesh;
+    float _creaseCosine;                // between faces
+    float _splitCosine;                 // between a face and the average
+    ThreadPool *_pool;
+    int _numThreads;
+    int _numPoints;
+    int _numFaces;
+
+    std::vector<Vector> _faceNormals;
+    std::vector<float> _cornerWeights;  // three per face
+    std::vector<char> _creases;         // three per face
+    std::vector<std::vector<NormalSum> > _sums;  // one set per thread
+};
+
+} // namespace
+
+//----------------------------------------------------------------------------
+
+NormalPass::NormalPass(IndexedMesh *imesh, float creaseAngle, ThreadPool *pool)
+{
+    _imesh = imesh;
+    _creaseCosine = (float)cos(creaseAngle * M_PI / 180.0);
+    _splitCosine = (float)cos(creaseAngle * 0.5 * M_PI / 180.0);
+    _pool = pool;
+    _numThreads = pool->numThreads();
+    _numPoints = (int)imesh->points.size();
+    _numFaces = imesh->numFaces();
+}
+
+//----------------------------------------------------------------------------
+
+void NormalPass::parallel(Stage stage, int count)
+{
+    // one range per thread of the pool, each summing into a set of
+    // its own, so the sums do not depend on which thread runs a range
+
+    std::vector<Range> ranges(_numThreads);
+    int t;
+    for (t = 0; t < _numThreads; ++t) {
+        ranges[t].pass = this;
+        ranges[t].stage = stage;
+        ranges[t].first = (int)((long long)count * t / _numThreads);
+        ranges[t].last = (int)((long long)count * (t + 1) / _numThreads);
+        ranges[t].thread = t;
+        _pool->submit(&ranges[t]);
+    }
+    _pool->wait();
+}
+
+//----------------------------------------------------------------------------
+
+void NormalPass::scatterFaces(int first, int last, int thread)
+{
+    std::vector<NormalSum> &sums = _sums[thread];
+    NormalSum zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+    sums.assign(_numPoints, zero);
+
+    const std::vector<Vector> &points = _imesh->points;
+    for (int f = first; f < last; ++f) {
+        const int *face = &_imesh->faces[f * 3];
+        const Vector &v0 = points[face[0]];
+        const Vector &v1 = points[face[1]];
+        const Vector &v2 = points[face[2]];
+        Vector e[3] = { v1 - v0, v2 - v1, v0 - v2 };
+        Vector normal = (e[0] % e[1]).normalized();
+        _faceNormals[f] = normal;
+
+        // weigh the face by its angle at each corner
+
+        for (int k = 0; k < 3; ++k) {
+            Vector u = e[k].normalized();
+            Vector w = e[(k + 2) % 3].normalized();
+            float c = -(float)(u * w);
+            float angle = (float)acos(THREED_MAX(-1.0f, THREED_MIN(1.0f, c)));
+            _cornerWeights[f * 3 + k] = angle;
+            NormalSum &sum = sums[face[k]];
+            sum.x += normal.x() * angle;
+            sum.y += normal.y() * angle;
+            sum.z += normal.z() * angle;
+            sum.w += angle;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void NormalPass::sumPoints(int first, int last, int /*thread*/)
+{
+    std::vector<NormalSum> &sums = _sums[0];
+    for (int t = 1; t < _numThreads; ++t) {
+        const std::vector<NormalSum> &other = _sums[t];
+        for (int p = first; p < last; ++p) {
+            sums[p].x += other[p].x;
+            sums[p].y += other[p].y;
+            sums[p].z += other[p].z;
+            sums[p].w += other[p].w;
+        }
+    }
+    for (int p = first; p < last; ++p)
+        _imesh->normals[p] = Vector(sums[p].x, sums[p].y, sums[p].z).normalized();
+}
+
+//----------------------------------------------------------------------------
+
+// two faces that meet at the crease angle are each half that angle
+// away from their average
+
+void NormalPass::findCreases(int first, int last, int /*thread*/)
+{
+    const std::vector<Vector> &normals = _imesh->normals;
+    for (int f = first; f < last; ++f) {
+        const Vector &normal = _faceNormals[f];
+        for (int k = 0; k < 3; ++k) {
+            int p = _imesh->faces[f * 3 + k];
+            _creases[f * 3 + k] = ((float)(normal * normals[p]) < _splitCosine);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void NormalPass::splitCreases(bool split)
+{
+    // the corners on creases are few, so take them in order of point
+
+    std::vector<std::pair<int, int> > corners;
+    int c;
+    for (c = 0; c < _numFaces * 3; ++c)
+        if (_creases[c])
+            corners.push_back(std::pair<int, int>(_imesh->faces[c], c));
+    std::sort(corners.begin(), corners.end());
+
+    std::vector<NormalSum> &sums = _sums[0];
+    bool hasMaterials = ((int)_imesh->pointMaterials.size() == _numPoints);
+    std::vector<Vector> seeds;
+    std::vector<NormalSum> clusters;
+    std::vector<int> indices;
+
+    int n = (int)corners.size();
+    int i = 0;
+    while (i < n) {
+        int p = corners[i].first;
+        int j = i;
+        while (j < n && corners[j].first == p)
+            ++j;
+
+        if (! split) {
+            _imesh->normals[p] = Vector();
+            i = j;
+            continue;
+        }
+
+        // gather the corners into sets of faces that turn by less
+        // than the crease angle from the first face of the set, and
+        // take them out of the normal of the point
+
+        seeds.clear();
+        clusters.clear();
+        indices.clear();
+        NormalSum &sum = sums[p];
+        for (; i < j; ++i) {
+            c = corners[i].second;
+            const Vector &normal = _faceNormals[c / 3];
+            float weight = _cornerWeights[c];
+            unsigned int s;
+            for (s = 0; s < seeds.size(); ++s)
+                if ((float)(normal * seeds[s]) >= _creaseCosine)
+                    break;
+            if (s == seeds.size()) {
+                NormalSum zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+                seeds.push_back(normal);
+                clusters.push_back(zero);
+            }
+            clusters[s].x += normal.x() * weight;
+            clusters[s].y += normal.y() * weight;
+            clusters[s].z += normal.z() * weight;
+            clusters[s].w += weight;
+            sum.x -= normal.x() * weight;
+            sum.y -= normal.y() * weight;
+            sum.z -= normal.z() * weight;
+            sum.w -= weight;
+            indices.push_back(s);
+        }
+
+        // every set but the first takes a new point.  the first takes
+        // one too, unless it took all the corners of the point
+
+        std::vector<int> newPoints(seeds.size());
+        unsigned int s;
+        for (s = 0; s < seeds.size(); ++s) {
+            if (s == 0 && sum.w <= 1e-6f)
+                newPoints[s] = p;
+            else {
+                newPoints[s] = (int)_imesh->points.size();
+                _imesh->points.push_back(_imesh->points[p]);
+                _imesh->normals.push_back(Vector());
+                if (hasMaterials)
+                    _imesh->pointMaterials.push_back(
+                        _imesh->pointMaterials[p]);
+            }
+            _imesh->normals[newPoints[s]] = Vector(
+                clusters[s].x, clusters[s].y, clusters[s].z).normalized();
+        }
+        if (newPoints[0] != p)
+            _imesh->normals[p] = Vector(sum.x, sum.y, sum.z).normalized();
+
+        int first = j - (int)indices.size();
+        for (s = 0; s < indices.size(); ++s)
+            _imesh->faces[corners[first + s].second] = newPoints[indices[s]];
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void NormalPass::run(bool split)
+{
+    _faceNormals.resize(_numFaces);
+    _cornerWeights.resize(_numFaces * 3);
+    _creases.resize(_numFaces * 3);
+    _sums.resize(_numThreads);
+    _imesh->normals.resize(_numPoints);
+
+    parallel(&NormalPass::scatterFaces, _numFaces);
+    parallel(&NormalPass::sumPoints, _numPoints);
+    parallel(&NormalPass::findCreases, _numFaces);
+    splitCreases(split);
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh_Opt::computeNormals(IndexedMesh *imesh, float creaseAngle,
+                              int numThreads)
+{
+    ThreadPool pool(THREED_MAX(numThreads, 1));
+    computeNormals(imesh, creaseAngle, &pool);
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh_Opt::computeNormals(IndexedMesh *imesh, float creaseAngle,
+                              ThreadPool *pool)
+{
+    NormalPass pass(imesh, creaseAngle, pool);
+    pass.run(true);
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh_Opt::computeNormals(Mesh *mesh, float creaseAngle, int numThreads)
+{
+    ThreadPool pool(THREED_MAX(numThreads, 1));
+    computeNormals(mesh, creaseAngle, &pool);
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh_Opt::computeNormals(Mesh *mesh, float creaseAngle, ThreadPool *pool)
+{
+    IndexedMesh imesh;
+    std::vector<const Mesh::MeshPoint *> mpoints;
+    getIndexedMesh(mesh, &imesh, &mpoints);
+
+    NormalPass pass(&imesh, creaseAngle, pool);
+    pass.run(false);
+
+    for (unsigned int i = 0; i < mpoints.size(); ++i)
+        ((Mesh::MeshPoint *)mpoints[i])->normal = imesh.normals[i];
+}
+
+//----------------------------------------------------------------------------
+
+#define CACHE_SIZE 32                   // entries modelled by the reorder
+#define MAX_VALENCE_SCORED 64
+
+namespace {
+
+// score of a point, by its position in a cache of CACHE_SIZE entries,
+// with a boost for points with few faces left (Forsyth)
+
+class CacheScores
+{
+public:
+    CacheScores()
+    {
+        int i;
+        for (i = 0; i < CACHE_SIZE; ++i) {
+            if (i < 3)
+                _position[i] = 0.75f;
+            else {
+                float s = 1.0f - (float)(i - 3) / (float)(CACHE_SIZE - 3);
+                _position[i] = (float)pow(s, 1.5);
+            }
+        }
+        _valence[0] = 0.0f;
+        for (i = 1; i < MAX_VALENCE_SCORED; ++i)
+            _valence[i] = 2.0f * (float)pow((double)i, -0.5);
+    }
+
+    float score(int position, int valence) const
+    {
+        if (valence <= 0)
+            return -1.0f;
+        float s = (position >= 0 ? _position[position] : 0.0f);
+        return s + _valence[THREED_MIN(valence, MAX_VALENCE_SCORED - 1)];
+    }
+
+private:
+    float _position[CACHE_SIZE];
+    float _valence[MAX_VALENCE_SCORED];
+};
+
+// put the faces in an order that reuses the points in a vertex cache
+
+void cacheOrder(const std::vector<int> &faces, int numPoints,
+                std::vector<int> *order)
+{
+    static const CacheScores scores;
+
+    int numFaces = (int)faces.size() / 3;
+    int i, k;
+
+    // faces around each point, in compressed rows
+
+    std::vector<int> start(numPoints + 1, 0);
+    for (i = 0; i < numFaces * 3; ++i)
+        ++start[faces[i] + 1];
+    for (i = 0; i < numPoints; ++i)
+        start[i + 1] += start[i];
+    std::vector<int> pointFaces(numFaces * 3);
+    std::vector<int> valence(numPoints, 0);
+    for (i = 0; i < numFaces * 3; ++i) {
+        int p = faces[i];
+        pointFaces[start[p] + valence[p]] = i / 3;
+        ++valence[p];
+    }
+
+    std::vector<int> position(numPoints, -1);
+    std::vector<float> pointScore(numPoints);
+    for (i = 0; i < numPoints; ++i)
+        pointScore[i] = scores.score(-1, valence[i]);
+
+    std::vector<bool> added(numFaces, false);
+
+    // the cache holds three more entries for the points of the face
+    // being added, which push the oldest ones out
+
+    int cache[CACHE_SIZE + 3];
+    int cacheUsed = 0;
+    int newCache[CACHE_SIZE + 3];
+
+    order->clear();
+    order->reserve(numFaces);
+    int best = -1;
+    int nextScan = 0;
+    while ((int)order->size() < numFaces) {
+
+        // without a face around the points in the cache, take the
+        // next face not added yet
+
+        if (best < 0) {
+            while (added[nextScan])
+                ++nextScan;
+            best = nextScan;
+        }
+
+        order->push_back(best);
+        added[best] = true;
+
+        const int *f = &faces[best * 3];
+        int newUsed = 0;
+        for (k = 0; k < 3; ++k) {
+            int p = f[k];
+            newCache[newUsed++] = p;
+
+            // take the face out of the faces around the point
+
+            int *row = &pointFaces[start[p]];
+            int n = valence[p];
+            for (int j = 0; j < n; ++j) {
+                if (row[j] == best) {
+                    row[j] = row[n - 1];
+                    break;
+                }
+            }
+            --valence[p];
+        }
+        for (i = 0; i < cacheUsed; ++i) {
+            int p = cache[i];
+            if (p != f[0] && p != f[1] && p != f[2])
+                newCache[newUsed++] = p;
+        }
+
+        // rescore the points in the cache, and those pushed out, and
+        // the faces around them.  the best of these is added next
+
+        best = -1;
+        float bestScore = -1.0f;
+        for (i = 0; i < newUsed; ++i) {
+            int p = newCache[i];
+            position[p] = (i < CACHE_SIZE ? i : -1);
+            pointScore[p] = scores.score(position[p], valence[p]);
+        }
+        for (i = 0; i < newUsed; ++i) {
+            int p = newCache[i];
+            int *row = &pointFaces[start[p]];
+            for (int j = 0; j < valence[p]; ++j) {
+                int g = row[j];
+                const int *fg = &faces[g * 3];
+                float s = pointScore[fg[0]] + pointScore[fg[1]] +
+                          pointScore[fg[2]];
+                if (s > bestScore) {
+                    bestScore = s;
+                    best = g;
+                }
+            }
+        }
+
+        cacheUsed = THREED_MIN(newUsed, CACHE_SIZE);
+        for (i = 0; i < cacheUsed; ++i)
+            cache[i] = newCache[i];
+    }
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+
+float Mesh_Opt::cacheMissRatio(const IndexedMesh &imesh, int cacheSize)
+{
+    // a FIFO cache, as in most hardware
+
+    int numPoints = (int)imesh.points.size();
+    int numFaces = imesh.numFaces();
+    if (numFaces == 0)
+        return 0.0f;
+
+    std::vector<int> stamps(numPoints, -cacheSize - 1);
+    int misses = 0;
+    for (int i = 0; i < numFaces * 3; ++i) {
+        int p = imesh.faces[i];
+        if (misses - stamps[p] > cacheSize) {
+            stamps[p] = misses;
+            ++misses;
+        }
+    }
+    return (float)misses / (float)numFaces;
+}
+
+//----------------------------------------------------------------------------
+
+void Mesh_Opt::optimizeVertexCache(IndexedMesh *imesh)
+{
+    int numPoints = (int)imesh->points.size();
+    int numFaces = imesh->numFaces();
+
+    std::vector<int> order;
+    cacheOrder(imesh->faces, numPoints, &order);
+
+    // number the points in order of first use; points that no face
+    // uses go last
+
+    std::vector<int> newIndex(numPoints, -1);
+    std::vector<int> faces(numFaces * 3);
+    std::vector<int> materials(numFaces);
+    int numUsed = 0;
+    int i, k;
+    for (i = 0; i < numFaces; ++i) {
+        int f = order[i];
+        for (k = 0; k < 3; ++k) {
+            int p = imesh->faces[f * 3 + k];
+            if (newIndex[p] < 0)
+                newIndex[p] = numUsed++;
+            faces[i * 3 + k] = newIndex[p];
+        }
+        materials[i] = imesh->faceMaterials[f];
+    }
+    for (i = 0; i < numPoints; ++i)
+        if (newIndex[i] < 0)
+            newIndex[i] = numUsed++;
+
+    bool hasNormals = ((int)imesh->normals.size() == numPoints);
+    bool hasMaterials = ((int)imesh->pointMaterials.size() == numPoints);
+    std::vector<Vector> points(numPoints);
+    std::vector<Vector> normals(hasNormals ? numPoints : 0);
+    std::vector<int> pointMaterials(hasMaterials ? numPoints : 0);
+    for (i = 0; i < numPoints; ++i) {
+        points[newIndex[i]] = imesh->points[i];
+        if (hasNormals)
+            normals[newIndex[i]] = imesh->normals[i];
+        if (hasMaterials)
+            pointMaterials[newIndex[i]] = imesh->pointMaterials[i];
+    }
+
+    imesh->points.swap(points);
+    imesh->normals.swap(normals);
+    imesh->pointMaterials.swap(pointMaterials);
+    imesh->faces.swap(faces);
+    imesh->faceMaterials.swap(materials);
+}
@@ -0,0 +1,162 @@
+//----------------------------------------------------------------------------
+// ThreeD Mesh Optimizer
+//----------------------------------------------------------------------------
+
+#ifndef _THREED_MESH_OPT_H
+#define _THREED_MESH_OPT_H
+
+#include <threed/mesh.h>
+#include <threed/color.h>
+#include <vector>
+
+namespace ThreeD {
+
+
+class ThreadPool;
+
+
+/**
+ * IndexedMesh, a mesh held in flat arrays:  the points, three point
+ * indices per face, and the material of each face and of each point.
+ * The optimizer works on this form, which is compact and cheap to
+ * walk, and converts from and to Mesh.
+ */
+struct IndexedMesh
+{
+    typedef MaterialPalette::Material Material;
+
+    std::vector<Vector> points;
+    std::vector<Vector> normals;        // one per point
+    std::vector<int> faces;             // three point indices per face
+    std::vector<int> faceMaterials;     // one per face
+    std::vector<int> pointMaterials;    // one per point, or none
+    std::vector<Material> materials;
+
+    /** @return the number of faces */
+    int numFaces() const { return (int)faces.size() / 3; }
+};
+
+
+/**
+ * Mesh_Opt, operations that optimize a mesh
+ */
+class Mesh_Opt
+{
+public:
+    /** Convert @p mesh into indexed form, in @p imesh
+     */
+    static void getIndexedMesh(const Mesh *mesh, IndexedMesh *imesh);
+
+    /** Replace the contents of @p mesh with the indexed mesh @p imesh
+     */
+    static void setIndexedMesh(Mesh *mesh, const IndexedMesh &imesh);
+
+    /** Simplify @p imesh by collapsing edges, cheapest first, where
+     *  the cost of a collapse is the quadric error of the merged
+     *  point (Garland and Heckbert).  Stops when no more than
+     *  @p targetFaces faces remain, or when the next collapse would
+     *  move the surface by more than (about) @p maxError.
+     *
+     *  Open boundaries and the borders between materials are kept,
+     *  and collapses that would fold a face over, or make the
+     *  surface non-manifold, are skipped.
+     *
+     *  @return the number of faces left
+     */
+    static int decimate(IndexedMesh *imesh, int targetFaces, float maxError);
+
+    /** Simplify @p mesh, through its indexed form
+     *
+     *  @return the number of faces left
+     */
+    static int decimate(Mesh *mesh, int targetFaces, float maxError);
+
+    /** Merge the faces of @p mesh that lie in the same plane, touch
+     *  along edges and share a material, into polygons, and triangulate
+     *  each polygon again with as few faces as its outline allows.
+     *  Points inside the polygons go away, and so do points along a
+     *  straight outline, where every polygon that passes by the point
+     *  is merged.  Flat sides of boxes, for example, collapse to a
+     *  couple of faces each.
+     *
+     *  Planes a little apart are merged as one, as the thin faces of a
+     *  side that is not on an axis plane hold planes of their own.
+     *  Such a side meshed by MC still merges little, as the faces too
+     *  thin to keep leave narrow holes in it.
+     *
+     *  @return the number of faces left
+     */
+    static int mergeCoplanarFaces(Mesh *mesh);
+
+    /** Cut the polygon @p loop, which lies in a plane across axis
+     *  @p axis (0 for x, 1 for y, 2 for z), into faces by clipping
+     *  ears.  The polygon may turn either way, and the faces turn the
+     *  same way it does.  The faces go into @p triangles, three points
+     *  per face.
+     *
+     *  @return false if the loop crosses itself, or encloses no area
+     */
+    static bool triangulateLoop(const std::vector<const Vector *> &loop,
+                                int axis,
+                                std::vector<const Vector *> *triangles);
+
+    /** Compute the normal of each point of @p imesh:  the average of
+     *  the normals of the faces around it, weighted by the angle of
+     *  each face at the point.  Where faces meet at more than
+     *  @p creaseAngle degrees, the point is split, into one point for
+     *  each set of faces on a side of the crease.
+     *
+     *  The faces are divided among @p numThreads threads, and each
+     *  thread sums normals into points of its own.
+     */
+    static void computeNormals(IndexedMesh *imesh, float creaseAngle,
+                               int numThreads = 1);
+
+    /** Compute the normals of the points of @p mesh, as above.  Points
+     *  of a Mesh cannot be split, so points on a crease are left
+     *  without a normal, and their faces are drawn flat.
+     */
+    static void computeNormals(Mesh *mesh, float creaseAngle,
+                               int numThreads = 1);
+
+    /** Compute the normals of the points of @p imesh, as above, on the
+     *  threads of @p pool, in as many ranges of faces as it has threads
+     */
+    static void computeNormals(IndexedMesh *imesh, float creaseAngle,
+                               ThreadPool *pool);
+
+    /** Compute the normals of the points of @p mesh, as above, on the
+     *  threads of @p pool
+     */
+    static void computeNormals(Mesh *mesh, float creaseAngle,
+                               ThreadPool *pool);
+
+    /** @return the average number of points missed per face, by a
+     *  first-in first-out vertex cache of @p cacheSize entries, when
+     *  drawing the faces of @p imesh in order.  About 0.5 is the best
+     *  possible on a closed mesh, and 3 the worst.
+     */
+    static float cacheMissRatio(const IndexedMesh &imesh, int cacheSize = 16);
+
+    /** Reorder the faces of @p imesh so that faces drawn one after the
+     *  other share points in the vertex cache of the graphics card
+     *  (Forsyth), and number the points in order of first use, so
+     *  reading them follows the faces through memory.
+     *
+     *  Mesh keeps its faces by plane, so the order only holds in the
+     *  indexed form; use it before handing the arrays to a renderer
+     *  or writing them out.
+     */
+    static void optimizeVertexCache(IndexedMesh *imesh);
+
+private:
+    /** Convert @p mesh into indexed form, and record the Mesh point
+     *  of each indexed point in @p mpoints, if not null
+     */
+    static void getIndexedMesh(const Mesh *mesh, IndexedMesh *imesh,
+                               std::vector<const Mesh::MeshPoint *> *mpoints);
+};
+
+
+} // namespace ThreeD
+#endif // _THREED_MESH_OPT_H
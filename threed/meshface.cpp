@@ -40,17 +40,18 @@ void MeshFace::getMinMax(Vector *vmin, Vector *vmax) const
 
 //----------------------------------------------------------------------------
 
-void MeshFace::draw(const Color &highlight)
+void MeshFace::draw(const MaterialPalette &palette, const Color &highlight)
 {
-    if (_c == Color())
+    const MaterialPalette::Material &mat = palette.get(_material);
+    if (mat.c == Color())
         return;
 
     float ambient[4] =
-        { _ambient.red(), _ambient.blue(), _ambient.green(), 1.0f };
+        { mat.ambient.red(), mat.ambient.blue(), mat.ambient.green(), 1.0f };
     float diffuse[4] =
-        { _diffuse.red(), _diffuse.green(), _diffuse.blue(), 1.0f };
+        { mat.diffuse.red(), mat.diffuse.green(), mat.diffuse.blue(), 1.0f };
     float specular[4] =
-        { _specular.red(), _specular.green(), _specular.blue(), 1.0f };
+        { mat.specular.red(), mat.specular.green(), mat.specular.blue(), 1.0f };
 
     int i;
 
@@ -66,8 +67,8 @@ void MeshFace::draw(const Color &highlight)
         glMaterialfv(GL_FRONT, GL_AMBIENT, ambient);
         glMaterialfv(GL_FRONT, GL_DIFFUSE, diffuse);
         glMaterialfv(GL_FRONT, GL_SPECULAR, specular);
-        glMaterialf(GL_FRONT, GL_SHININESS, _shininess);
-        glColor3f(_c.red(), _c.green(), _c.blue());
+        glMaterialf(GL_FRONT, GL_SHININESS, mat.shininess);
+        glColor3f(mat.c.red(), mat.c.green(), mat.c.blue());
 
         glVertex3f(vertex.x(), vertex.y(), -vertex.z());
     }
@@ -7,6 +7,7 @@
 
 #include <threed/color.h>
 #include <threed/plane.h>
+#include <threed/materialpalette.h>
 
 namespace ThreeD {
 
@@ -21,13 +22,12 @@ public:
      * Constructor.
      *
      * Constructs a mesh face as a triangle bound by the three vertices
-     * @p v0, @p v1 and @p v2, and having color @p c.
+     * @p v0, @p v1 and @p v2, and having material @p material
+     * of the palette of its mesh.
      */
     MeshFace(const Vector *v0, const Vector *v1, const Vector *v2,
-             const Color &c, const Color &a, const Color &d,
-             const Color &sp, float sh)
-        : _c(c), _ambient(a), _diffuse(d),
-          _specular(sp), _shininess(sh)
+             MaterialPalette::Id material)
+        : _material(material)
     {
         _v[0] = v0;
         _v[1] = v1;
@@ -58,12 +58,12 @@ public:
     void getMinMax(Vector *vmin, Vector *vmax) const;
 
     /**
-     * Draws this mesh face.
+     * Draws this mesh face, in its material from @p palette.
      *
      * Note:  any parameters that should affect the output should be
      * effected into OpenGL prior to the invocation of this method.
      */
-    void draw(const Color &highlight);
+    void draw(const MaterialPalette &palette, const Color &highlight);
 
     /** Set vertex pointers. */
     void setVertexPointers(const Vector **vptrs)
@@ -89,14 +89,8 @@ public:
      */
 
     const Vector *_v[3];
-
-    Color _c;
-    Color _ambient;
-    Color _diffuse;
-    Color _specular;
-    float _shininess;
-
     Vector _planeNormal;
+    MaterialPalette::Id _material;
 };
 
 
@@ -23,8 +23,9 @@
 
 #define THREED_MAX(a,b) ((a) > (b) ? (a) : (b))
 
-// sign of a float value: returns 0 for positive, 1 for negative
-#define fsign(f) ((int)((*(long *)(&f) & 0x80000000L) >> 31))
+// sign of a float value: returns 0 for positive, 1 for negative.  Reads
+// the four bytes of the float, where long is eight bytes on LP64
+#define fsign(f) ((int)((*(unsigned int *)(&f) & 0x80000000U) >> 31))
 
 // sign of a double value: returns 0 for positive, 1 for negative
 #define dsign(f) ((int)((*(((long *)(&f)) + 1) & 0x80000000L) >> 31))
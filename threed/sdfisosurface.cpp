@@ -0,0 +1,461 @@
+//----------------------------------------------------------------------------
+// ThreeD Signed Distance Primitives
+//----------------------------------------------------------------------------
+
+#include <threed/sdfisosurface.h>
+#include <threed/misc.h>
+#include <math.h>
+
+using namespace ThreeD;
+
+//----------------------------------------------------------------------------
+
+// the kernels copy the members they use into locals, so the compiler
+// need not reload them after every store into the densities
+
+namespace {
+
+inline float sign(float f)
+{
+    return (f < 0.0f ? -1.0f : 1.0f);
+}
+
+inline float clamp(float f, float lo, float hi)
+{
+    return (f < lo ? lo : (f > hi ? hi : f));
+}
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------
+//
+// SdfIsosurface
+//
+//----------------------------------------------------------------------------
+
+SdfIsosurface::SdfIsosurface()
+{
+    _mat.color = Color(1.0f, 1.0f, 1.0f);
+    _mat.ambient = Color();
+    _mat.diffuse = 1.0f;
+    _mat.specular = 1.0f;
+    _mat.brilliance = 1.0f;
+}
+
+//----------------------------------------------------------------------------
+
+void SdfIsosurface::setMaterial(const Material &mat)
+{
+    _mat = mat;
+}
+
+//----------------------------------------------------------------------------
+
+void SdfIsosurface::fNormal(const Vector *point, Vector *normal) const
+{
+    float x, y, z;
+    _globalTransInv.transform(point->x(), point->y(), point->z(), &x, &y, &z);
+
+    Vector g = gradient(x, y, z);
+    if (g == Vector())
+        g = Vector(0.0f, 1.0f, 0.0f);   // at a center or on a ridge
+
+    float nx, ny, nz;
+    _globalTransInv.transformNormal(g.x(), g.y(), g.z(), &nx, &ny, &nz);
+    *normal = Vector(nx, ny, nz).normalized();
+}
+
+//----------------------------------------------------------------------------
+
+const Isosurface::Material &SdfIsosurface::fMaterial(
+    const Vector * /*point*/, float /*density*/) const
+{
+    return _mat;
+}
+
+//----------------------------------------------------------------------------
+//
+// SdfSphere
+//
+//----------------------------------------------------------------------------
+
+SdfSphere::SdfSphere(float radius)
+{
+    _radius = radius;
+    addBoundingBox(BoundingBox(Vector(-radius, -radius, -radius),
+                               Vector(radius, radius, radius)));
+}
+
+//----------------------------------------------------------------------------
+
+void SdfSphere::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    const float radius = _radius;
+    for (int i = 0; i < num_points; ++i)
+        densities[i] =
+            sqrtf(xs[i] * xs[i] + ys[i] * ys[i] + zs[i] * zs[i]) - radius;
+}
+
+//----------------------------------------------------------------------------
+
+Vector SdfSphere::gradient(float x, float y, float z) const
+{
+    return Vector(x, y, z);
+}
+
+//----------------------------------------------------------------------------
+//
+// SdfBox
+//
+//----------------------------------------------------------------------------
+
+SdfBox::SdfBox(const Vector &size, float rounding)
+{
+    Vector half = size / 2.0f;
+    _half[0] = half.x() - rounding;
+    _half[1] = half.y() - rounding;
+    _half[2] = half.z() - rounding;
+    _rounding = rounding;
+    addBoundingBox(BoundingBox(-half, half));
+}
+
+//----------------------------------------------------------------------------
+
+void SdfBox::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    const float bx = _half[0];
+    const float by = _half[1];
+    const float bz = _half[2];
+    const float rounding = _rounding;
+
+    for (int i = 0; i < num_points; ++i) {
+        float qx = fabsf(xs[i]) - bx;
+        float qy = fabsf(ys[i]) - by;
+        float qz = fabsf(zs[i]) - bz;
+        float ox = THREED_MAX(qx, 0.0f);
+        float oy = THREED_MAX(qy, 0.0f);
+        float oz = THREED_MAX(qz, 0.0f);
+        float inside = THREED_MIN(THREED_MAX(qx, THREED_MAX(qy, qz)), 0.0f);
+        densities[i] = sqrtf(ox * ox + oy * oy + oz * oz) + inside - rounding;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+Vector SdfBox::gradient(float x, float y, float z) const
+{
+    float qx = fabsf(x) - _half[0];
+    float qy = fabsf(y) - _half[1];
+    float qz = fabsf(z) - _half[2];
+
+    // outside, away from the nearest point of the box; inside, out
+    // through the nearest side
+
+    if (qx > 0.0f || qy > 0.0f || qz > 0.0f)
+        return Vector(sign(x) * THREED_MAX(qx, 0.0f),
+                      sign(y) * THREED_MAX(qy, 0.0f),
+                      sign(z) * THREED_MAX(qz, 0.0f));
+    if (qx >= qy && qx >= qz)
+        return Vector(sign(x), 0.0f, 0.0f);
+    if (qy >= qz)
+        return Vector(0.0f, sign(y), 0.0f);
+    return Vector(0.0f, 0.0f, sign(z));
+}
+
+//----------------------------------------------------------------------------
+//
+// SdfCylinder
+//
+//----------------------------------------------------------------------------
+
+SdfCylinder::SdfCylinder(float radius, float height)
+{
+    _radius = radius;
+    _halfHeight = height / 2.0f;
+    addBoundingBox(BoundingBox(Vector(-radius, -_halfHeight, -radius),
+                               Vector(radius, _halfHeight, radius)));
+}
+
+//----------------------------------------------------------------------------
+
+void SdfCylinder::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    const float radius = _radius;
+    const float halfHeight = _halfHeight;
+
+    for (int i = 0; i < num_points; ++i) {
+        float dr = sqrtf(xs[i] * xs[i] + zs[i] * zs[i]) - radius;
+        float dy = fabsf(ys[i]) - halfHeight;
+        float or_ = THREED_MAX(dr, 0.0f);
+        float oy = THREED_MAX(dy, 0.0f);
+        densities[i] = THREED_MIN(THREED_MAX(dr, dy), 0.0f) +
+                       sqrtf(or_ * or_ + oy * oy);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+Vector SdfCylinder::gradient(float x, float y, float z) const
+{
+    float r = sqrtf(x * x + z * z);
+    float dr = r - _radius;
+    float dy = fabsf(y) - _halfHeight;
+
+    float gr, gy;
+    if (dr > 0.0f || dy > 0.0f) {
+        gr = THREED_MAX(dr, 0.0f);
+        gy = THREED_MAX(dy, 0.0f);
+    } else if (dr >= dy) {
+        gr = 1.0f;
+        gy = 0.0f;
+    } else {
+        gr = 0.0f;
+        gy = 1.0f;
+    }
+
+    if (r > 0.0f)
+        return Vector(gr * x / r, gy * sign(y), gr * z / r);
+    return Vector(0.0f, gy * sign(y), 0.0f);
+}
+
+//----------------------------------------------------------------------------
+//
+// SdfCapsule
+//
+//----------------------------------------------------------------------------
+
+SdfCapsule::SdfCapsule(float radius, float length)
+{
+    _radius = radius;
+    _halfLength = length / 2.0f;
+    float h = _halfLength + radius;
+    addBoundingBox(BoundingBox(Vector(-radius, -h, -radius),
+                               Vector(radius, h, radius)));
+}
+
+//----------------------------------------------------------------------------
+
+void SdfCapsule::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    const float radius = _radius;
+    const float halfLength = _halfLength;
+
+    for (int i = 0; i < num_points; ++i) {
+        float dy = ys[i] - clamp(ys[i], -halfLength, halfLength);
+        densities[i] =
+            sqrtf(xs[i] * xs[i] + dy * dy + zs[i] * zs[i]) - radius;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+Vector SdfCapsule::gradient(float x, float y, float z) const
+{
+    return Vector(x, y - clamp(y, -_halfLength, _halfLength), z);
+}
+
+//----------------------------------------------------------------------------
+//
+// SdfTorus
+//
+//----------------------------------------------------------------------------
+
+SdfTorus::SdfTorus(float majorRadius, float minorRadius)
+{
+    _majorRadius = majorRadius;
+    _minorRadius = minorRadius;
+    float r = majorRadius + minorRadius;
+    addBoundingBox(BoundingBox(Vector(-r, -minorRadius, -r),
+                               Vector(r, minorRadius, r)));
+}
+
+//----------------------------------------------------------------------------
+
+void SdfTorus::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    const float majorRadius = _majorRadius;
+    const float minorRadius = _minorRadius;
+
+    for (int i = 0; i < num_points; ++i) {
+        float q = sqrtf(xs[i] * xs[i] + zs[i] * zs[i]) - majorRadius;
+        densities[i] = sqrtf(q * q + ys[i] * ys[i]) - minorRadius;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+Vector SdfTorus::gradient(float x, float y, float z) const
+{
+    float r = sqrtf(x * x + z * z);
+    if (r <= 0.0f)
+        return Vector(0.0f, y, 0.0f);
+    float q = r - _majorRadius;
+    return Vector(q * x / r, y, q * z / r);
+}
+
+//----------------------------------------------------------------------------
+//
+// SdfPlane
+//
+//----------------------------------------------------------------------------
+
+SdfPlane::SdfPlane(const Vector &normal, float extent)
+{
+    Vector n = normal.normalized();
+    _normal[0] = n.x();
+    _normal[1] = n.y();
+    _normal[2] = n.z();
+    addBoundingBox(BoundingBox(Vector(-extent, -extent, -extent),
+                               Vector(extent, extent, extent)));
+}
+
+//----------------------------------------------------------------------------
+
+void SdfPlane::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    const float nx = _normal[0];
+    const float ny = _normal[1];
+    const float nz = _normal[2];
+
+    for (int i = 0; i < num_points; ++i)
+        densities[i] = xs[i] * nx + ys[i] * ny + zs[i] * nz;
+}
+
+//----------------------------------------------------------------------------
+
+Vector SdfPlane::gradient(float /*x*/, float /*y*/, float /*z*/) const
+{
+    return Vector(_normal[0], _normal[1], _normal[2]);
+}
+
+//----------------------------------------------------------------------------
+//
+// SdfCone
+//
+//----------------------------------------------------------------------------
+
+SdfCone::SdfCone(float radius, float height)
+{
+    _radius = radius;
+    _halfHeight = height / 2.0f;
+    addBoundingBox(BoundingBox(Vector(-radius, -_halfHeight, -radius),
+                               Vector(radius, _halfHeight, radius)));
+}
+
+//----------------------------------------------------------------------------
+
+float SdfCone::distance2d(float r, float y, float *dr, float *dy) const
+{
+    // the nearer of the base disc and the slanted side (Quilez)
+
+    float h = _halfHeight;
+    float radius = _radius;
+
+    float ca_r = r - THREED_MIN(r, (y < 0.0f ? radius : 0.0f));
+    float ca_y = fabsf(y) - h;
+
+    // side from the tip (0,h) to the rim (radius,-h)
+    float k2r = -radius;
+    float k2y = 2.0f * h;
+    float t = clamp(((-r) * k2r + (h - y) * k2y) / (k2r * k2r + k2y * k2y),
+                    0.0f, 1.0f);
+    float cb_r = r + k2r * t;
+    float cb_y = y - h + k2y * t;
+
+    float s = (cb_r < 0.0f && ca_y < 0.0f ? -1.0f : 1.0f);
+    float a2 = ca_r * ca_r + ca_y * ca_y;
+    float b2 = cb_r * cb_r + cb_y * cb_y;
+
+    if (a2 < b2) {
+        *dr = s * ca_r;
+        *dy = s * ca_y * sign(y);
+        return s * sqrtf(a2);
+    }
+    *dr = s * cb_r;
+    *dy = s * cb_y;
+    return s * sqrtf(b2);
+}
+
+//----------------------------------------------------------------------------
+
+void SdfCone::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    float dr, dy;
+    for (int i = 0; i < num_points; ++i)
+        densities[i] = distance2d(sqrtf(xs[i] * xs[i] + zs[i] * zs[i]),
+                                  ys[i], &dr, &dy);
+}
+
+//----------------------------------------------------------------------------
+
+Vector SdfCone::gradient(float x, float y, float z) const
+{
+    float r = sqrtf(x * x + z * z);
+    float dr, dy;
+    distance2d(r, y, &dr, &dy);
+    if (r > 0.0f)
+        return Vector(dr * x / r, dy, dr * z / r);
+    return Vector(0.0f, dy, 0.0f);
+}
+
+//----------------------------------------------------------------------------
+//
+// SdfEllipsoid
+//
+//----------------------------------------------------------------------------
+
+SdfEllipsoid::SdfEllipsoid(const Vector &radii)
+{
+    _inv[0] = 1.0f / radii.x();
+    _inv[1] = 1.0f / radii.y();
+    _inv[2] = 1.0f / radii.z();
+    for (int k = 0; k < 3; ++k)
+        _inv2[k] = _inv[k] * _inv[k];
+    _minRadius = THREED_MIN(radii.x(), THREED_MIN(radii.y(), radii.z()));
+    addBoundingBox(BoundingBox(-radii, radii));
+}
+
+//----------------------------------------------------------------------------
+
+void SdfEllipsoid::fDensityPoints(
+    const float *xs, const float *ys, const float *zs,
+    int num_points, float *densities) const
+{
+    // k0 = |p / radii| grows by at most 1 / minRadius per unit of
+    // distance, so (k0 - 1) * minRadius never exceeds the distance
+
+    const float ix = _inv[0], iy = _inv[1], iz = _inv[2];
+    const float minRadius = _minRadius;
+
+    for (int i = 0; i < num_points; ++i) {
+        float ax = xs[i] * ix, ay = ys[i] * iy, az = zs[i] * iz;
+        float k0 = sqrtf(ax * ax + ay * ay + az * az);
+        densities[i] = (k0 - 1.0f) * minRadius;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+Vector SdfEllipsoid::gradient(float x, float y, float z) const
+{
+    // k0 = |p / radii|, as in fDensityPoints()
+    Vector a(x * _inv2[0], y * _inv2[1], z * _inv2[2]);
+    float k0 = sqrtf(x * a.x() + y * a.y() + z * a.z());
+    if (k0 <= 0.0f)
+        return Vector();
+    return a * (_minRadius / k0);
+}
@@ -0,0 +1,250 @@
+//----------------------------------------------------------------------------
+// ThreeD Signed Distance Primitives
+//----------------------------------------------------------------------------
+
+#ifndef _THREED_SDFISOSURFACE_H
+#define _THREED_SDFISOSURFACE_H
+
+#include <threed/isosurface.h>
+
+namespace ThreeD {
+
+
+/**
+ * SdfIsosurface, a primitive whose density is the signed distance to
+ * its surface:  negative inside, positive outside, and changing by at
+ * most one unit per unit of distance.  Transforms that only rotate and
+ * translate keep the distance; a scale stretches it.
+ *
+ * The primitives are centered on the origin, and are placed with
+ * setTransform().  Densities are computed in float, a chunk of points
+ * at a time, by kernels without calls or virtual dispatch in the loop,
+ * and normals come from the exact gradient of the distance.
+ */
+class SdfIsosurface : public Isosurface
+{
+public:
+    /** constructor.  The material is white.
+     */
+    SdfIsosurface();
+
+    /** Set the material of the whole primitive
+     */
+    void setMaterial(const Material &mat);
+
+    /** Compute the normal from the gradient of the distance
+     */
+    virtual void fNormal(const Vector *point, Vector *normal) const;
+
+    /** @return the material set by setMaterial()
+     */
+    virtual const Material &fMaterial(
+        const Vector *point, float density) const;
+
+protected:
+
+    /** Compute the gradient of the distance at a point given in the
+     *  coordinates of the primitive.  It need not be normalized.
+     */
+    virtual Vector gradient(float x, float y, float z) const = 0;
+
+    /*
+     * data
+     */
+
+    Material _mat;
+};
+
+
+/**
+ * SdfSphere, a sphere of radius @p radius
+ */
+class SdfSphere : public SdfIsosurface
+{
+public:
+    SdfSphere(float radius);
+
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+protected:
+    virtual Vector gradient(float x, float y, float z) const;
+
+    float _radius;
+};
+
+
+/**
+ * SdfBox, a box of @p size, with edges rounded to @p rounding
+ */
+class SdfBox : public SdfIsosurface
+{
+public:
+    SdfBox(const Vector &size, float rounding = 0.0f);
+
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+protected:
+    virtual Vector gradient(float x, float y, float z) const;
+
+    float _half[3];                     // half size less the rounding
+    float _rounding;
+};
+
+
+/**
+ * SdfRoundedBox, an SdfBox with rounded edges
+ */
+class SdfRoundedBox : public SdfBox
+{
+public:
+    SdfRoundedBox(const Vector &size, float rounding)
+        : SdfBox(size, rounding)
+    {
+    }
+};
+
+
+/**
+ * SdfCylinder, a capped cylinder along the y axis, of radius
+ * @p radius and height @p height
+ */
+class SdfCylinder : public SdfIsosurface
+{
+public:
+    SdfCylinder(float radius, float height);
+
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+protected:
+    virtual Vector gradient(float x, float y, float z) const;
+
+    float _radius;
+    float _halfHeight;
+};
+
+
+/**
+ * SdfCapsule, the points within @p radius of a segment of length
+ * @p length along the y axis
+ */
+class SdfCapsule : public SdfIsosurface
+{
+public:
+    SdfCapsule(float radius, float length);
+
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+protected:
+    virtual Vector gradient(float x, float y, float z) const;
+
+    float _radius;
+    float _halfLength;
+};
+
+
+/**
+ * SdfTorus, a torus around the y axis, whose tube of radius
+ * @p minorRadius runs at @p majorRadius from the axis
+ */
+class SdfTorus : public SdfIsosurface
+{
+public:
+    SdfTorus(float majorRadius, float minorRadius);
+
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+protected:
+    virtual Vector gradient(float x, float y, float z) const;
+
+    float _majorRadius;
+    float _minorRadius;
+};
+
+
+/**
+ * SdfPlane, the half space below the plane through the origin with
+ * normal @p normal.  The plane is infinite, so it is bounded by a
+ * cube of @p extent around the origin, which is all the meshers see
+ * of it.
+ */
+class SdfPlane : public SdfIsosurface
+{
+public:
+    SdfPlane(const Vector &normal, float extent);
+
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+protected:
+    virtual Vector gradient(float x, float y, float z) const;
+
+    float _normal[3];
+};
+
+
+/**
+ * SdfCone, a cone along the y axis, with a base of radius @p radius
+ * at -height/2 and its tip at +height/2
+ */
+class SdfCone : public SdfIsosurface
+{
+public:
+    SdfCone(float radius, float height);
+
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+protected:
+    /** Compute the distance in the plane of the axis and a point,
+     *  at distance @p r from the axis and height @p y, and the
+     *  direction away from the surface, in @p dr and @p dy
+     */
+    inline float distance2d(float r, float y, float *dr, float *dy) const;
+
+    virtual Vector gradient(float x, float y, float z) const;
+
+    float _radius;
+    float _halfHeight;
+};
+
+
+/**
+ * SdfEllipsoid, an ellipsoid with radii @p radii along the axes.
+ * The distance to an ellipsoid has no closed form; the density is a
+ * bound on it, the ellipsoid squeezed into a sphere of the smallest
+ * radius, which is exact along the shortest axis and falls short of
+ * the distance elsewhere, by up to the ratio of the radii.  Estimates
+ * that come closer off the axes (Quilez) can exceed the distance.
+ */
+class SdfEllipsoid : public SdfIsosurface
+{
+public:
+    SdfEllipsoid(const Vector &radii);
+
+    virtual void fDensityPoints(
+        const float *xs, const float *ys, const float *zs,
+        int num_points, float *densities) const;
+
+protected:
+    virtual Vector gradient(float x, float y, float z) const;
+
+    float _inv[3];                      // 1 / radius
+    float _inv2[3];                     // 1 / radius^2
+    float _minRadius;
+};
+
+
+} // namespace ThreeD
+#endif // _THREED_SDFISOSURFACE_H
@@ -0,0 +1,257 @@
+//----------------------------------------------------------------------------
+// ThreeD Work-Stealing Thread Pool
+//----------------------------------------------------------------------------
+
+#include <threed/threadpool.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using namespace ThreeD;
+
+//----------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = numProcessors();
+
+    pthread_key_create(&_self, 0);
+    pthread_mutex_init(&_lock, 0);
+    pthread_cond_init(&_changed, 0);
+    _queued = 0;
+    _pending = 0;
+    _next = 0;
+    _quit = false;
+
+    int i;
+    for (i = 0; i < numThreads; ++i) {
+        Worker *worker = new Worker;
+        worker->pool = this;
+        worker->index = i;
+        worker->started = false;
+        pthread_mutex_init(&worker->lock, 0);
+        _workers.push_back(worker);
+    }
+
+    // a thread that cannot be started leaves its deque to the others
+
+    _numRunning = 1;
+    for (i = 1; i < numThreads; ++i) {
+        Worker *worker = _workers[i];
+        worker->started =
+            (pthread_create(&worker->thread, 0, runWorker, worker) == 0);
+        if (worker->started)
+            ++_numRunning;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+ThreadPool::~ThreadPool()
+{
+    pthread_mutex_lock(&_lock);
+    _quit = true;
+    pthread_cond_broadcast(&_changed);
+    pthread_mutex_unlock(&_lock);
+
+    unsigned int i;
+    for (i = 1; i < _workers.size(); ++i)
+        if (_workers[i]->started)
+            pthread_join(_workers[i]->thread, 0);
+
+    // tasks left on the deques of threads that never started
+    wait();
+
+    for (i = 0; i < _workers.size(); ++i) {
+        pthread_mutex_destroy(&_workers[i]->lock);
+        delete _workers[i];
+    }
+
+    pthread_cond_destroy(&_changed);
+    pthread_mutex_destroy(&_lock);
+    pthread_key_delete(_self);
+}
+
+//----------------------------------------------------------------------------
+
+bool ThreadPool::setAffinity(const std::vector<int> &cpus)
+{
+#ifdef __linux__
+    int numCpus = numProcessors();
+    bool ok = true;
+    for (unsigned int i = 1; i < _workers.size(); ++i) {
+        if (! _workers[i]->started)
+            continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (cpus.empty()) {
+            for (int cpu = 0; cpu < numCpus && cpu < CPU_SETSIZE; ++cpu)
+                CPU_SET(cpu, &set);
+        } else
+            CPU_SET(cpus[(i - 1) % cpus.size()], &set);
+        if (pthread_setaffinity_np(
+                _workers[i]->thread, sizeof(set), &set) != 0)
+            ok = false;
+    }
+    return ok;
+#else
+    return false;
+#endif
+}
+
+//----------------------------------------------------------------------------
+
+void ThreadPool::submit(Task *task)
+{
+    // a task submitted by a task stays on its thread, where it is
+    // likely to find the data of its parent in the cache
+
+    Worker *worker = (Worker *)pthread_getspecific(_self);
+    if (! worker || worker->pool != this) {
+        pthread_mutex_lock(&_lock);
+        worker = _workers[_next];
+        _next = (_next + 1) % (int)_workers.size();
+        pthread_mutex_unlock(&_lock);
+    }
+
+    // count the task before it can be taken, or a thread that steals
+    // and finishes it at once could bring _pending to zero while the
+    // task that submitted it is still running
+
+    pthread_mutex_lock(&_lock);
+    ++_queued;
+    ++_pending;
+    pthread_mutex_unlock(&_lock);
+
+    pthread_mutex_lock(&worker->lock);
+    worker->tasks.push_back(task);
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_mutex_lock(&_lock);
+    pthread_cond_broadcast(&_changed);
+    pthread_mutex_unlock(&_lock);
+}
+
+//----------------------------------------------------------------------------
+
+void ThreadPool::wait()
+{
+    void *outer = pthread_getspecific(_self);
+    pthread_setspecific(_self, _workers[0]);
+
+    while (1) {
+        Task *task = take(0);
+        if (task) {
+            task->run();
+            finish();
+            continue;
+        }
+
+        pthread_mutex_lock(&_lock);
+        while (_queued == 0 && _pending != 0)
+            pthread_cond_wait(&_changed, &_lock);
+        bool done = (_pending == 0);
+        pthread_mutex_unlock(&_lock);
+        if (done)
+            break;
+    }
+
+    pthread_setspecific(_self, outer);
+}
+
+//----------------------------------------------------------------------------
+
+bool ThreadPool::runOne()
+{
+    Task *task = take(0);
+    if (! task)
+        return false;
+
+    void *outer = pthread_getspecific(_self);
+    pthread_setspecific(_self, _workers[0]);
+    task->run();
+    pthread_setspecific(_self, outer);
+    finish();
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+int ThreadPool::numProcessors()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count >= 1 ? (int)count : 1);
+}
+
+//----------------------------------------------------------------------------
+
+void *ThreadPool::runWorker(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    ThreadPool *pool = worker->pool;
+    pthread_setspecific(pool->_self, worker);
+
+    while (1) {
+        Task *task = pool->take(worker->index);
+        if (task) {
+            task->run();
+            pool->finish();
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->_lock);
+        while (pool->_queued == 0 && ! pool->_quit)
+            pthread_cond_wait(&pool->_changed, &pool->_lock);
+        bool quit = (pool->_queued == 0 && pool->_quit);
+        pthread_mutex_unlock(&pool->_lock);
+        if (quit)
+            break;
+    }
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+
+ThreadPool::Task *ThreadPool::take(int index)
+{
+    int n = (int)_workers.size();
+    Task *task = 0;
+
+    Worker *worker = _workers[index];
+    pthread_mutex_lock(&worker->lock);
+    if (! worker->tasks.empty()) {
+        task = worker->tasks.back();
+        worker->tasks.pop_back();
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    for (int i = 1; ! task && i < n; ++i) {
+        Worker *victim = _workers[(index + i) % n];
+        pthread_mutex_lock(&victim->lock);
+        if (! victim->tasks.empty()) {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    if (task) {
+        pthread_mutex_lock(&_lock);
+        --_queued;
+        pthread_mutex_unlock(&_lock);
+    }
+    return task;
+}
+
+//----------------------------------------------------------------------------
+
+void ThreadPool::finish()
+{
+    pthread_mutex_lock(&_lock);
+    if (--_pending == 0)
+        pthread_cond_broadcast(&_changed);
+    pthread_mutex_unlock(&_lock);
+}
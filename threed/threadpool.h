@@ -0,0 +1,133 @@
+//----------------------------------------------------------------------------
+// ThreeD Work-Stealing Thread Pool
+//----------------------------------------------------------------------------
+
+#ifndef _THREED_THREADPOOL_H
+#define _THREED_THREADPOOL_H
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+namespace ThreeD {
+
+
+/**
+ * ThreadPool, a set of threads that run tasks, with work stealing
+ *
+ * Each thread of the pool keeps a deque of tasks.  A thread runs its
+ * own tasks newest first, and once it runs out, takes the oldest task
+ * of another thread, so the threads that drew cheap tasks (bricks
+ * far from the surface) take over from those held up by costly ones.
+ * Tasks submitted from outside the pool are dealt to the threads in
+ * turn; tasks submitted by a running task go to its own thread.
+ *
+ * The thread that calls wait() runs tasks too, as thread 0, so a pool
+ * of N threads starts N - 1 threads of its own, and a pool of one runs
+ * every task inside wait().
+ *
+ * A pool is meant to be made once and handed to the meshers and
+ * passes that take one (see IsoMesher::setThreadPool()), which keeps
+ * its threads alive between calls.  One caller at a time submits
+ * tasks and waits for them.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * Task, a unit of work.  The pool does not destroy tasks.
+     */
+    class Task
+    {
+    public:
+        virtual ~Task() {}
+        virtual void run() = 0;
+    };
+
+    /** Construct a pool of @p numThreads threads, counting the thread
+     *  that waits; zero for one per processor
+     */
+    ThreadPool(int numThreads = 0);
+
+    /** destructor.  The threads finish the tasks queued, and stop.
+     */
+    ~ThreadPool();
+
+    /** @return the number of threads, counting the thread that waits
+     */
+    int numThreads() const { return (int)_workers.size(); }
+
+    /** @return the number of threads that run tasks:  the thread that
+     *  waits, and those of the pool that could be started
+     */
+    int numRunning() const { return _numRunning; }
+
+    /** Pin the threads of the pool to processors:  thread i, from 1,
+     *  to processor cpus[(i - 1) % cpus.size()].  The thread that
+     *  waits is left alone.  An empty list lets the threads run on any
+     *  processor again.
+     *
+     *  @return false if the system does not support it, or refused
+     */
+    bool setAffinity(const std::vector<int> &cpus);
+
+    /** Queue @p task to run on some thread of the pool
+     */
+    void submit(Task *task);
+
+    /** Run tasks on the calling thread until all the tasks submitted
+     *  are done
+     */
+    void wait();
+
+    /** Run one task on the calling thread, as thread 0, for a caller
+     *  that waits on something other than wait()
+     *
+     *  @return false if no task was queued
+     */
+    bool runOne();
+
+    /** @return the number of processors online
+     */
+    static int numProcessors();
+
+private:
+    struct Worker {
+        ThreadPool *pool;
+        int index;
+        pthread_t thread;
+        bool started;
+        pthread_mutex_t lock;           // of the deque
+        std::deque<Task *> tasks;
+    };
+
+    static void *runWorker(void *arg);
+
+    /** Take a task for thread @p index:  its own newest, or the
+     *  oldest task of the next thread that has one.  @return 0 if
+     *  no thread has a task
+     */
+    Task *take(int index);
+
+    /** Count a task as done
+     */
+    void finish();
+
+    /*
+     * data
+     */
+
+    std::vector<Worker *> _workers;     // 0 is the thread that waits
+    int _numRunning;                    // 1 + the threads started
+    pthread_key_t _self;                // Worker of the current thread
+    pthread_mutex_t _lock;              // of the counts below
+    pthread_cond_t _changed;            // a task queued, or all done
+    int _queued;                        // tasks in the deques
+    int _pending;                       // tasks submitted, not done
+    int _next;                          // thread to deal the next task to
+    bool _quit;
+};
+
+
+} // namespace ThreeD
+#endif // _THREED_THREADPOOL_H
@@ -8,13 +8,21 @@
 #include <threed/object.h>
 #include <threed/matrix.h>
 #include <threed/transform.h>
+#include <threed/materialpalette.h>
 #include <threed/mesh.h>
 #include <threed/meshface.h>
+#include <threed/mesh_opt.h>
+#include <threed/mesh_codec.h>
 #include <threed/isosurface.h>
 #include <threed/csgisosurface.h>
+#include <threed/sdfisosurface.h>
 #include <threed/isomesher.h>
 #include <threed/isomesher_dc.h>
 #include <threed/isomesher_mc.h>
+#include <threed/isomesher_brick.h>
+#include <threed/densitycache.h>
+#include <threed/threadpool.h>
 #include <threed/world.h>
 #include <threed/camera.h>
+#include <threed/frustum.h>
 #include <threed/lightsource.h>
@@ -3,6 +3,7 @@
 //----------------------------------------------------------------------------
 
 #include <threed/world.h>
+#include <threed/frustum.h>
 #include <threed/opengl.h>
 #include <threed/mesh.h>
 #include <OpenGL/glu.h>
@@ -27,10 +28,37 @@ void WorldLink::draw()
 
 //----------------------------------------------------------------------------
 
+bool WorldLink::getWorldBounds(BoundingBox *bbox)
+{
+    if (! _boundsCached) {
+        Vector v1, v2;
+        _obj->getBoundingBox(&v1, &v2);
+        // an empty mesh has its minimum above its maximum
+        _boundsEmpty = (v1.x() > v2.x());
+        _bounds.set(v1, v2);
+        _boundsCached = true;
+    }
+    if (_boundsEmpty)
+        return false;
+
+    // as in draw()
+    Transform trans(*this);
+    trans.translate(_location);
+
+    *bbox = _bounds;
+    bbox->transform(trans);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
 World::World()
 {
     _inSelection = false;
     _enableLights = true;
+    _culling = true;
+    _drawStats.drawn = 0;
+    _drawStats.culled = 0;
 }
 
 //----------------------------------------------------------------------------
@@ -138,14 +166,36 @@ void World::draw()
     double cameraMatrix[16];
     glGetDoublev(GL_MODELVIEW_MATRIX, cameraMatrix);
 
+    // the view volume in world coordinates, where the links place
+    // their objects.  In selection, it is the volume of the pick
+    // matrix, which no object outside it can be picked in
+
+    Frustum frustum;
+    if (_culling) {
+        double projectionMatrix[16];
+        glGetDoublev(GL_PROJECTION_MATRIX, projectionMatrix);
+        frustum.extract(projectionMatrix, cameraMatrix);
+    }
+
+    _drawStats.drawn = 0;
+    _drawStats.culled = 0;
+
     std::list<WorldLink *>::iterator it = _links.begin();
     while (it != _links.end()) {
         WorldLink *link = (*it);
         ++it;
+        if (_culling) {
+            BoundingBox bbox;
+            if (! link->getWorldBounds(&bbox) || frustum.outside(bbox)) {
+                ++_drawStats.culled;
+                continue;
+            }
+        }
         if (_inSelection)
             glLoadName(link->id);
         glLoadMatrixd(cameraMatrix);
         link->draw();
+        ++_drawStats.drawn;
     }
 }
 
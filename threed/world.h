@@ -10,6 +10,7 @@
 #include <threed/object.h>
 #include <threed/transform.h>
 #include <threed/lightsource.h>
+#include <threed/boundingbox.h>
 #include <list>
 
 namespace ThreeD {
@@ -18,17 +19,36 @@ class WorldLink : public Transform
 {
 public:
     WorldLink(Object *obj, const Vector &loc)
-        : Transform(), _obj(obj), _location(loc)
+        : Transform(), _obj(obj), _location(loc), _boundsCached(false)
         { };
     
     Object *object() const { return _obj; }
 
     inline void draw();
+
+    /**
+     * Finds the bounding box of the object in world coordinates, from
+     * the bounding box of the object, which is cached, put through
+     * the transform of this link.
+     *
+     * @return false if the object is empty.
+     */
+    bool getWorldBounds(BoundingBox *bbox);
+
+    /**
+     * Drops the cached bounding box, after the object changed.
+     */
+    void invalidateBounds() { _boundsCached = false; }
+
     int id;
         
 protected:
     Object *_obj;
     Vector _location;
+
+    BoundingBox _bounds;            // of the object, if cached
+    bool _boundsCached;
+    bool _boundsEmpty;
 };
 
 
@@ -38,6 +58,12 @@ protected:
 class World
 {
 public:
+    /** Objects drawn and culled by the last draw() */
+    struct DrawStats {
+        int drawn;
+        int culled;
+    };
+
     /**
      * Constructor.
      *
@@ -99,12 +125,27 @@ public:
     void eraseLights();
 
     /**
-     * Draws this world, that is, each child Object.
+     * Draws this world, that is, each child Object.  With culling, the
+     * objects whose bounding boxes lie outside the view volume of the
+     * current projection and modelview matrices are skipped.
      *
      * Note:  any parameters that should affect the output should be
      * effected into OpenGL prior to the invocation of this method.
      */
     virtual void draw();
+
+    /**
+     * Enables or disables culling of the objects outside the view
+     * volume.  Culling is enabled by default.  After changing the
+     * shape of an object, call WorldLink::invalidateBounds().
+     */
+    void setCulling(bool culling) { _culling = culling; }
+
+    /**
+     * @return the numbers of objects drawn and culled by the last
+     * draw().
+     */
+    const DrawStats &drawStats() const { return _drawStats; }
     
     /**
      * Returns the bounding box for this object.  The origin of the box is
@@ -140,6 +181,9 @@ protected:
 
     bool _enableLights;
     std::list<LightSource> _lightSources;
+
+    bool _culling;
+    DrawStats _drawStats;
 };
 
 